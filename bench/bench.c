@@ -0,0 +1,437 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "http.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+
+/*
+ * drives discord_http against the mock server (see Makefile)
+ * and reports throughput, latency percentiles and allocations per request
+ *
+ * concurrency 1 runs blocking discord_http_request calls, higher levels run
+ * twice, once keeping that many discord_http_request_async calls in flight
+ * and once with that many threads calling discord_http_request on a
+ * thread_safe client
+ */
+
+#define BENCH_PATH_LENGTH 256
+#define BENCH_LEVELS 16
+
+typedef struct bench_options {
+    size_t requests;
+    size_t levels[BENCH_LEVELS];
+    size_t levels_length;
+    const char *base_url;
+    const char *path;
+    double global_rate;
+    const char *ca_file;
+} bench_options;
+
+typedef enum bench_mode {
+    BENCH_SYNC,
+    BENCH_ASYNC
+} bench_mode;
+
+typedef struct bench_run bench_run;
+
+typedef struct bench_slot {
+    bench_run *run;
+    uint64_t start;
+} bench_slot;
+
+struct bench_run {
+    discord_http *http;
+    const bench_options *options;
+    size_t concurrency;
+
+    /* shared by the worker threads of sync levels */
+    atomic_size_t issued;
+    atomic_size_t completed;
+    atomic_size_t errors;
+
+    bench_slot *slots;
+    uint64_t *latencies;
+};
+
+/* counts every allocation in the process, libcurl and json-c included */
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+
+static atomic_size_t allocations = 0;
+
+void *malloc(size_t size){
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size){
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size){
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+
+    return __libc_realloc(ptr, size);
+}
+
+static size_t get_allocations(void){
+    return atomic_load_explicit(&allocations, memory_order_relaxed);
+}
+#else
+static size_t get_allocations(void){
+    return 0;
+}
+#endif
+
+static uint64_t get_time_us(void){
+    struct timespec ts = {0};
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static int compare_latencies(const void *a, const void *b){
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * a distinct query per request keeps identical GETs from being coalesced,
+ * they all still share one bucket, so throughput runs lift the mock's limit
+ */
+static void write_request_path(const bench_run *run, size_t index, char *path, size_t size){
+    const char *base = run->options->path;
+
+    snprintf(path, size, "%s%ci=%zu", base, strchr(base, '?') ? '&' : '?', index);
+}
+
+static void record_response(bench_run *run, size_t index, discord_http_response *response){
+    run->latencies[index] = get_time_us() - run->slots[index].start;
+
+    if (!response || response->status >= 400){
+        run->errors += 1;
+    }
+
+    if (response){
+        discord_http_response_free(response);
+    }
+
+    run->completed += 1;
+}
+
+static void issue_requests(bench_run *);
+
+static void handle_response(discord_http *http, discord_http_response *response, void *slotptr){
+    (void)http;
+
+    bench_slot *slot = slotptr;
+    bench_run *run = slot->run;
+
+    record_response(run, slot - run->slots, response);
+    issue_requests(run);
+}
+
+static void issue_requests(bench_run *run){
+    char path[BENCH_PATH_LENGTH];
+
+    while (run->issued < run->options->requests && run->issued - run->completed < run->concurrency){
+        size_t index = run->issued++;
+
+        run->slots[index].run = run;
+        run->slots[index].start = get_time_us();
+
+        write_request_path(run, index, path, sizeof(path));
+
+        bool success = discord_http_request_async(
+            run->http,
+            DISCORD_HTTP_GET,
+            path,
+            NULL,
+            handle_response,
+            &run->slots[index]
+        );
+
+        if (!success){
+            record_response(run, index, NULL);
+        }
+    }
+}
+
+static void *run_blocking(void *runptr){
+    bench_run *run = runptr;
+    char path[BENCH_PATH_LENGTH];
+
+    for (;;){
+        size_t index = run->issued++;
+
+        if (index >= run->options->requests){
+            break;
+        }
+
+        run->slots[index].start = get_time_us();
+
+        write_request_path(run, index, path, sizeof(path));
+
+        record_response(run, index, discord_http_request(run->http, DISCORD_HTTP_GET, path, NULL));
+    }
+
+    return NULL;
+}
+
+static bool run_sync(bench_run *run){
+    if (run->concurrency == 1){
+        run_blocking(run);
+
+        return true;
+    }
+
+    pthread_t *threads = calloc(run->concurrency, sizeof(*threads));
+
+    if (!threads){
+        fprintf(stderr, "alloc for %zu threads failed\n", run->concurrency);
+
+        return false;
+    }
+
+    size_t started = 0;
+
+    while (started < run->concurrency && !pthread_create(&threads[started], NULL, run_blocking, run)){
+        started += 1;
+    }
+
+    if (started < run->concurrency){
+        fprintf(stderr, "pthread_create call failed after %zu threads\n", started);
+    }
+
+    /* the threads already started still finish every request */
+    for (size_t index = 0; index < started; ++index){
+        pthread_join(threads[index], NULL);
+    }
+
+    free(threads);
+
+    return started == run->concurrency;
+}
+
+static bool run_async(bench_run *run){
+    issue_requests(run);
+
+    while (run->completed < run->options->requests){
+        if (!discord_http_perform(run->http, -1)){
+            fprintf(stderr, "discord_http_perform call failed\n");
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool run_level(const bench_options *options, size_t concurrency, bench_mode mode){
+    discord_http_options hopts = {0};
+    hopts.global_rate = options->global_rate;
+    hopts.base_url = options->base_url;
+    hopts.ca_file = options->ca_file;
+    hopts.thread_safe = mode == BENCH_SYNC && concurrency > 1;
+
+    discord_http *http = discord_http_init("mock-token", &hopts);
+
+    if (!http){
+        fprintf(stderr, "discord_http_init call failed\n");
+
+        return false;
+    }
+
+    bench_run run = {0};
+    run.http = http;
+    run.options = options;
+    run.concurrency = concurrency;
+    run.slots = calloc(options->requests, sizeof(*run.slots));
+    run.latencies = calloc(options->requests, sizeof(*run.latencies));
+
+    if (!run.slots || !run.latencies){
+        fprintf(stderr, "alloc for %zu requests failed\n", options->requests);
+
+        free(run.slots);
+        free(run.latencies);
+        discord_http_free(http);
+
+        return false;
+    }
+
+    size_t allocated = get_allocations();
+    uint64_t start = get_time_us();
+
+    bool success = mode == BENCH_ASYNC ? run_async(&run) : run_sync(&run);
+
+    uint64_t elapsed = get_time_us() - start;
+
+    allocated = get_allocations() - allocated;
+
+    if (success){
+        size_t completed = run.completed;
+        size_t errors = run.errors;
+
+        qsort(run.latencies, completed, sizeof(*run.latencies), compare_latencies);
+
+        discord_http_stats stats = {0};
+        discord_http_get_stats(http, &stats);
+
+        size_t p50 = completed ? (completed - 1) * 50 / 100 : 0;
+        size_t p99 = completed ? (completed - 1) * 99 / 100 : 0;
+
+        printf(
+            "%-6s %6zu %9zu %7zu %11.1f %9.3f %9.3f %11.1f %6zu %6zu\n",
+            mode == BENCH_ASYNC ? "async" : "sync",
+            concurrency,
+            completed,
+            errors,
+            elapsed ? completed * 1e6 / elapsed : 0,
+            completed ? run.latencies[p50] / 1000.0 : 0,
+            completed ? run.latencies[p99] / 1000.0 : 0,
+            completed ? (double)allocated / completed : 0,
+            stats.connections_created,
+            stats.retries
+        );
+
+        discord_http_stats_free(&stats);
+    }
+
+    free(run.slots);
+    free(run.latencies);
+
+    discord_http_free(http);
+
+    return success;
+}
+
+static bool parse_levels(bench_options *options, char *value){
+    options->levels_length = 0;
+
+    for (char *token = strtok(value, ","); token; token = strtok(NULL, ",")){
+        long level = strtol(token, NULL, 10);
+
+        if (level < 1 || options->levels_length == BENCH_LEVELS){
+            return false;
+        }
+
+        options->levels[options->levels_length++] = (size_t)level;
+    }
+
+    return options->levels_length;
+}
+
+static void print_usage(const char *name){
+    fprintf(
+        stderr,
+        "usage: %s [-n requests] [-c concurrency,...] [-u base url] [-p path]\n"
+        "          [-g global rate] [-a ca file]\n"
+        "base url defaults to %s\n",
+        name,
+        DISCORD_API
+    );
+}
+
+int main(int argc, char **argv){
+    bench_options options = {
+        .requests = 1000,
+        .levels = {1, 8, 32, 128},
+        .levels_length = 4,
+        .path = "/users/@me",
+        .global_rate = 1e6
+    };
+
+    int opt = 0;
+
+    while ((opt = getopt(argc, argv, "n:c:u:p:g:a:h")) != -1){
+        switch (opt){
+        case 'n':
+            options.requests = strtoul(optarg, NULL, 10);
+
+            break;
+        case 'c':
+            if (!parse_levels(&options, optarg)){
+                print_usage(argv[0]);
+
+                return EXIT_FAILURE;
+            }
+
+            break;
+        case 'u':
+            options.base_url = optarg;
+
+            break;
+        case 'p':
+            options.path = optarg;
+
+            break;
+        case 'g':
+            options.global_rate = atof(optarg);
+
+            break;
+        case 'a':
+            options.ca_file = optarg;
+
+            break;
+        default:
+            print_usage(argv[0]);
+
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (!options.requests){
+        print_usage(argv[0]);
+
+        return EXIT_FAILURE;
+    }
+
+    printf(
+        "%s%s, %zu requests per level\n\n",
+        options.base_url ? options.base_url : DISCORD_API,
+        options.path,
+        options.requests
+    );
+    printf(
+        "%-6s %6s %9s %7s %11s %9s %9s %11s %6s %6s\n",
+        "mode",
+        "conc",
+        "requests",
+        "errors",
+        "req/s",
+        "p50 ms",
+        "p99 ms",
+        "allocs/req",
+        "conns",
+        "retry"
+    );
+
+    bool success = true;
+
+    for (size_t index = 0; index < options.levels_length; ++index){
+        size_t concurrency = options.levels[index];
+
+        if (concurrency > 1){
+            success = run_level(&options, concurrency, BENCH_ASYNC) && success;
+        }
+
+        success = run_level(&options, concurrency, BENCH_SYNC) && success;
+    }
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,478 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <inttypes.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+
+#include <libwebsockets.h>
+
+/*
+ * stand-in for the Discord REST API, answers every route with a small json
+ * body and per-route X-RateLimit-* headers
+ *
+ * serves HTTP/1.1, and HTTP/2 as well when given a certificate (negotiated
+ * over ALPN, libcurl only speaks HTTP/2 over TLS)
+ */
+
+#define MOCK_BUCKETS 256
+#define MOCK_BUCKET_KEY_LENGTH 128
+#define MOCK_PATH_LENGTH 256
+#define MOCK_BODY_LENGTH 512
+#define MOCK_HEADERS_LENGTH 1024
+#define MOCK_VALUE_LENGTH 64
+
+typedef struct mock_options {
+    int port;
+    int latency;
+    int jitter;
+    int limit;
+    int window;
+    double inject;
+    const char *cert;
+    const char *key;
+} mock_options;
+
+typedef struct mock_bucket {
+    char key[MOCK_BUCKET_KEY_LENGTH];
+    uint64_t hash;
+    int remaining;
+    uint64_t reset;
+} mock_bucket;
+
+typedef enum mock_stage {
+    MOCK_STAGE_BODY_PENDING,
+    MOCK_STAGE_WAITING,
+    MOCK_STAGE_HEADERS,
+    MOCK_STAGE_BODY
+} mock_stage;
+
+typedef struct mock_session {
+    mock_stage stage;
+    int method;
+    char path[MOCK_PATH_LENGTH];
+
+    unsigned int status;
+    const mock_bucket *bucket;
+    int remaining;
+    uint64_t reset;
+    double retry_after;
+    bool shared;
+
+    unsigned char body[LWS_PRE + MOCK_BODY_LENGTH];
+    size_t length;
+} mock_session;
+
+static mock_options options = {
+    .port = 8080,
+    .limit = 50,
+    .window = 1000
+};
+
+static mock_bucket buckets[MOCK_BUCKETS];
+static size_t buckets_length = 0;
+
+static uint64_t requests = 0;
+static uint64_t limited = 0;
+
+static volatile sig_atomic_t interrupted = 0;
+
+static int handle_mock_event(struct lws *, enum lws_callback_reasons, void *, void *, size_t);
+
+static const struct lws_protocols lwsprotocols[] = {
+    {
+        "handle_mock_event",
+        &handle_mock_event,
+        sizeof(mock_session),
+        0,
+        0,
+        NULL,
+        0
+    },
+
+    LWS_PROTOCOL_LIST_TERM
+};
+
+static uint64_t get_time_ms(void){
+    struct timespec ts = {0};
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* FNV-1a, stands in for the opaque X-RateLimit-Bucket hash */
+static uint64_t hash_key(const char *key){
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (; *key; ++key){
+        hash ^= (unsigned char)*key;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/* one bucket per method and major route, e.g. 0 channels/123 */
+static mock_bucket *get_bucket(int method, const char *path){
+    const char *route = path;
+
+    if (!strncmp(route, "/api/", 5)){
+        route = strchr(route + 5, '/');
+        route = route ? route + 1 : "";
+    }
+
+    size_t length = strcspn(route, "/?");
+
+    if (route[length] == '/'){
+        length += 1 + strcspn(route + length + 1, "/?");
+    }
+
+    char key[MOCK_BUCKET_KEY_LENGTH];
+    snprintf(key, sizeof(key), "%d %.*s", method, (int)length, route);
+
+    for (size_t index = 0; index < buckets_length; ++index){
+        if (!strcmp(buckets[index].key, key)){
+            return &buckets[index];
+        }
+    }
+
+    /* full table, everything else shares the last bucket */
+    if (buckets_length == MOCK_BUCKETS){
+        return &buckets[MOCK_BUCKETS - 1];
+    }
+
+    mock_bucket *bucket = &buckets[buckets_length++];
+
+    memcpy(bucket->key, key, sizeof(key));
+    bucket->hash = hash_key(key);
+    bucket->remaining = options.limit;
+
+    return bucket;
+}
+
+static void take_bucket(mock_session *session){
+    uint64_t now = get_time_ms();
+    mock_bucket *bucket = get_bucket(session->method, session->path);
+
+    if (now >= bucket->reset){
+        bucket->remaining = options.limit;
+        bucket->reset = now + options.window;
+    }
+
+    session->bucket = bucket;
+    session->reset = bucket->reset;
+    session->status = session->method == LWSHUMETH_DELETE ? 204 : 200;
+
+    requests += 1;
+
+    if (options.inject > 0 && rand() < options.inject * RAND_MAX){
+        session->status = 429;
+        session->retry_after = 0.05;
+        session->shared = true;
+    }
+    else if (bucket->remaining <= 0){
+        session->status = 429;
+        session->retry_after = (bucket->reset - now) / 1000.0;
+    }
+    else {
+        bucket->remaining -= 1;
+    }
+
+    session->remaining = bucket->remaining;
+
+    if (session->status == 429){
+        limited += 1;
+    }
+}
+
+static void write_body(mock_session *session){
+    char *body = (char *)session->body + LWS_PRE;
+    int length = 0;
+
+    if (session->status == 429){
+        length = snprintf(
+            body,
+            MOCK_BODY_LENGTH,
+            "{\"message\":\"You are being rate limited.\",\"retry_after\":%.3f,\"global\":false}",
+            session->retry_after
+        );
+    }
+    else if (session->status == 204){
+        length = 0;
+    }
+    else if (session->method == LWSHUMETH_GET && strstr(session->path, "/messages") && !strstr(session->path, "/messages/")){
+        length = snprintf(body, MOCK_BODY_LENGTH, "[]");
+    }
+    else {
+        length = snprintf(
+            body,
+            MOCK_BODY_LENGTH,
+            "{\"id\":\"%" PRIu64 "\",\"username\":\"mock\",\"discriminator\":\"0000\"}",
+            requests
+        );
+    }
+
+    session->length = length > 0 && length < MOCK_BODY_LENGTH ? (size_t)length : 0;
+}
+
+static bool add_header(struct lws *wsi, const char *name, const char *value, unsigned char **p, unsigned char *end){
+    return !lws_add_http_header_by_name(
+        wsi,
+        (const unsigned char *)name,
+        (const unsigned char *)value,
+        (int)strlen(value),
+        p,
+        end
+    );
+}
+
+static bool write_headers(struct lws *wsi, mock_session *session){
+    unsigned char buffer[LWS_PRE + MOCK_HEADERS_LENGTH];
+    unsigned char *start = buffer + LWS_PRE;
+    unsigned char *p = start;
+    unsigned char *end = buffer + sizeof(buffer) - 1;
+
+    const char *type = session->length ? "application/json" : NULL;
+
+    if (lws_add_http_common_headers(wsi, session->status, type, session->length, &p, end)){
+        return false;
+    }
+
+    uint64_t now = get_time_ms();
+    double resetafter = session->reset > now ? (session->reset - now) / 1000.0 : 0;
+
+    char limit[MOCK_VALUE_LENGTH];
+    char remaining[MOCK_VALUE_LENGTH];
+    char reset[MOCK_VALUE_LENGTH];
+    char reset_after[MOCK_VALUE_LENGTH];
+    char bucket[MOCK_VALUE_LENGTH];
+
+    snprintf(limit, sizeof(limit), "%d", options.limit);
+    snprintf(remaining, sizeof(remaining), "%d", session->remaining);
+    snprintf(reset, sizeof(reset), "%.3f", session->reset / 1000.0);
+    snprintf(reset_after, sizeof(reset_after), "%.3f", resetafter);
+    snprintf(bucket, sizeof(bucket), "%016" PRIx64, session->bucket->hash);
+
+    bool success = add_header(wsi, "x-ratelimit-limit:", limit, &p, end)
+        && add_header(wsi, "x-ratelimit-remaining:", remaining, &p, end)
+        && add_header(wsi, "x-ratelimit-reset:", reset, &p, end)
+        && add_header(wsi, "x-ratelimit-reset-after:", reset_after, &p, end)
+        && add_header(wsi, "x-ratelimit-bucket:", bucket, &p, end);
+
+    if (success && session->status == 429){
+        char retry_after[MOCK_VALUE_LENGTH];
+        snprintf(retry_after, sizeof(retry_after), "%d", (int)session->retry_after + 1);
+
+        success = add_header(wsi, "retry-after:", retry_after, &p, end)
+            && add_header(wsi, "x-ratelimit-scope:", session->shared ? "shared" : "user", &p, end);
+    }
+
+    return success && !lws_finalize_write_http_header(wsi, start, &p, end);
+}
+
+/* takes the request off the bucket and answers it after the configured latency */
+static void schedule_response(struct lws *wsi, mock_session *session){
+    take_bucket(session);
+    write_body(session);
+
+    int latency = options.latency;
+
+    if (options.jitter > 0){
+        latency += rand() % (options.jitter + 1);
+    }
+
+    session->stage = MOCK_STAGE_WAITING;
+
+    if (latency > 0){
+        lws_set_timer_usecs(wsi, (lws_usec_t)latency * LWS_US_PER_MS);
+    }
+    else {
+        session->stage = MOCK_STAGE_HEADERS;
+
+        lws_callback_on_writable(wsi);
+    }
+}
+
+static int handle_mock_event(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len){
+    mock_session *session = user;
+
+    switch (reason){
+    case LWS_CALLBACK_HTTP: {
+        char *uri = NULL;
+        int urilength = 0;
+
+        memset(session, 0, sizeof(*session));
+
+        session->method = lws_http_get_uri_and_method(wsi, &uri, &urilength);
+        snprintf(session->path, sizeof(session->path), "%s", (const char *)in);
+
+        /* answered once the body is in */
+        if (lws_hdr_total_length(wsi, WSI_TOKEN_HTTP_CONTENT_LENGTH) > 0){
+            session->stage = MOCK_STAGE_BODY_PENDING;
+
+            return 0;
+        }
+
+        schedule_response(wsi, session);
+
+        return 0;
+    }
+    case LWS_CALLBACK_HTTP_BODY:
+        return 0;
+    case LWS_CALLBACK_HTTP_BODY_COMPLETION:
+        if (session->stage == MOCK_STAGE_BODY_PENDING){
+            schedule_response(wsi, session);
+        }
+
+        return 0;
+    case LWS_CALLBACK_TIMER:
+        session->stage = MOCK_STAGE_HEADERS;
+
+        lws_callback_on_writable(wsi);
+
+        return 0;
+    case LWS_CALLBACK_HTTP_WRITEABLE:
+        /* one write per writeable callback, HTTP/2 needs it that way */
+        if (session->stage == MOCK_STAGE_HEADERS){
+            if (!write_headers(wsi, session)){
+                return 1;
+            }
+
+            session->stage = MOCK_STAGE_BODY;
+
+            lws_callback_on_writable(wsi);
+
+            return 0;
+        }
+        else if (session->stage != MOCK_STAGE_BODY){
+            return 0;
+        }
+
+        if (lws_write(wsi, session->body + LWS_PRE, session->length, LWS_WRITE_HTTP_FINAL) < 0){
+            return 1;
+        }
+
+        return lws_http_transaction_completed(wsi) ? -1 : 0;
+    default:
+        break;
+    }
+
+    return lws_callback_http_dummy(wsi, reason, user, in, len);
+}
+
+static void handle_signal(int signal){
+    (void)signal;
+
+    interrupted = 1;
+}
+
+static void print_usage(const char *name){
+    fprintf(
+        stderr,
+        "usage: %s [-p port] [-l latency ms] [-j jitter ms] [-b bucket limit]\n"
+        "          [-w bucket window ms] [-e 429 injection rate 0-1] [-c cert -k key]\n",
+        name
+    );
+}
+
+int main(int argc, char **argv){
+    int opt = 0;
+
+    while ((opt = getopt(argc, argv, "p:l:j:b:w:e:c:k:h")) != -1){
+        switch (opt){
+        case 'p':
+            options.port = atoi(optarg);
+
+            break;
+        case 'l':
+            options.latency = atoi(optarg);
+
+            break;
+        case 'j':
+            options.jitter = atoi(optarg);
+
+            break;
+        case 'b':
+            options.limit = atoi(optarg);
+
+            break;
+        case 'w':
+            options.window = atoi(optarg);
+
+            break;
+        case 'e':
+            options.inject = atof(optarg);
+
+            break;
+        case 'c':
+            options.cert = optarg;
+
+            break;
+        case 'k':
+            options.key = optarg;
+
+            break;
+        default:
+            print_usage(argv[0]);
+
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (!options.cert != !options.key){
+        fprintf(stderr, "both -c and -k are required for TLS\n");
+
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    lws_set_log_level(LLL_ERR | LLL_WARN, NULL);
+
+    struct lws_context_creation_info info = {0};
+    info.port = options.port;
+    info.protocols = lwsprotocols;
+
+    if (options.cert){
+        info.options |= LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT;
+        info.ssl_cert_filepath = options.cert;
+        info.ssl_private_key_filepath = options.key;
+        info.alpn = "h2,http/1.1";
+    }
+
+    struct lws_context *context = lws_create_context(&info);
+
+    if (!context){
+        fprintf(stderr, "lws_create_context call failed\n");
+
+        return EXIT_FAILURE;
+    }
+
+    printf(
+        "listening on %s://127.0.0.1:%d (latency %d+%d ms, %d requests per %d ms, 429 injection %.3f)\n",
+        options.cert ? "https" : "http",
+        options.port,
+        options.latency,
+        options.jitter,
+        options.limit,
+        options.window,
+        options.inject
+    );
+
+    fflush(stdout);
+
+    while (!interrupted && lws_service(context, 0) >= 0);
+
+    lws_context_destroy(context);
+
+    printf("%" PRIu64 " requests, %" PRIu64 " rate limited\n", requests, limited);
+
+    return EXIT_SUCCESS;
+}
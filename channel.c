@@ -200,7 +200,7 @@ bool channel_send_message(discord_channel *channel, const discord_message_reply
 
         return false;
     }
-    else if (!message->content && !message->embed && !message->embeds && !message->sticker_ids){
+    else if (!message->content && !message->embed && !message->embeds && !message->sticker_ids && !message->attachments){
         log_write(
             logger,
             LOG_WARNING,
@@ -224,7 +224,7 @@ bool channel_send_message(discord_channel *channel, const discord_message_reply
         return false;
     }
 
-    discord_http_response *res = discord_http_create_message(channel->state->http, channel->id, data);
+    discord_http_response *res = discord_http_create_message(channel->state->http, channel->id, data, message->attachments);
 
     json_object_put(data);
 
@@ -238,7 +238,7 @@ bool channel_send_message(discord_channel *channel, const discord_message_reply
             __FILE__
         );
 
-        success = channel->state->http->ratelimited;
+        success = false;
     }
     else if (res->status != 200){
         log_write(
@@ -255,6 +255,32 @@ bool channel_send_message(discord_channel *channel, const discord_message_reply
     return success;
 }
 
+bool channel_delete_messages(discord_channel *channel, const snowflake *ids, size_t length, const char *reason){
+    if (!channel){
+        log_write(
+            logger,
+            LOG_WARNING,
+            "[%s] channel_delete_messages() - channel is NULL\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    bool success = discord_http_delete_messages(channel->state->http, channel->id, ids, length, reason);
+
+    if (!success){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] channel_delete_messages() - discord_http_delete_messages call failed\n",
+            __FILE__
+        );
+    }
+
+    return success;
+}
+
 void channel_free(void *ptr){
     discord_channel *channel = ptr;
 
@@ -64,6 +64,7 @@ discord_channel *channel_init(discord_state *, json_object *);
 
 /* API calls */
 bool channel_send_message(discord_channel *, const discord_message_reply *);
+bool channel_delete_messages(discord_channel *, const snowflake *, size_t, const char *);
 
 void channel_free(void *);
 
@@ -44,6 +44,33 @@ static bool set_application_information(discord *client){
     return client->application ? true : false;
 }
 
+/* every shard carries the same presence */
+static bool send_presence_update(discord *client){
+    bool success = false;
+
+    /* shard threads may replace the presence while it is being copied */
+    state_lock(client->state);
+
+    if (client->shard_manager){
+        success = shard_manager_send(
+            client->shard_manager,
+            GATEWAY_OP_PRESENCE_UPDATE,
+            state_get_presence(client->state)
+        );
+    }
+    else {
+        success = gateway_send(
+            client->gateway,
+            GATEWAY_OP_PRESENCE_UPDATE,
+            state_get_presence(client->state)
+        );
+    }
+
+    state_unlock(client->state);
+
+    return success;
+}
+
 discord *discord_init(const char *token, const discord_options *opts){
     logger = opts ? opts->log : NULL;
 
@@ -78,8 +105,11 @@ discord *discord_init(const char *token, const discord_options *opts){
         sopts.log = opts->log;
         sopts.intent = opts->intent;
         sopts.max_messages = opts->max_messages;
+        sopts.http = opts->http;
+        sopts.thread_safe = opts->shards && opts->shard_threads > 0;
 
         gopts.compress = opts->compress;
+        gopts.encoding = opts->encoding;
         gopts.large_threshold = opts->large_threshold;
         gopts.events = opts->events;
     }
@@ -129,6 +159,30 @@ discord *discord_init(const char *token, const discord_options *opts){
         return NULL;
     }
 
+    if (opts && opts->shards){
+        discord_shard_manager_options smopts = {0};
+        smopts.shards = opts->shards;
+        smopts.threads = opts->shard_threads;
+        smopts.gateway = &gopts;
+
+        client->shard_manager = shard_manager_init(client->state, &smopts);
+
+        if (!client->shard_manager){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] discord_init() - shard manager initialization failed\n",
+                __FILE__
+            );
+
+            discord_free(client);
+
+            return NULL;
+        }
+
+        return client;
+    }
+
     client->gateway = gateway_init(client->state, &gopts);
 
     if (!client->gateway){
@@ -159,6 +213,21 @@ bool discord_connect_gateway(discord *client){
         return false;
     }
 
+    if (client->shard_manager){
+        if (!shard_manager_connect(client->shard_manager)){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] discord_connect_gateway() - shard_manager_connect call failed\n",
+                __FILE__
+            );
+
+            return false;
+        }
+
+        return shard_manager_run_loop(client->shard_manager);
+    }
+
     if (!gateway_connect(client->gateway)){
         log_write(
             logger,
@@ -185,7 +254,12 @@ void discord_disconnect_gateway(discord *client){
         return;
     }
 
-    gateway_disconnect(client->gateway);
+    if (client->shard_manager){
+        shard_manager_disconnect(client->shard_manager);
+    }
+    else {
+        gateway_disconnect(client->gateway);
+    }
 }
 
 bool discord_set_presence(discord *client, const discord_presence *presence){
@@ -216,17 +290,13 @@ bool discord_set_presence(discord *client, const discord_presence *presence){
         return false;
     }
 
-    success = gateway_send(
-        client->gateway,
-        GATEWAY_OP_PRESENCE_UPDATE,
-        state_get_presence(client->state)
-    );
+    success = send_presence_update(client);
 
     if (!success){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] discord_set_presence() - gateway_send call failed\n",
+            "[%s] discord_set_presence() - send_presence_update call failed\n",
             __FILE__
         );
     }
@@ -280,17 +350,13 @@ bool discord_modify_presence(discord *client, const time_t *since, const list *a
         }
     }
 
-    success = gateway_send(
-        client->gateway,
-        GATEWAY_OP_PRESENCE_UPDATE,
-        state_get_presence(client->state)
-    );
+    success = send_presence_update(client);
 
     if (!success){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] discord_modify_presence() - gateway_send call failed\n",
+            "[%s] discord_modify_presence() - send_presence_update call failed\n",
             __FILE__
         );
     }
@@ -316,14 +382,12 @@ const discord_user *discord_get_user(discord *client, snowflake id, bool fetch){
         discord_http_response *res = discord_http_get_user(client->state->http, id);
 
         if (!res){
-            if (!client->state->http->ratelimited){
-                log_write(
-                    logger,
-                    LOG_ERROR,
-                    "[%s] discord_get_user() - discord_http_get_user call failed\n",
-                    __FILE__
-                );
-            }
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] discord_get_user() - discord_http_get_user call failed\n",
+                __FILE__
+            );
 
             return NULL;
         }
@@ -373,7 +437,7 @@ bool discord_send_message(discord *client, snowflake channelid, const discord_me
 
         return false;
     }
-    else if (!message->content && !message->embed && !message->embeds && !message->sticker_ids){
+    else if (!message->content && !message->embed && !message->embeds && !message->sticker_ids && !message->attachments){
         log_write(
             logger,
             LOG_WARNING,
@@ -397,23 +461,21 @@ bool discord_send_message(discord *client, snowflake channelid, const discord_me
         return false;
     }
 
-    discord_http_response *res = discord_http_create_message(client->state->http, channelid, data);
+    discord_http_response *res = discord_http_create_message(client->state->http, channelid, data, message->attachments);
 
     json_object_put(data);
 
     bool success = true;
 
     if (!res){
-        if (!client->state->http->ratelimited){
-            log_write(
-                logger,
-                LOG_ERROR,
-                "[%s] discord_send_message() - discord_http_create_message call failed\n",
-                __FILE__
-            );
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] discord_send_message() - discord_http_create_message call failed\n",
+            __FILE__
+        );
 
-            success = false;
-        }
+        success = false;
     }
     else if (res->status != 200){
         log_write(
@@ -442,8 +504,10 @@ void discord_free(discord *client){
         return;
     }
 
-    state_free(client->state);
+    /* the gateway still references the state's http client */
     gateway_free(client->gateway);
+    shard_manager_free(client->shard_manager);
+    state_free(client->state);
 
     application_free(client->application);
 
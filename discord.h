@@ -2,6 +2,7 @@
 #define DISCORD_H
 
 #include "gateway.h"
+#include "shard.h"
 #include "state.h"
 
 typedef struct discord_options {
@@ -12,9 +13,16 @@ typedef struct discord_options {
 
     /* passthrough state options */
     size_t max_messages;
+    const discord_http_options *http;
+
+    /* 0 for a single connection, a count or DISCORD_GATEWAY_RECOMMENDED_SHARDS to shard */
+    int shards;
+    /* 0 runs every shard on the calling thread, otherwise the worker thread count */
+    int shard_threads;
 
     /* passthrough gateway options */
     bool compress;
+    discord_gateway_encoding encoding;
     int large_threshold;
     const discord_gateway_events *events;
 } discord_options;
@@ -22,6 +30,7 @@ typedef struct discord_options {
 typedef struct discord {
     discord_state *state;
     discord_gateway *gateway;
+    discord_shard_manager *shard_manager;
 
     discord_application *application;
     const discord_user *user;
@@ -35,6 +44,7 @@ void discord_disconnect_gateway(discord *);
 bool discord_set_presence(discord *, const discord_presence *);
 bool discord_modify_presence(discord *, const time_t *, const list *, const char *, const bool *);
 
+/* with shard_threads, hold state_lock while using the returned user */
 const discord_user *discord_get_user(discord *, snowflake, bool);
 
 bool discord_send_message(discord *, snowflake, const discord_message_reply *);
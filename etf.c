@@ -0,0 +1,762 @@
+#include "etf.h"
+
+#include "c-utils/log.h"
+#include "c-utils/str.h"
+
+#include <inttypes.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#define ETF_KEY_LENGTH 256
+#define ETF_WRITER_SIZE 512
+
+typedef struct etf_reader {
+    const unsigned char *data;
+    size_t length;
+    size_t offset;
+} etf_reader;
+
+typedef struct etf_writer {
+    unsigned char *data;
+    size_t length;
+    size_t size;
+} etf_writer;
+
+static bool decode_term(etf_reader *, int, json_object **);
+static bool encode_term(etf_writer *, json_object *, int);
+
+static bool set_output(json_object *obj, json_object **output){
+    if (!obj){
+        DLOG(
+            "[%s] set_output() - json object alloc failed\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    *output = obj;
+
+    return true;
+}
+
+static bool read_bytes(etf_reader *reader, size_t length, const unsigned char **output){
+    if (reader->length - reader->offset < length){
+        DLOG(
+            "[%s] read_bytes() - term truncated (%zu bytes needed, %zu left)\n",
+            __FILE__,
+            length,
+            reader->length - reader->offset
+        );
+
+        return false;
+    }
+
+    *output = reader->data + reader->offset;
+    reader->offset += length;
+
+    return true;
+}
+
+/* big endian, width is 1, 2 or 4 */
+static bool read_uint(etf_reader *reader, size_t width, uint32_t *output){
+    const unsigned char *bytes = NULL;
+
+    if (!read_bytes(reader, width, &bytes)){
+        return false;
+    }
+
+    uint32_t value = 0;
+
+    for (size_t index = 0; index < width; ++index){
+        value = value << 8 | bytes[index];
+    }
+
+    *output = value;
+
+    return true;
+}
+
+static size_t get_text_width(uint32_t tag){
+    switch (tag){
+    case ETF_SMALL_ATOM:
+    case ETF_SMALL_ATOM_UTF8:
+        return 1;
+    case ETF_ATOM:
+    case ETF_ATOM_UTF8:
+    case ETF_STRING:
+        return 2;
+    case ETF_BINARY:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+static bool read_text(etf_reader *reader, uint32_t tag, const char **text, size_t *length){
+    uint32_t textlen = 0;
+    const unsigned char *bytes = NULL;
+
+    if (!read_uint(reader, get_text_width(tag), &textlen) || !read_bytes(reader, textlen, &bytes)){
+        return false;
+    }
+    else if (textlen > INT_MAX){
+        DLOG(
+            "[%s] read_text() - text too long (%" PRIu32 " bytes)\n",
+            __FILE__,
+            textlen
+        );
+
+        return false;
+    }
+
+    *text = (const char *)bytes;
+    *length = textlen;
+
+    return true;
+}
+
+static bool is_atom(const char *text, size_t length, const char *atom){
+    return strlen(atom) == length && !memcmp(text, atom, length);
+}
+
+static bool decode_atom(const char *text, size_t length, json_object **output){
+    if (is_atom(text, length, "nil") || is_atom(text, length, "null")){
+        *output = NULL;
+
+        return true;
+    }
+    else if (is_atom(text, length, "true") || is_atom(text, length, "false")){
+        return set_output(json_object_new_boolean(length == 4), output);
+    }
+
+    return set_output(json_object_new_string_len(text, length), output);
+}
+
+/* snowflakes arrive as 8 byte bigs, anything past 64 bits is refused */
+static bool decode_big(etf_reader *reader, size_t width, json_object **output){
+    uint32_t length = 0;
+    uint32_t sign = 0;
+    const unsigned char *bytes = NULL;
+
+    if (!read_uint(reader, width, &length) || !read_uint(reader, 1, &sign) || !read_bytes(reader, length, &bytes)){
+        return false;
+    }
+
+    uint64_t magnitude = 0;
+
+    for (size_t index = length; index > 0; --index){
+        if (index > sizeof(magnitude) && bytes[index - 1]){
+            DLOG(
+                "[%s] decode_big() - integer wider than 64 bits\n",
+                __FILE__
+            );
+
+            return false;
+        }
+
+        magnitude = magnitude << 8 | bytes[index - 1];
+    }
+
+    if (!sign){
+        if (magnitude > INT64_MAX){
+            return set_output(json_object_new_uint64(magnitude), output);
+        }
+
+        return set_output(json_object_new_int64((int64_t)magnitude), output);
+    }
+    else if (magnitude > (uint64_t)INT64_MAX + 1){
+        DLOG(
+            "[%s] decode_big() - negative integer out of range\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    return set_output(json_object_new_int64(-(int64_t)(magnitude - 1) - 1), output);
+}
+
+static bool decode_new_float(etf_reader *reader, json_object **output){
+    uint32_t high = 0;
+    uint32_t low = 0;
+
+    if (!read_uint(reader, 4, &high) || !read_uint(reader, 4, &low)){
+        return false;
+    }
+
+    uint64_t bits = (uint64_t)high << 32 | low;
+    double value = 0;
+
+    memcpy(&value, &bits, sizeof(value));
+
+    return set_output(json_object_new_double(value), output);
+}
+
+/* the pre-R11 float, a NUL padded "%.20e" string */
+static bool decode_float(etf_reader *reader, json_object **output){
+    const unsigned char *bytes = NULL;
+    char text[32] = {0};
+
+    if (!read_bytes(reader, 31, &bytes)){
+        return false;
+    }
+
+    memcpy(text, bytes, 31);
+
+    return set_output(json_object_new_double(strtod(text, NULL)), output);
+}
+
+static bool decode_list(etf_reader *reader, size_t width, bool tail, int depth, json_object **output){
+    uint32_t length = 0;
+
+    if (!read_uint(reader, width, &length)){
+        return false;
+    }
+    /* every element takes at least a byte, so this bounds the alloc below */
+    else if (length > reader->length - reader->offset){
+        DLOG(
+            "[%s] decode_list() - %" PRIu32 " elements in %zu bytes\n",
+            __FILE__,
+            length,
+            reader->length - reader->offset
+        );
+
+        return false;
+    }
+
+    json_object *array = json_object_new_array();
+
+    if (!set_output(array, output)){
+        return false;
+    }
+
+    for (uint32_t index = 0; index < length; ++index){
+        json_object *element = NULL;
+
+        if (!decode_term(reader, depth + 1, &element)){
+            json_object_put(array);
+
+            return false;
+        }
+
+        json_object_array_add(array, element);
+    }
+
+    if (tail){
+        uint32_t tag = 0;
+
+        if (!read_uint(reader, 1, &tag) || tag != ETF_NIL){
+            DLOG(
+                "[%s] decode_list() - improper lists are not supported\n",
+                __FILE__
+            );
+
+            json_object_put(array);
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * keys are nearly always short atoms or binaries and are copied into buffer,
+ * other terms are stringified into an allocated key the caller frees
+ */
+static bool decode_key(etf_reader *reader, int depth, char *buffer, size_t size, char **output){
+    size_t offset = reader->offset;
+    uint32_t tag = 0;
+
+    if (!read_uint(reader, 1, &tag)){
+        return false;
+    }
+
+    if (get_text_width(tag)){
+        const char *text = NULL;
+        size_t length = 0;
+
+        if (!read_text(reader, tag, &text, &length)){
+            return false;
+        }
+
+        char *key = length < size ? buffer : malloc(length + 1);
+
+        if (!key){
+            DLOG(
+                "[%s] decode_key() - alloc for key failed\n",
+                __FILE__
+            );
+
+            return false;
+        }
+
+        memcpy(key, text, length);
+        key[length] = '\0';
+
+        *output = key;
+
+        return true;
+    }
+
+    reader->offset = offset;
+
+    json_object *keyobj = NULL;
+
+    if (!decode_term(reader, depth + 1, &keyobj)){
+        return false;
+    }
+
+    const char *keystr = json_object_get_string(keyobj);
+    char *key = keystr ? string_duplicate(keystr) : NULL;
+
+    json_object_put(keyobj);
+
+    if (!key){
+        DLOG(
+            "[%s] decode_key() - key could not be converted to a string\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    *output = key;
+
+    return true;
+}
+
+static bool decode_map(etf_reader *reader, int depth, json_object **output){
+    uint32_t length = 0;
+
+    if (!read_uint(reader, 4, &length)){
+        return false;
+    }
+
+    json_object *obj = json_object_new_object();
+
+    if (!set_output(obj, output)){
+        return false;
+    }
+
+    char buffer[ETF_KEY_LENGTH];
+
+    for (uint32_t index = 0; index < length; ++index){
+        char *key = NULL;
+        json_object *value = NULL;
+
+        if (!decode_key(reader, depth, buffer, sizeof(buffer), &key)){
+            json_object_put(obj);
+
+            return false;
+        }
+
+        bool success = decode_term(reader, depth + 1, &value);
+
+        if (success){
+            json_object_object_add(obj, key, value);
+        }
+
+        if (key != buffer){
+            free(key);
+        }
+
+        if (!success){
+            json_object_put(obj);
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* a zlib compressed term always runs to the end of the input */
+static bool decode_compressed(etf_reader *reader, int depth, json_object **output){
+    uint32_t length = 0;
+
+    if (!read_uint(reader, 4, &length)){
+        return false;
+    }
+
+    unsigned char *data = malloc(length ? length : 1);
+
+    if (!data){
+        DLOG(
+            "[%s] decode_compressed() - alloc for %" PRIu32 " bytes failed\n",
+            __FILE__,
+            length
+        );
+
+        return false;
+    }
+
+    uLongf datalen = length;
+    int ret = uncompress(
+        data,
+        &datalen,
+        reader->data + reader->offset,
+        reader->length - reader->offset
+    );
+
+    if (ret != Z_OK || datalen != length){
+        DLOG(
+            "[%s] decode_compressed() - uncompress call failed: %d\n",
+            __FILE__,
+            ret
+        );
+
+        free(data);
+
+        return false;
+    }
+
+    reader->offset = reader->length;
+
+    etf_reader inner = {0};
+    inner.data = data;
+    inner.length = datalen;
+
+    bool success = decode_term(&inner, depth + 1, output);
+
+    if (success && inner.offset != inner.length){
+        DLOG(
+            "[%s] decode_compressed() - trailing bytes after compressed term\n",
+            __FILE__
+        );
+
+        json_object_put(*output);
+
+        success = false;
+    }
+
+    free(data);
+
+    return success;
+}
+
+static bool decode_term(etf_reader *reader, int depth, json_object **output){
+    if (depth > ETF_MAX_DEPTH){
+        DLOG(
+            "[%s] decode_term() - term nested deeper than %d\n",
+            __FILE__,
+            ETF_MAX_DEPTH
+        );
+
+        return false;
+    }
+
+    uint32_t tag = 0;
+    uint32_t value = 0;
+    const char *text = NULL;
+    size_t length = 0;
+
+    if (!read_uint(reader, 1, &tag)){
+        return false;
+    }
+
+    switch (tag){
+    case ETF_SMALL_INTEGER:
+        return read_uint(reader, 1, &value) && set_output(json_object_new_int(value), output);
+    case ETF_INTEGER:
+        return read_uint(reader, 4, &value) && set_output(json_object_new_int((int32_t)value), output);
+    case ETF_NEW_FLOAT:
+        return decode_new_float(reader, output);
+    case ETF_FLOAT:
+        return decode_float(reader, output);
+    case ETF_ATOM:
+    case ETF_SMALL_ATOM:
+    case ETF_ATOM_UTF8:
+    case ETF_SMALL_ATOM_UTF8:
+        return read_text(reader, tag, &text, &length) && decode_atom(text, length, output);
+    case ETF_STRING:
+    case ETF_BINARY:
+        return read_text(reader, tag, &text, &length) && set_output(json_object_new_string_len(text, length), output);
+    case ETF_SMALL_TUPLE:
+        return decode_list(reader, 1, false, depth, output);
+    case ETF_LARGE_TUPLE:
+        return decode_list(reader, 4, false, depth, output);
+    case ETF_NIL:
+        return set_output(json_object_new_array(), output);
+    case ETF_LIST:
+        return decode_list(reader, 4, true, depth, output);
+    case ETF_MAP:
+        return decode_map(reader, depth, output);
+    case ETF_SMALL_BIG:
+        return decode_big(reader, 1, output);
+    case ETF_LARGE_BIG:
+        return decode_big(reader, 4, output);
+    case ETF_COMPRESSED:
+        return decode_compressed(reader, depth, output);
+    default:
+        DLOG(
+            "[%s] decode_term() - unsupported tag %" PRIu32 "\n",
+            __FILE__,
+            tag
+        );
+
+        return false;
+    }
+}
+
+bool etf_decode(const void *data, size_t length, json_object **output){
+    if (!data || !output){
+        DLOG(
+            "[%s] etf_decode() - data or output is NULL\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    etf_reader reader = {0};
+    reader.data = data;
+    reader.length = length;
+
+    uint32_t version = 0;
+
+    if (!read_uint(&reader, 1, &version) || version != ETF_VERSION){
+        DLOG(
+            "[%s] etf_decode() - missing version byte\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    json_object *obj = NULL;
+
+    if (!decode_term(&reader, 0, &obj)){
+        return false;
+    }
+    else if (reader.offset != reader.length){
+        DLOG(
+            "[%s] etf_decode() - %zu trailing bytes after term\n",
+            __FILE__,
+            reader.length - reader.offset
+        );
+
+        json_object_put(obj);
+
+        return false;
+    }
+
+    *output = obj;
+
+    return true;
+}
+
+static bool reserve_writer(etf_writer *writer, size_t length){
+    size_t size = writer->length + length;
+
+    if (size <= writer->size){
+        return true;
+    }
+
+    size_t newsize = writer->size ? writer->size : ETF_WRITER_SIZE;
+
+    while (newsize < size){
+        newsize *= 2;
+    }
+
+    unsigned char *tmp = realloc(writer->data, newsize);
+
+    if (!tmp){
+        DLOG(
+            "[%s] reserve_writer() - realloc for %zu bytes failed\n",
+            __FILE__,
+            newsize
+        );
+
+        return false;
+    }
+
+    writer->data = tmp;
+    writer->size = newsize;
+
+    return true;
+}
+
+static bool write_bytes(etf_writer *writer, const void *data, size_t length){
+    if (!reserve_writer(writer, length)){
+        return false;
+    }
+
+    memcpy(writer->data + writer->length, data, length);
+    writer->length += length;
+
+    return true;
+}
+
+static bool write_uint(etf_writer *writer, size_t width, uint32_t value){
+    unsigned char bytes[4];
+
+    for (size_t index = width; index > 0; --index){
+        bytes[index - 1] = value & 0xFF;
+        value >>= 8;
+    }
+
+    return write_bytes(writer, bytes, width);
+}
+
+static bool write_atom(etf_writer *writer, const char *atom){
+    size_t length = strlen(atom);
+
+    return write_uint(writer, 1, ETF_SMALL_ATOM_UTF8) && write_uint(writer, 1, length) && write_bytes(writer, atom, length);
+}
+
+static bool write_binary(etf_writer *writer, const char *data, size_t length){
+    return write_uint(writer, 1, ETF_BINARY) && write_uint(writer, 4, length) && write_bytes(writer, data, length);
+}
+
+static bool write_integer(etf_writer *writer, json_object *obj){
+    int64_t value = json_object_get_int64(obj);
+
+    if (value >= 0 && value <= UINT8_MAX){
+        return write_uint(writer, 1, ETF_SMALL_INTEGER) && write_uint(writer, 1, value);
+    }
+    else if (value >= INT32_MIN && value <= INT32_MAX){
+        return write_uint(writer, 1, ETF_INTEGER) && write_uint(writer, 4, (uint32_t)value);
+    }
+
+    bool negative = value < 0;
+    uint64_t magnitude = negative ? (uint64_t)-(value + 1) + 1 : (uint64_t)value;
+
+    /* get_int64 clamps unsigned values past INT64_MAX */
+    if (value == INT64_MAX){
+        magnitude = json_object_get_uint64(obj);
+    }
+
+    unsigned char bytes[sizeof(magnitude)];
+    size_t length = 0;
+
+    while (magnitude){
+        bytes[length++] = magnitude & 0xFF;
+        magnitude >>= 8;
+    }
+
+    return write_uint(writer, 1, ETF_SMALL_BIG) && write_uint(writer, 1, length) && write_uint(writer, 1, negative) && write_bytes(writer, bytes, length);
+}
+
+static bool write_double(etf_writer *writer, double value){
+    uint64_t bits = 0;
+
+    memcpy(&bits, &value, sizeof(bits));
+
+    return write_uint(writer, 1, ETF_NEW_FLOAT) && write_uint(writer, 4, bits >> 32) && write_uint(writer, 4, bits & 0xFFFFFFFF);
+}
+
+static bool write_array(etf_writer *writer, json_object *obj, int depth){
+    size_t length = json_object_array_length(obj);
+
+    if (!length){
+        return write_uint(writer, 1, ETF_NIL);
+    }
+    else if (!write_uint(writer, 1, ETF_LIST) || !write_uint(writer, 4, length)){
+        return false;
+    }
+
+    for (size_t index = 0; index < length; ++index){
+        if (!encode_term(writer, json_object_array_get_idx(obj, index), depth + 1)){
+            return false;
+        }
+    }
+
+    return write_uint(writer, 1, ETF_NIL);
+}
+
+/* keys go out as binaries, which the gateway accepts like erlpack's */
+static bool write_map(etf_writer *writer, json_object *obj, int depth){
+    if (!write_uint(writer, 1, ETF_MAP) || !write_uint(writer, 4, json_object_object_length(obj))){
+        return false;
+    }
+
+    struct json_object_iterator iter = json_object_iter_begin(obj);
+    struct json_object_iterator end = json_object_iter_end(obj);
+
+    while (!json_object_iter_equal(&iter, &end)){
+        const char *key = json_object_iter_peek_name(&iter);
+
+        if (!write_binary(writer, key, strlen(key))){
+            return false;
+        }
+        else if (!encode_term(writer, json_object_iter_peek_value(&iter), depth + 1)){
+            return false;
+        }
+
+        json_object_iter_next(&iter);
+    }
+
+    return true;
+}
+
+static bool encode_term(etf_writer *writer, json_object *obj, int depth){
+    if (depth > ETF_MAX_DEPTH){
+        DLOG(
+            "[%s] encode_term() - object nested deeper than %d\n",
+            __FILE__,
+            ETF_MAX_DEPTH
+        );
+
+        return false;
+    }
+
+    switch (json_object_get_type(obj)){
+    case json_type_null:
+        return write_atom(writer, "nil");
+    case json_type_boolean:
+        return write_atom(writer, json_object_get_boolean(obj) ? "true" : "false");
+    case json_type_int:
+        return write_integer(writer, obj);
+    case json_type_double:
+        return write_double(writer, json_object_get_double(obj));
+    case json_type_string:
+        return write_binary(writer, json_object_get_string(obj), json_object_get_string_len(obj));
+    case json_type_array:
+        return write_array(writer, obj, depth);
+    case json_type_object:
+        return write_map(writer, obj, depth);
+    default:
+        DLOG(
+            "[%s] encode_term() - unsupported json type %d\n",
+            __FILE__,
+            json_object_get_type(obj)
+        );
+
+        return false;
+    }
+}
+
+unsigned char *etf_encode(json_object *obj, size_t offset, size_t *length){
+    if (!length){
+        DLOG(
+            "[%s] etf_encode() - length is NULL\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    etf_writer writer = {0};
+
+    if (!reserve_writer(&writer, offset + ETF_WRITER_SIZE)){
+        return NULL;
+    }
+
+    writer.length = offset;
+
+    if (!write_uint(&writer, 1, ETF_VERSION) || !encode_term(&writer, obj, 0)){
+        free(writer.data);
+
+        return NULL;
+    }
+
+    *length = writer.length - offset;
+
+    return writer.data;
+}
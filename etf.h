@@ -0,0 +1,48 @@
+#ifndef ETF_H
+#define ETF_H
+
+#include "c-utils/json_utils.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Erlang External Term Format, as spoken by the gateway with encoding=etf
+ *
+ * terms map onto json objects the same way Discord's erlpack does:
+ * maps become objects, lists and tuples arrays, binaries and plain atoms
+ * strings, the atoms nil/true/false null and booleans, and big integers
+ * (snowflakes) 64-bit ints, so json_object_get_string still yields the id
+ */
+
+#define ETF_VERSION 131
+#define ETF_MAX_DEPTH 64
+
+typedef enum etf_tag {
+    ETF_NEW_FLOAT = 70,
+    ETF_COMPRESSED = 80,
+    ETF_SMALL_INTEGER = 97,
+    ETF_INTEGER = 98,
+    ETF_FLOAT = 99,
+    ETF_ATOM = 100,
+    ETF_SMALL_TUPLE = 104,
+    ETF_LARGE_TUPLE = 105,
+    ETF_NIL = 106,
+    ETF_STRING = 107,
+    ETF_LIST = 108,
+    ETF_BINARY = 109,
+    ETF_SMALL_BIG = 110,
+    ETF_LARGE_BIG = 111,
+    ETF_SMALL_ATOM = 115,
+    ETF_MAP = 116,
+    ETF_ATOM_UTF8 = 118,
+    ETF_SMALL_ATOM_UTF8 = 119
+} etf_tag;
+
+/* null is a valid term, so the decoded object is returned through the last argument */
+bool etf_decode(const void *, size_t, json_object **);
+
+/* the returned buffer has the given number of bytes reserved in front of the term */
+unsigned char *etf_encode(json_object *, size_t, size_t *);
+
+#endif
@@ -1,24 +1,133 @@
 #include "gateway.h"
+#include "etf.h"
+#include "shard.h"
+
+#include <zlib.h>
 
 static const logctx *logger = NULL;
 
+/* every zlib-stream message ends with the empty block of a Z_SYNC_FLUSH */
+static const unsigned char zlib_suffix[] = {0x00, 0x00, 0xFF, 0xFF};
+
+static const char *const gateway_event_names[GATEWAY_EVENT_COUNT] = {
+    [GATEWAY_EVENT_READY] = "READY",
+    [GATEWAY_EVENT_RESUMED] = "RESUMED",
+    [GATEWAY_EVENT_APPLICATION_COMMAND_PERMISSIONS_UPDATE] = "APPLICATION_COMMAND_PERMISSIONS_UPDATE",
+    [GATEWAY_EVENT_AUTO_MODERATION_RULE_CREATE] = "AUTO_MODERATION_RULE_CREATE",
+    [GATEWAY_EVENT_AUTO_MODERATION_RULE_UPDATE] = "AUTO_MODERATION_RULE_UPDATE",
+    [GATEWAY_EVENT_AUTO_MODERATION_RULE_DELETE] = "AUTO_MODERATION_RULE_DELETE",
+    [GATEWAY_EVENT_AUTO_MODERATION_ACTION_EXECUTION] = "AUTO_MODERATION_ACTION_EXECUTION",
+    [GATEWAY_EVENT_CHANNEL_CREATE] = "CHANNEL_CREATE",
+    [GATEWAY_EVENT_CHANNEL_UPDATE] = "CHANNEL_UPDATE",
+    [GATEWAY_EVENT_CHANNEL_DELETE] = "CHANNEL_DELETE",
+    [GATEWAY_EVENT_CHANNEL_PINS_UPDATE] = "CHANNEL_PINS_UPDATE",
+    [GATEWAY_EVENT_THREAD_CREATE] = "THREAD_CREATE",
+    [GATEWAY_EVENT_THREAD_UPDATE] = "THREAD_UPDATE",
+    [GATEWAY_EVENT_THREAD_DELETE] = "THREAD_DELETE",
+    [GATEWAY_EVENT_THREAD_LIST_SYNC] = "THREAD_LIST_SYNC",
+    [GATEWAY_EVENT_THREAD_MEMBER_UPDATE] = "THREAD_MEMBER_UPDATE",
+    [GATEWAY_EVENT_THREAD_MEMBERS_UPDATE] = "THREAD_MEMBERS_UPDATE",
+    [GATEWAY_EVENT_ENTITLEMENT_CREATE] = "ENTITLEMENT_CREATE",
+    [GATEWAY_EVENT_ENTITLEMENT_UPDATE] = "ENTITLEMENT_UPDATE",
+    [GATEWAY_EVENT_ENTITLEMENT_DELETE] = "ENTITLEMENT_DELETE",
+    [GATEWAY_EVENT_GUILD_CREATE] = "GUILD_CREATE",
+    [GATEWAY_EVENT_GUILD_UPDATE] = "GUILD_UPDATE",
+    [GATEWAY_EVENT_GUILD_DELETE] = "GUILD_DELETE",
+    [GATEWAY_EVENT_GUILD_AUDIT_LOG_ENTRY_CREATE] = "GUILD_AUDIT_LOG_ENTRY_CREATE",
+    [GATEWAY_EVENT_GUILD_BAN_ADD] = "GUILD_BAN_ADD",
+    [GATEWAY_EVENT_GUILD_BAN_REMOVE] = "GUILD_BAN_REMOVE",
+    [GATEWAY_EVENT_GUILD_EMOJIS_UPDATE] = "GUILD_EMOJIS_UPDATE",
+    [GATEWAY_EVENT_GUILD_STICKERS_UPDATE] = "GUILD_STICKERS_UPDATE",
+    [GATEWAY_EVENT_GUILD_INTEGRATIONS_UPDATE] = "GUILD_INTEGRATIONS_UPDATE",
+    [GATEWAY_EVENT_GUILD_MEMBER_ADD] = "GUILD_MEMBER_ADD",
+    [GATEWAY_EVENT_GUILD_MEMBER_REMOVE] = "GUILD_MEMBER_REMOVE",
+    [GATEWAY_EVENT_GUILD_MEMBER_UPDATE] = "GUILD_MEMBER_UPDATE",
+    [GATEWAY_EVENT_GUILD_MEMBERS_CHUNK] = "GUILD_MEMBERS_CHUNK",
+    [GATEWAY_EVENT_GUILD_ROLE_CREATE] = "GUILD_ROLE_CREATE",
+    [GATEWAY_EVENT_GUILD_ROLE_UPDATE] = "GUILD_ROLE_UPDATE",
+    [GATEWAY_EVENT_GUILD_ROLE_DELETE] = "GUILD_ROLE_DELETE",
+    [GATEWAY_EVENT_GUILD_SCHEDULED_EVENT_CREATE] = "GUILD_SCHEDULED_EVENT_CREATE",
+    [GATEWAY_EVENT_GUILD_SCHEDULED_EVENT_UPDATE] = "GUILD_SCHEDULED_EVENT_UPDATE",
+    [GATEWAY_EVENT_GUILD_SCHEDULED_EVENT_DELETE] = "GUILD_SCHEDULED_EVENT_DELETE",
+    [GATEWAY_EVENT_GUILD_SCHEDULED_EVENT_USER_ADD] = "GUILD_SCHEDULED_EVENT_USER_ADD",
+    [GATEWAY_EVENT_GUILD_SCHEDULED_EVENT_USER_REMOVE] = "GUILD_SCHEDULED_EVENT_USER_REMOVE",
+    [GATEWAY_EVENT_GUILD_SOUNDBOARD_SOUND_CREATE] = "GUILD_SOUNDBOARD_SOUND_CREATE",
+    [GATEWAY_EVENT_GUILD_SOUNDBOARD_SOUND_UPDATE] = "GUILD_SOUNDBOARD_SOUND_UPDATE",
+    [GATEWAY_EVENT_GUILD_SOUNDBOARD_SOUND_DELETE] = "GUILD_SOUNDBOARD_SOUND_DELETE",
+    [GATEWAY_EVENT_GUILD_SOUNDBOARD_SOUNDS_UPDATE] = "GUILD_SOUNDBOARD_SOUNDS_UPDATE",
+    [GATEWAY_EVENT_SOUNDBOARD_SOUNDS] = "SOUNDBOARD_SOUNDS",
+    [GATEWAY_EVENT_INTEGRATION_CREATE] = "INTEGRATION_CREATE",
+    [GATEWAY_EVENT_INTEGRATION_UPDATE] = "INTEGRATION_UPDATE",
+    [GATEWAY_EVENT_INTEGRATION_DELETE] = "INTEGRATION_DELETE",
+    [GATEWAY_EVENT_INTERACTION_CREATE] = "INTERACTION_CREATE",
+    [GATEWAY_EVENT_INVITE_CREATE] = "INVITE_CREATE",
+    [GATEWAY_EVENT_INVITE_DELETE] = "INVITE_DELETE",
+    [GATEWAY_EVENT_MESSAGE_CREATE] = "MESSAGE_CREATE",
+    [GATEWAY_EVENT_MESSAGE_UPDATE] = "MESSAGE_UPDATE",
+    [GATEWAY_EVENT_MESSAGE_DELETE] = "MESSAGE_DELETE",
+    [GATEWAY_EVENT_MESSAGE_DELETE_BULK] = "MESSAGE_DELETE_BULK",
+    [GATEWAY_EVENT_MESSAGE_REACTION_ADD] = "MESSAGE_REACTION_ADD",
+    [GATEWAY_EVENT_MESSAGE_REACTION_REMOVE] = "MESSAGE_REACTION_REMOVE",
+    [GATEWAY_EVENT_MESSAGE_REACTION_REMOVE_ALL] = "MESSAGE_REACTION_REMOVE_ALL",
+    [GATEWAY_EVENT_MESSAGE_REACTION_REMOVE_EMOJI] = "MESSAGE_REACTION_REMOVE_EMOJI",
+    [GATEWAY_EVENT_MESSAGE_POLL_VOTE_ADD] = "MESSAGE_POLL_VOTE_ADD",
+    [GATEWAY_EVENT_MESSAGE_POLL_VOTE_REMOVE] = "MESSAGE_POLL_VOTE_REMOVE",
+    [GATEWAY_EVENT_PRESENCE_UPDATE] = "PRESENCE_UPDATE",
+    [GATEWAY_EVENT_STAGE_INSTANCE_CREATE] = "STAGE_INSTANCE_CREATE",
+    [GATEWAY_EVENT_STAGE_INSTANCE_UPDATE] = "STAGE_INSTANCE_UPDATE",
+    [GATEWAY_EVENT_STAGE_INSTANCE_DELETE] = "STAGE_INSTANCE_DELETE",
+    [GATEWAY_EVENT_SUBSCRIPTION_CREATE] = "SUBSCRIPTION_CREATE",
+    [GATEWAY_EVENT_SUBSCRIPTION_UPDATE] = "SUBSCRIPTION_UPDATE",
+    [GATEWAY_EVENT_SUBSCRIPTION_DELETE] = "SUBSCRIPTION_DELETE",
+    [GATEWAY_EVENT_TYPING_START] = "TYPING_START",
+    [GATEWAY_EVENT_USER_UPDATE] = "USER_UPDATE",
+    [GATEWAY_EVENT_VOICE_CHANNEL_EFFECT_SEND] = "VOICE_CHANNEL_EFFECT_SEND",
+    [GATEWAY_EVENT_VOICE_STATE_UPDATE] = "VOICE_STATE_UPDATE",
+    [GATEWAY_EVENT_VOICE_SERVER_UPDATE] = "VOICE_SERVER_UPDATE",
+    [GATEWAY_EVENT_WEBHOOKS_UPDATE] = "WEBHOOKS_UPDATE"
+};
+
 typedef struct gateway_receive_buffer {
     char *data;
     size_t length;
+    size_t size;
 } gateway_receive_buffer;
 
+/* one inflate context per connection, messages share its dictionary */
+typedef struct gateway_inflater {
+    z_stream stream;
+    gateway_receive_buffer input;
+} gateway_inflater;
+
+typedef struct gateway_http_socket {
+    discord_gateway_loop *loop;
+    struct lws *wsi;
+    int fd;
+    int events;
+} gateway_http_socket;
+
 static int handle_gateway_event(struct lws *, enum lws_callback_reasons, void *, void *, size_t);
+static int handle_http_socket_event(struct lws *, enum lws_callback_reasons, void *, void *, size_t);
 
 static const struct lws_protocols lwsprotocols[] = {
     {
         "handle_gateway_event",
         &handle_gateway_event,
-        sizeof(discord_gateway),
+        0,
         4096,
         0,
         NULL,
         0
     },
+    {
+        "handle_http_socket_event",
+        &handle_http_socket_event,
+        0,
+        0,
+        0,
+        NULL,
+        0
+    },
 
     LWS_PROTOCOL_LIST_TERM
 };
@@ -160,8 +269,9 @@ static bool send_gateway_heartbeat(discord_gateway *gateway){
 static bool send_gateway_identify(discord_gateway *gateway){
     const char *datafmt = "{"
                           "\"token\": \"%s\", "
-                          "\"compress\": %s, "
+                          "\"compress\": false, "
                           "\"large_threshold\": %d, "
+                          "%s"
                           "\"intents\": %d, "
                           "\"presence\": %s, "
                           "\"properties\": {"
@@ -171,11 +281,19 @@ static bool send_gateway_identify(discord_gateway *gateway){
                           "}"
                           "}";
 
+    char shard[32] = "";
+
+    if (gateway->shard_count){
+        snprintf(shard, sizeof(shard), "\"shard\": [%d, %d], ", gateway->shard_id, gateway->shard_count);
+    }
+
+    state_lock(gateway->state);
+
     char *datastr = string_create(
         datafmt,
         gateway->state->token,
-        gateway->compress ? "true" : "false",
         gateway->large_threshold,
+        shard,
         gateway->state->intent,
         state_get_presence_string(gateway->state),
         DISCORD_LIBRARY_OS,
@@ -183,6 +301,8 @@ static bool send_gateway_identify(discord_gateway *gateway){
         DISCORD_LIBRARY_NAME
     );
 
+    state_unlock(gateway->state);
+
     if (!datastr){
         log_write(
             logger,
@@ -225,6 +345,89 @@ static bool send_gateway_identify(discord_gateway *gateway){
     return success;
 }
 
+static void handle_identify_timer(lws_sorted_usec_list_t *sul){
+    discord_gateway *gateway = lws_container_of(sul, discord_gateway, identify_timer);
+
+    if (!gateway->connected){
+        return;
+    }
+
+    if (!send_gateway_identify(gateway)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] handle_identify_timer() - send_gateway_identify call failed\n",
+            __FILE__
+        );
+
+        gateway_disconnect(gateway);
+    }
+}
+
+/* managed shards wait for their max_concurrency bucket before identifying */
+static bool queue_gateway_identify(discord_gateway *gateway){
+    lws_usec_t delay = 0;
+
+    if (gateway->manager){
+        delay = shard_manager_reserve_identify(gateway->manager, gateway->shard_id);
+    }
+
+    if (!delay){
+        return send_gateway_identify(gateway);
+    }
+
+    log_write(
+        logger,
+        LOG_DEBUG,
+        "[%s] queue_gateway_identify() - shard %d identifying in %lld ms\n",
+        __FILE__,
+        gateway->shard_id,
+        (long long)(delay / LWS_US_PER_MS)
+    );
+
+    lws_sul_schedule(
+        gateway->loop->context,
+        0,
+        &gateway->identify_timer,
+        handle_identify_timer,
+        delay
+    );
+
+    return true;
+}
+
+static void handle_reconnect_timer(lws_sorted_usec_list_t *sul){
+    discord_gateway *gateway = lws_container_of(sul, discord_gateway, reconnect_timer);
+
+    log_write(
+        logger,
+        LOG_DEBUG,
+        "[%s] handle_reconnect_timer() - attempting to reconnect to gateway server (resume: %s)\n",
+        __FILE__,
+        gateway->resume ? "true" : "false"
+    );
+
+    if (!gateway->resume){
+        gateway->session_id[0] = '\0';
+        gateway->last_sequence = 0;
+    }
+
+    gateway->last_sent = 0;
+    gateway->sent_count = 0;
+
+    if (!gateway_connect(gateway)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] handle_reconnect_timer() - gateway_connect call failed\n",
+            __FILE__
+        );
+
+        gateway->reconnect = false;
+        gateway->running = false;
+    }
+}
+
 static bool send_gateway_resume(discord_gateway *gateway){
     const char *datafmt = "{"
                           "\"token\": \"%s\", "
@@ -281,43 +484,79 @@ static bool send_gateway_resume(discord_gateway *gateway){
     return success;
 }
 
-static discord_gateway_event get_gateway_event_callback(discord_gateway *gateway, const char *name){
-    discord_gateway_event event = NULL;
+static size_t hash_gateway_event_name(const char *name){
+    /* FNV-1a */
+    uint64_t hash = 14695981039346656037ULL;
 
-    for (size_t index = 0; gateway->events[index].name; ++index){
-        if (!strcmp(gateway->events[index].name, name)){
-            event = gateway->events[index].event;
+    for (; *name; ++name){
+        hash ^= (unsigned char)*name;
+        hash *= 1099511628211ULL;
+    }
 
-            break;
+    return hash % DISCORD_GATEWAY_EVENT_SLOTS;
+}
+
+static discord_gateway_event_type get_gateway_event_type(const discord_gateway *gateway, const char *name){
+    size_t slot = hash_gateway_event_name(name);
+
+    /* the table is never full, an empty slot ends the probe */
+    while (gateway->event_slots[slot]){
+        discord_gateway_event_type type = gateway->event_slots[slot];
+
+        if (!strcmp(gateway_event_names[type], name)){
+            return type;
         }
+
+        slot = (slot + 1) % DISCORD_GATEWAY_EVENT_SLOTS;
     }
 
-    return event;
+    return GATEWAY_EVENT_UNKNOWN;
 }
 
-static bool handle_gateway_dispatch(discord_gateway *gateway, const char *name, json_object *data){
-    log_write(
-        logger,
-        LOG_DEBUG,
-        "[%s] handle_gateway_dispatch() - gateway server dispatched event %s\n",
-        __FILE__,
-        name
-    );
+/* maps every name once so dispatching is a table lookup */
+static void init_gateway_events(discord_gateway *gateway){
+    for (int type = GATEWAY_EVENT_UNKNOWN + 1; type < GATEWAY_EVENT_COUNT; ++type){
+        size_t slot = hash_gateway_event_name(gateway_event_names[type]);
+
+        while (gateway->event_slots[slot]){
+            slot = (slot + 1) % DISCORD_GATEWAY_EVENT_SLOTS;
+        }
+
+        gateway->event_slots[slot] = type;
+    }
 
     if (!gateway->events){
-        log_write(
-            logger,
-            LOG_DEBUG,
-            "[%s] handle_gateway_dispatch() - no event callbacks have been set\n",
-            __FILE__
-        );
+        return;
+    }
 
-        return true;
+    for (size_t index = 0; gateway->events[index].name; ++index){
+        discord_gateway_event_type type = get_gateway_event_type(gateway, gateway->events[index].name);
+
+        /* the first callback set for an event wins, as with the list scan */
+        if (type != GATEWAY_EVENT_UNKNOWN && !gateway->callbacks[type]){
+            gateway->callbacks[type] = gateway->events[index].event;
+        }
+    }
+}
+
+static discord_gateway_event get_gateway_event_callback(const discord_gateway *gateway, discord_gateway_event_type type, const char *name){
+    if (type != GATEWAY_EVENT_UNKNOWN){
+        return gateway->callbacks[type];
     }
 
-    const void *eventdata = NULL;
+    /* events newer than the table can still be handled by name */
+    for (size_t index = 0; gateway->events[index].name; ++index){
+        if (!strcmp(gateway->events[index].name, name)){
+            return gateway->events[index].event;
+        }
+    }
+
+    return NULL;
+}
 
-    if (!strcmp(name, "READY")){
+/* caches the event's objects and sets the data its callback receives, runs under the state lock */
+static bool update_gateway_state(discord_gateway *gateway, discord_gateway_event_type type, json_object *data, const void **eventdata){
+    if (type == GATEWAY_EVENT_READY){
         const discord_user *user = state_set_user(
             gateway->state,
             json_object_object_get(data, "user")
@@ -327,7 +566,7 @@ static bool handle_gateway_dispatch(discord_gateway *gateway, const char *name,
             log_write(
                 logger,
                 LOG_ERROR,
-                "[%s] handle_gateway_dispatch() - state_set_user call failed\n",
+                "[%s] update_gateway_state() - state_set_user call failed\n",
                 __FILE__
             );
 
@@ -343,7 +582,7 @@ static bool handle_gateway_dispatch(discord_gateway *gateway, const char *name,
             log_write(
                 logger,
                 LOG_ERROR,
-                "[%s] handle_gateway_dispatch() - missing session_id from data\n",
+                "[%s] update_gateway_state() - missing session_id from data\n",
                 __FILE__
             );
 
@@ -352,49 +591,49 @@ static bool handle_gateway_dispatch(discord_gateway *gateway, const char *name,
 
         string_copy(sessionid, gateway->session_id, sizeof(gateway->session_id));
 
-        eventdata = gateway->state->user;
+        *eventdata = gateway->state->user;
     }
-    else if (!strcmp(name, "RESUMED")){
+    else if (type == GATEWAY_EVENT_RESUMED){
         gateway->resume = false;
 
-        eventdata = gateway->state->user;
+        *eventdata = gateway->state->user;
     }
-    else if (!strcmp(name, "GUILD_CREATE")){
+    else if (type == GATEWAY_EVENT_GUILD_CREATE){
         /* set guild up for cache */
     }
-    else if (!strcmp(name, "MESSAGE_CREATE")){
+    else if (type == GATEWAY_EVENT_MESSAGE_CREATE){
         const discord_message *message = state_set_message(gateway->state, data, false);
 
         if (!message){
             log_write(
                 logger,
                 LOG_ERROR,
-                "[%s] handle_gateway_dispatch() - state_set_message call failed\n",
+                "[%s] update_gateway_state() - state_set_message call failed\n",
                 __FILE__
             );
 
             return false;
         }
 
-        eventdata = message;
+        *eventdata = message;
     }
-    else if (!strcmp(name, "MESSAGE_UPDATE")){
+    else if (type == GATEWAY_EVENT_MESSAGE_UPDATE){
         const discord_message *message = state_set_message(gateway->state, data, true);
 
         if (!message){
             log_write(
                 logger,
                 LOG_ERROR,
-                "[%s] handle_gateway_dispatch() - state_set_message call failed\n",
+                "[%s] update_gateway_state() - state_set_message call failed\n",
                 __FILE__
             );
 
             return false;
         }
 
-        eventdata = message;
+        *eventdata = message;
     }
-    else if (!strcmp(name, "MESSAGE_DELETE")){
+    else if (type == GATEWAY_EVENT_MESSAGE_DELETE){
         const char *idstr = json_object_get_string(
             json_object_object_get(data, "id")
         );
@@ -411,8 +650,7 @@ static bool handle_gateway_dispatch(discord_gateway *gateway, const char *name,
             return false;
         }
 
-        static snowflake id = 0;
-        bool success = snowflake_from_string(idstr, &id);
+        bool success = snowflake_from_string(idstr, &gateway->deleted_message_id);
 
         if (!success){
             log_write(
@@ -426,10 +664,59 @@ static bool handle_gateway_dispatch(discord_gateway *gateway, const char *name,
             return false;
         }
 
-        eventdata = &id;
+        *eventdata = &gateway->deleted_message_id;
+    }
+
+    return true;
+}
+
+static bool handle_gateway_dispatch(discord_gateway *gateway, const char *name, json_object *data){
+    log_write(
+        logger,
+        LOG_DEBUG,
+        "[%s] handle_gateway_dispatch() - gateway server dispatched event %s\n",
+        __FILE__,
+        name
+    );
+
+    if (!gateway->events){
+        log_write(
+            logger,
+            LOG_DEBUG,
+            "[%s] handle_gateway_dispatch() - no event callbacks have been set\n",
+            __FILE__
+        );
+
+        return true;
+    }
+
+    const void *eventdata = NULL;
+    discord_gateway_event_type type = get_gateway_event_type(gateway, name);
+
+    /* decoding ran unlocked, only the cache update is serialized with other shards */
+    state_lock(gateway->state);
+
+    bool success = update_gateway_state(gateway, type, data, &eventdata);
+
+    /* other shards may evict or update the event data before the callback is done with it */
+    if (success){
+        state_pin(gateway->state);
+    }
+
+    state_unlock(gateway->state);
+
+    if (!success){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] handle_gateway_dispatch() - update_gateway_state call failed\n",
+            __FILE__
+        );
+
+        return false;
     }
 
-    discord_gateway_event event = get_gateway_event_callback(gateway, name);
+    discord_gateway_event event = get_gateway_event_callback(gateway, type, name);
 
     if (!event){
         log_write(
@@ -440,22 +727,69 @@ static bool handle_gateway_dispatch(discord_gateway *gateway, const char *name,
             name
         );
 
+        state_unpin(gateway->state);
+
         return true;
     }
 
-    return event(gateway->state->event_context, eventdata);
+    /*
+     * the callback runs unlocked so it can block, e.g. on a rate limited
+     * request, without stalling the other shards
+     */
+    success = event(gateway->state->event_context, eventdata);
+
+    state_unpin(gateway->state);
+
+    return success;
+}
+
+static json_object *decode_gateway_payload(const discord_gateway *gateway){
+    const gateway_receive_buffer *buffer = gateway->buffer;
+
+    if (gateway->encoding != GATEWAY_ENCODING_ETF){
+        json_object *payload = json_tokener_parse(buffer->data);
+
+        if (!payload){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] decode_gateway_payload() - json_tokener_parse call failed on data %s\n",
+                __FILE__,
+                buffer->data
+            );
+        }
+
+        return payload;
+    }
+
+    json_object *payload = NULL;
+
+    if (!etf_decode(buffer->data, buffer->length, &payload) || !payload){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] decode_gateway_payload() - etf_decode call failed on %zu byte payload\n",
+            __FILE__,
+            buffer->length
+        );
+
+        json_object_put(payload);
+
+        return NULL;
+    }
+
+    return payload;
 }
 
 static bool handle_gateway_payload(discord_gateway *gateway){
-    json_object *payload = json_tokener_parse(gateway->buffer->data);
+    json_object *payload = decode_gateway_payload(gateway);
 
     if (!payload){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] handle_gateway_payload() - json_tokener_parse call failed on data %s\n",
-            __FILE__,
-            gateway->buffer->data
+            "[%s] handle_gateway_payload() - decode_gateway_payload call failed\n",
+            __FILE__
         );
 
         return false;
@@ -596,13 +930,13 @@ static bool handle_gateway_payload(discord_gateway *gateway){
                 __FILE__
             );
 
-            success = send_gateway_identify(gateway);
+            success = queue_gateway_identify(gateway);
 
             if (!success){
                 log_write(
                     logger,
                     LOG_ERROR,
-                    "[%s] handle_gateway_payload() - send_gateway_identify call failed\n",
+                    "[%s] handle_gateway_payload() - queue_gateway_identify call failed\n",
                     __FILE__
                 );
             }
@@ -657,8 +991,13 @@ static bool handle_gateway_writable(discord_gateway *gateway, struct lws *wsi){
 
     unsigned char *data = payload.data;
 
-    size_t datalen = strlen((char *)(data + LWS_PRE));
-    int ret = lws_write(wsi, data + LWS_PRE, datalen, LWS_WRITE_TEXT);
+    size_t datalen = payload.size - LWS_PRE;
+    int ret = lws_write(
+        wsi,
+        data + LWS_PRE,
+        datalen,
+        gateway->encoding == GATEWAY_ENCODING_ETF ? LWS_WRITE_BINARY : LWS_WRITE_TEXT
+    );
 
     free(data);
 
@@ -689,99 +1028,265 @@ static bool handle_gateway_writable(discord_gateway *gateway, struct lws *wsi){
     return true;
 }
 
-static bool handle_gateway_receive(discord_gateway *gateway, struct lws *wsi, void *data, size_t datalen){
-    bool first_frag = lws_is_first_fragment(wsi);
-    bool last_frag = lws_is_final_fragment(wsi);
+static bool reserve_receive_buffer(gateway_receive_buffer *buffer, size_t size){
+    if (size <= buffer->size){
+        return true;
+    }
 
-    if (first_frag){
-        gateway->buffer->length = 0;
+    size_t newsize = buffer->size ? buffer->size : DISCORD_GATEWAY_INFLATE_CHUNK;
+
+    while (newsize < size){
+        newsize *= 2;
     }
 
-    char *tmp = realloc(gateway->buffer->data, gateway->buffer->length + datalen + 1);
+    char *tmp = realloc(buffer->data, newsize);
 
     if (!tmp){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] handle_gateway_event() - buffer data object realloc failed\n",
+            "[%s] reserve_receive_buffer() - buffer data realloc failed\n",
             __FILE__
         );
 
-        return -1;
+        return false;
+    }
+
+    buffer->data = tmp;
+    buffer->size = newsize;
+
+    return true;
+}
+
+static bool append_receive_buffer(gateway_receive_buffer *buffer, const void *data, size_t datalen){
+    if (!reserve_receive_buffer(buffer, buffer->length + datalen + 1)){
+        return false;
     }
 
-    memcpy(tmp + gateway->buffer->length, data, datalen);
+    memcpy(buffer->data + buffer->length, data, datalen);
 
-    gateway->buffer->data = tmp;
-    gateway->buffer->length += datalen;
-    gateway->buffer->data[gateway->buffer->length] = '\0';
+    buffer->length += datalen;
+    buffer->data[buffer->length] = '\0';
 
-    return last_frag ? handle_gateway_payload(gateway) : true;
+    return true;
 }
 
-int handle_gateway_event(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *data, size_t datalen){
-    if (user){
-        /* ignored for now */
+static bool has_zlib_suffix(const gateway_receive_buffer *buffer){
+    size_t suffixlen = sizeof(zlib_suffix);
+
+    if (buffer->length < suffixlen){
+        return false;
     }
 
-    discord_gateway *gateway = lws_context_user(lws_get_context(wsi));
+    return !memcmp(buffer->data + buffer->length - suffixlen, zlib_suffix, suffixlen);
+}
 
-    bool closeconn = false;
-    bool success = true;
+static gateway_inflater *init_gateway_inflater(void){
+    gateway_inflater *inflater = calloc(1, sizeof(*inflater));
 
-    switch (reason){
-    case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
+    if (!inflater){
         log_write(
             logger,
-            LOG_DEBUG,
-            "[%s] handle_gateway_event() - LWS_CALLBACK_CLIENT_CONNECTION_ERROR event triggered\n",
+            LOG_ERROR,
+            "[%s] init_gateway_inflater() - alloc for inflater failed\n",
             __FILE__
         );
 
-        success = false;
+        return NULL;
+    }
 
-        break;
-    case LWS_CALLBACK_CLIENT_ESTABLISHED:
-        log_write(
-            logger,
-            LOG_DEBUG,
-            "[%s] handle_gateway_event() - handshake with the gateway server completed successfully\n",
-            __FILE__
-        );
+    int ret = inflateInit(&inflater->stream);
 
-        break;
-    case LWS_CALLBACK_CLIENT_RECEIVE:
+    if (ret != Z_OK){
         log_write(
             logger,
-            LOG_DEBUG,
-            "[%s] handle_gateway_event() - ready to receive data from the gateway server\n",
-            __FILE__
+            LOG_ERROR,
+            "[%s] init_gateway_inflater() - inflateInit call failed: %d\n",
+            __FILE__,
+            ret
         );
 
-        success = handle_gateway_receive(gateway, wsi, data, datalen);
+        free(inflater);
 
-        if (!success){
-            log_write(
-                logger,
-                LOG_ERROR,
-                "[%s] handle_gateway_event() - handle_gateway_receive call failed\n",
-                __FILE__
-            );
-        }
+        return NULL;
+    }
 
-        break;
-    case LWS_CALLBACK_CLIENT_WRITEABLE:
+    return inflater;
+}
+
+static bool reset_gateway_inflater(gateway_inflater *inflater){
+    inflater->input.length = 0;
+
+    int ret = inflateReset(&inflater->stream);
+
+    if (ret != Z_OK){
         log_write(
             logger,
-            LOG_DEBUG,
-            "[%s] handle_gateway_event() - ready to send data to the gateway server\n",
-            __FILE__
+            LOG_ERROR,
+            "[%s] reset_gateway_inflater() - inflateReset call failed: %d\n",
+            __FILE__,
+            ret
         );
 
-        if (gateway->connected){
-            success = handle_gateway_writable(gateway, wsi);
+        return false;
+    }
 
-            if (!success){
+    return true;
+}
+
+static void free_gateway_inflater(gateway_inflater *inflater){
+    if (!inflater){
+        return;
+    }
+
+    inflateEnd(&inflater->stream);
+
+    free(inflater->input.data);
+    free(inflater);
+}
+
+/* inflates the buffered message into gateway->buffer, reusing its allocation */
+static bool inflate_gateway_message(discord_gateway *gateway){
+    gateway_inflater *inflater = gateway->inflater;
+    gateway_receive_buffer *output = gateway->buffer;
+    z_stream *stream = &inflater->stream;
+
+    lws_usec_t start = lws_now_usecs();
+
+    stream->next_in = (unsigned char *)inflater->input.data;
+    stream->avail_in = inflater->input.length;
+
+    output->length = 0;
+
+    int ret = Z_OK;
+
+    do {
+        if (!reserve_receive_buffer(output, output->length + DISCORD_GATEWAY_INFLATE_CHUNK + 1)){
+            return false;
+        }
+
+        size_t available = output->size - output->length - 1;
+
+        stream->next_out = (unsigned char *)output->data + output->length;
+        stream->avail_out = available;
+
+        ret = inflate(stream, Z_SYNC_FLUSH);
+
+        if (ret != Z_OK && ret != Z_BUF_ERROR){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] inflate_gateway_message() - inflate call failed: %s\n",
+                __FILE__,
+                stream->msg ? stream->msg : "unknown error"
+            );
+
+            return false;
+        }
+
+        output->length += available - stream->avail_out;
+    } while (stream->avail_in || !stream->avail_out);
+
+    output->data[output->length] = '\0';
+
+    gateway->stats.messages += 1;
+    gateway->stats.compressed_bytes += inflater->input.length;
+    gateway->stats.inflated_bytes += output->length;
+    gateway->stats.inflate_time_us += lws_now_usecs() - start;
+
+    inflater->input.length = 0;
+
+    return true;
+}
+
+static bool handle_gateway_receive(discord_gateway *gateway, struct lws *wsi, void *data, size_t datalen){
+    if (gateway->inflater){
+        /*
+         * a message can span frames and fragments, it ends with the suffix
+         * on a final fragment, a chunk boundary may land on the same bytes
+         */
+        if (!append_receive_buffer(&gateway->inflater->input, data, datalen)){
+            return false;
+        }
+
+        if (!lws_is_final_fragment(wsi) || !has_zlib_suffix(&gateway->inflater->input)){
+            return true;
+        }
+
+        return inflate_gateway_message(gateway) && handle_gateway_payload(gateway);
+    }
+
+    if (lws_is_first_fragment(wsi)){
+        gateway->buffer->length = 0;
+    }
+
+    if (!append_receive_buffer(gateway->buffer, data, datalen)){
+        return false;
+    }
+
+    return lws_is_final_fragment(wsi) ? handle_gateway_payload(gateway) : true;
+}
+
+int handle_gateway_event(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *data, size_t datalen){
+    /* the connection's userdata, NULL for protocol wide reasons */
+    discord_gateway *gateway = user;
+
+    bool closeconn = false;
+    bool success = true;
+
+    switch (reason){
+    case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
+        log_write(
+            logger,
+            LOG_DEBUG,
+            "[%s] handle_gateway_event() - LWS_CALLBACK_CLIENT_CONNECTION_ERROR event triggered\n",
+            __FILE__
+        );
+
+        success = false;
+
+        break;
+    case LWS_CALLBACK_CLIENT_ESTABLISHED:
+        log_write(
+            logger,
+            LOG_DEBUG,
+            "[%s] handle_gateway_event() - handshake with the gateway server completed successfully\n",
+            __FILE__
+        );
+
+        break;
+    case LWS_CALLBACK_CLIENT_RECEIVE:
+        log_write(
+            logger,
+            LOG_DEBUG,
+            "[%s] handle_gateway_event() - ready to receive data from the gateway server\n",
+            __FILE__
+        );
+
+        success = handle_gateway_receive(gateway, wsi, data, datalen);
+
+        if (!success){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] handle_gateway_event() - handle_gateway_receive call failed\n",
+                __FILE__
+            );
+        }
+
+        break;
+    case LWS_CALLBACK_CLIENT_WRITEABLE:
+        log_write(
+            logger,
+            LOG_DEBUG,
+            "[%s] handle_gateway_event() - ready to send data to the gateway server\n",
+            __FILE__
+        );
+
+        if (gateway->connected){
+            success = handle_gateway_writable(gateway, wsi);
+
+            if (!success){
                 log_write(
                     logger,
                     LOG_ERROR,
@@ -901,36 +1406,15 @@ int handle_gateway_event(struct lws *wsi, enum lws_callback_reasons reason, void
             break;
         }
 
-        /* NOTE need actual logic here */
-        sleep(3);
-
-        log_write(
-            logger,
-            LOG_DEBUG,
-            "[%s] handle_gateway_event() - attempting to reconnect to gateway server (resume: %s)\n",
-            __FILE__,
-            gateway->resume ? "true" : "false"
+        /* the loop may be shared with other shards and the http client, don't block it */
+        lws_sul_schedule(
+            gateway->loop->context,
+            0,
+            &gateway->reconnect_timer,
+            handle_reconnect_timer,
+            DISCORD_GATEWAY_RECONNECT_DELAY * LWS_US_PER_SEC
         );
 
-        if (!gateway->resume){
-            gateway->session_id[0] = '\0';
-            gateway->last_sequence = 0;
-        }
-
-        gateway->last_sent = 0;
-        gateway->sent_count = 0;
-
-        success = gateway_connect(gateway);
-
-        if (!success){
-            log_write(
-                logger,
-                LOG_ERROR,
-                "[%s] handle_gateway_event() - gateway_connect call failed\n",
-                __FILE__
-            );
-        }
-
         break;
     case LWS_CALLBACK_PROTOCOL_DESTROY:
         log_write(
@@ -942,8 +1426,6 @@ int handle_gateway_event(struct lws *wsi, enum lws_callback_reasons reason, void
 
         closeconn = true;
 
-        gateway->running = false;
-
         break;
     default:
         if (DISCORD_GATEWAY_LWS_LOG_LEVEL){
@@ -987,6 +1469,188 @@ int handle_gateway_event(struct lws *wsi, enum lws_callback_reasons reason, void
     return closeconn ? -1 : 0;
 }
 
+static void handle_http_timer(lws_sorted_usec_list_t *sul){
+    discord_gateway_loop *loop = lws_container_of(sul, discord_gateway_loop, http_timer);
+
+    if (!discord_http_timer_action(loop->state->http)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] handle_http_timer() - discord_http_timer_action call failed\n",
+            __FILE__
+        );
+    }
+}
+
+static void set_http_timer(void *loopptr, long timeout_ms){
+    discord_gateway_loop *loop = loopptr;
+
+    lws_sul_schedule(
+        loop->context,
+        0,
+        &loop->http_timer,
+        handle_http_timer,
+        timeout_ms < 0 ? LWS_SET_TIMER_USEC_CANCEL : timeout_ms * LWS_US_PER_MS
+    );
+}
+
+static void update_http_socket_events(gateway_http_socket *sock){
+    lws_rx_flow_control(sock->wsi, (sock->events & DISCORD_HTTP_POLL_IN) ? 1 : 0);
+
+    if (sock->events & DISCORD_HTTP_POLL_OUT){
+        lws_callback_on_writable(sock->wsi);
+    }
+}
+
+static void *watch_http_socket(void *loopptr, int fd, int events, void *socketptr){
+    discord_gateway_loop *loop = loopptr;
+    gateway_http_socket *sock = socketptr;
+
+    if (events & DISCORD_HTTP_POLL_REMOVE){
+        if (sock){
+            /* curl closes its own descriptor, lws closes the duplicate */
+            sock->fd = -1;
+            sock->events = 0;
+
+            lws_rx_flow_control(sock->wsi, 0);
+            lws_set_timeout(sock->wsi, PENDING_TIMEOUT_USER_OK, LWS_TO_KILL_ASYNC);
+        }
+
+        return NULL;
+    }
+
+    if (!sock){
+        sock = calloc(1, sizeof(*sock));
+
+        if (!sock){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] watch_http_socket() - calloc for socket failed\n",
+                __FILE__
+            );
+
+            return NULL;
+        }
+
+        /* adopted as a raw descriptor so lws only reports readiness */
+        lws_sock_file_fd_type desc = {0};
+        desc.filefd = dup(fd);
+
+        if (desc.filefd < 0){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] watch_http_socket() - dup call failed for fd %d\n",
+                __FILE__,
+                fd
+            );
+
+            free(sock);
+
+            return NULL;
+        }
+
+        sock->wsi = lws_adopt_descriptor_vhost(
+            lws_get_vhost_by_name(loop->context, "default"),
+            LWS_ADOPT_RAW_FILE_DESC,
+            desc,
+            lwsprotocols[1].name,
+            NULL
+        );
+
+        if (!sock->wsi){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] watch_http_socket() - lws_adopt_descriptor_vhost call failed\n",
+                __FILE__
+            );
+
+            free(sock);
+
+            return NULL;
+        }
+
+        sock->loop = loop;
+
+        lws_set_opaque_user_data(sock->wsi, sock);
+    }
+
+    sock->fd = fd;
+    sock->events = events;
+
+    update_http_socket_events(sock);
+
+    return sock;
+}
+
+int handle_http_socket_event(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *data, size_t datalen){
+    if (user || data || datalen){
+        /* unused */
+    }
+
+    gateway_http_socket *sock = lws_get_opaque_user_data(wsi);
+
+    switch (reason){
+    case LWS_CALLBACK_RAW_RX_FILE:
+        if (!sock || sock->fd < 0){
+            break;
+        }
+
+        if (!discord_http_socket_action(sock->loop->state->http, sock->fd, DISCORD_HTTP_POLL_IN)){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] handle_http_socket_event() - discord_http_socket_action call failed\n",
+                __FILE__
+            );
+        }
+
+        break;
+    case LWS_CALLBACK_RAW_WRITEABLE_FILE:
+        if (!sock || sock->fd < 0){
+            break;
+        }
+
+        if (!discord_http_socket_action(sock->loop->state->http, sock->fd, DISCORD_HTTP_POLL_OUT)){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] handle_http_socket_event() - discord_http_socket_action call failed\n",
+                __FILE__
+            );
+        }
+
+        /* writable notifications are one-shot */
+        if (sock->fd >= 0 && (sock->events & DISCORD_HTTP_POLL_OUT)){
+            lws_callback_on_writable(wsi);
+        }
+
+        break;
+    case LWS_CALLBACK_RAW_CLOSE_FILE:
+        lws_set_opaque_user_data(wsi, NULL);
+
+        free(sock);
+
+        break;
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+static char *create_gateway_endpoint(const discord_gateway *gateway, const char *url){
+    return string_create(
+        "%s/?v=%d&encoding=%s%s",
+        url,
+        DISCORD_GATEWAY_VERSION,
+        gateway->encoding == GATEWAY_ENCODING_ETF ? DISCORD_GATEWAY_ENCODING_ETF : DISCORD_GATEWAY_ENCODING_JSON,
+        gateway->compress ? "&compress=" DISCORD_GATEWAY_COMPRESSION : ""
+    );
+}
+
 static bool set_gateway_endpoint(discord_gateway *gateway){
     discord_http_response *response = discord_http_get_bot_gateway(gateway->state->http);
 
@@ -1045,15 +1709,9 @@ static bool set_gateway_endpoint(discord_gateway *gateway){
         return true;
     }
 
-    const char *url = json_object_get_string(
-        json_object_object_get(response->data, "url")
-    );
-
-    char *endpoint = string_create(
-        "%s/?v=%d&encoding=%s",
-        url,
-        DISCORD_GATEWAY_VERSION,
-        DISCORD_GATEWAY_ENCODING
+    char *endpoint = create_gateway_endpoint(
+        gateway,
+        json_object_get_string(json_object_object_get(response->data, "url"))
     );
 
     discord_http_response_free(response);
@@ -1062,7 +1720,7 @@ static bool set_gateway_endpoint(discord_gateway *gateway){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] set_gateway_endpoint() - endpoint string alloc failed\n",
+            "[%s] set_gateway_endpoint() - create_gateway_endpoint call failed\n",
             __FILE__
         );
 
@@ -1074,12 +1732,12 @@ static bool set_gateway_endpoint(discord_gateway *gateway){
     return true;
 }
 
-discord_gateway *gateway_init(discord_state *state, const discord_gateway_options *opts){
+discord_gateway_loop *gateway_loop_init(discord_state *state, bool drivehttp){
     if (!state){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] gateway_init() - state is NULL\n",
+            "[%s] gateway_loop_init() - state is NULL\n",
             __FILE__
         );
 
@@ -1090,6 +1748,105 @@ discord_gateway *gateway_init(discord_state *state, const discord_gateway_option
 
     lws_set_log_level(DISCORD_GATEWAY_LWS_LOG_LEVEL, NULL);
 
+    discord_gateway_loop *loop = calloc(1, sizeof(*loop));
+
+    if (!loop){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] gateway_loop_init() - alloc for loop object failed\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    loop->state = state;
+
+    struct lws_context_creation_info ctxinfo = {0};
+    ctxinfo.options = LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT;
+    ctxinfo.port = CONTEXT_PORT_NO_LISTEN;
+    ctxinfo.protocols = lwsprotocols;
+    ctxinfo.user = loop;
+
+    loop->context = lws_create_context(&ctxinfo);
+
+    if (!loop->context){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] gateway_loop_init() - lws_create_context call failed\n",
+            __FILE__
+        );
+
+        gateway_loop_free(loop);
+
+        return NULL;
+    }
+
+    if (!drivehttp){
+        return loop;
+    }
+
+    discord_http_event_loop httploop = {0};
+    httploop.userdata = loop;
+    httploop.watch_socket = watch_http_socket;
+    httploop.set_timer = set_http_timer;
+
+    if (!discord_http_set_event_loop(state->http, &httploop)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] gateway_loop_init() - discord_http_set_event_loop call failed\n",
+            __FILE__
+        );
+
+        gateway_loop_free(loop);
+
+        return NULL;
+    }
+
+    loop->drives_http = true;
+
+    return loop;
+}
+
+/* destroying the context closes every connection on it, free their gateways after */
+void gateway_loop_free(discord_gateway_loop *loop){
+    if (!loop){
+        log_write(
+            logger,
+            LOG_DEBUG,
+            "[%s] gateway_loop_free() - loop is NULL\n",
+            __FILE__
+        );
+
+        return;
+    }
+
+    if (loop->drives_http){
+        discord_http_set_event_loop(loop->state->http, NULL);
+    }
+
+    lws_context_destroy(loop->context);
+
+    free(loop);
+}
+
+discord_gateway *gateway_init(discord_state *state, const discord_gateway_options *opts){
+    if (!state){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] gateway_init() - state is NULL\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    logger = state->log;
+
     discord_gateway *gateway = calloc(1, sizeof(*gateway));
 
     if (!gateway){
@@ -1110,9 +1867,17 @@ discord_gateway *gateway_init(discord_state *state, const discord_gateway_option
 
     if (opts){
         gateway->compress = opts->compress;
+        gateway->encoding = opts->encoding;
         gateway->events = opts->events;
+
+        gateway->shard_id = opts->shard_id;
+        gateway->shard_count = opts->shard_count;
+        gateway->manager = opts->manager;
+        gateway->loop = opts->loop;
     }
 
+    init_gateway_events(gateway);
+
     gateway->queue = list_init();
 
     if (!gateway->queue){
@@ -1143,19 +1908,52 @@ discord_gateway *gateway_init(discord_state *state, const discord_gateway_option
         return NULL;
     }
 
-    struct lws_context_creation_info ctxinfo = {0};
-    ctxinfo.options = LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT;
-    ctxinfo.port = CONTEXT_PORT_NO_LISTEN;
-    ctxinfo.protocols = lwsprotocols;
-    ctxinfo.user = gateway;
+    if (gateway->compress){
+        gateway->inflater = init_gateway_inflater();
+
+        if (!gateway->inflater){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] gateway_init() - init_gateway_inflater call failed\n",
+                __FILE__
+            );
+
+            gateway_free(gateway);
+
+            return NULL;
+        }
+    }
+
+    if (gateway->manager){
+        gateway->endpoint = create_gateway_endpoint(gateway, gateway->manager->url);
+
+        if (!gateway->endpoint){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] gateway_init() - create_gateway_endpoint call failed\n",
+                __FILE__
+            );
 
-    gateway->context = lws_create_context(&ctxinfo);
+            gateway_free(gateway);
+
+            return NULL;
+        }
+    }
+
+    if (gateway->loop){
+        return gateway;
+    }
 
-    if (!gateway->context){
+    gateway->loop = gateway_loop_init(state, true);
+    gateway->owns_loop = true;
+
+    if (!gateway->loop){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] gateway_init() - lws_create_context call failed\n",
+            "[%s] gateway_init() - gateway_loop_init call failed\n",
             __FILE__
         );
 
@@ -1181,7 +1979,20 @@ bool gateway_connect(discord_gateway *gateway){
 
     gateway->reconnect = false;
 
-    if (!set_gateway_endpoint(gateway)){
+    /* the compressed stream starts over with every connection */
+    if (gateway->inflater && !reset_gateway_inflater(gateway->inflater)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] gateway_connect() - reset_gateway_inflater call failed\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    /* managed shards use the endpoint their manager fetched */
+    if (!gateway->manager && !set_gateway_endpoint(gateway)){
         log_write(
             logger,
             LOG_ERROR,
@@ -1232,7 +2043,7 @@ bool gateway_connect(discord_gateway *gateway){
     }
 
     struct lws_client_connect_info conninfo = {0};
-    conninfo.context = gateway->context;
+    conninfo.context = gateway->loop->context;
     conninfo.protocol = lwsprotocols[0].name;
     conninfo.address = address;
     conninfo.port = DISCORD_GATEWAY_PORT;
@@ -1241,6 +2052,7 @@ bool gateway_connect(discord_gateway *gateway){
     conninfo.host = address;
     conninfo.ssl_connection = LCCSCF_USE_SSL;
     conninfo.pwsi = &gateway->wsi;
+    conninfo.userdata = gateway;
 
     log_write(
         logger,
@@ -1282,6 +2094,21 @@ void gateway_disconnect(discord_gateway *gateway){
 
         return;
     }
+    else if (!gateway->connected && gateway->reconnect){
+        /* waiting to reconnect, nothing left to close */
+        lws_sul_schedule(
+            gateway->loop->context,
+            0,
+            &gateway->reconnect_timer,
+            handle_reconnect_timer,
+            LWS_SET_TIMER_USEC_CANCEL
+        );
+
+        gateway->reconnect = false;
+        gateway->running = false;
+
+        return;
+    }
     else if (!gateway->connected){
         log_write(
             logger,
@@ -1297,6 +2124,14 @@ void gateway_disconnect(discord_gateway *gateway){
 
     cancel_gateway_heartbeating(gateway);
 
+    lws_sul_schedule(
+        gateway->loop->context,
+        0,
+        &gateway->identify_timer,
+        handle_identify_timer,
+        LWS_SET_TIMER_USEC_CANCEL
+    );
+
     lws_close_reason(
         gateway->wsi,
         gateway->resume ? 4000 : 1000,
@@ -1320,7 +2155,7 @@ bool gateway_run_loop(discord_gateway *gateway){
     }
 
     while (gateway->running){
-        int ret = lws_service(gateway->context, 0);
+        int ret = lws_service(gateway->loop->context, 0);
 
         if (ret){
             log_write(
@@ -1337,6 +2172,46 @@ bool gateway_run_loop(discord_gateway *gateway){
     return true;
 }
 
+/* the returned buffer starts with LWS_PRE bytes of headroom for lws_write */
+static unsigned char *encode_gateway_payload(const discord_gateway *gateway, json_object *payloadobj, size_t *length){
+    if (gateway->encoding == GATEWAY_ENCODING_ETF){
+        return etf_encode(payloadobj, LWS_PRE, length);
+    }
+
+    const char *payloadstr = json_object_to_json_string(payloadobj);
+
+    if (!payloadstr){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] encode_gateway_payload() - json payload object to string failed\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    size_t payloadstrlen = strlen(payloadstr);
+    unsigned char *payload = malloc(LWS_PRE + payloadstrlen + 1);
+
+    if (!payload){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] encode_gateway_payload() - payload alloc failed\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    memcpy(payload + LWS_PRE, payloadstr, payloadstrlen + 1);
+
+    *length = payloadstrlen;
+
+    return payload;
+}
+
 bool gateway_send(discord_gateway *gateway, discord_gateway_opcodes op, json_object *data){
     if (!gateway){
         log_write(
@@ -1401,31 +2276,14 @@ bool gateway_send(discord_gateway *gateway, discord_gateway_opcodes op, json_obj
     json_object_object_add(payloadobj, "op", opobj);
     json_object_object_add(payloadobj, "d", json_object_get(data));
 
-    const char *payloadstr = json_object_to_json_string(payloadobj);
-
-    if (!payloadstr){
-        log_write(
-            logger,
-            LOG_ERROR,
-            "[%s] gateway_send() - json payload object to string failed\n",
-            __FILE__
-        );
-
-        json_object_put(payloadobj);
-
-        return false;
-    }
-
-    size_t payloadstrlen = strlen(payloadstr);
-
-    size_t payloadsize = LWS_PRE + payloadstrlen + 1;
-    char *payload = malloc(payloadsize);
+    size_t payloadlen = 0;
+    unsigned char *payload = encode_gateway_payload(gateway, payloadobj, &payloadlen);
 
     if (!payload){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] gateway_send() - payload alloc failed\n",
+            "[%s] gateway_send() - encode_gateway_payload call failed\n",
             __FILE__
         );
 
@@ -1434,11 +2292,9 @@ bool gateway_send(discord_gateway *gateway, discord_gateway_opcodes op, json_obj
         return false;
     }
 
-    string_copy(payloadstr, payload + LWS_PRE, payloadsize);
-
     list_item item = {0};
     item.type = L_TYPE_STRING;
-    item.size = payloadsize;
+    item.size = LWS_PRE + payloadlen;
     item.data = payload;
 
     bool success = list_append(gateway->queue, &item);
@@ -1468,6 +2324,40 @@ bool gateway_send(discord_gateway *gateway, discord_gateway_opcodes op, json_obj
     return success;
 }
 
+const discord_gateway_stats *gateway_get_stats(const discord_gateway *gateway){
+    if (!gateway){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] gateway_get_stats() - gateway is NULL\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    return &gateway->stats;
+}
+
+/* inflated over compressed bytes, 5.0 means the wire carried a fifth of the json */
+double gateway_get_compression_ratio(const discord_gateway *gateway){
+    if (!gateway){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] gateway_get_compression_ratio() - gateway is NULL\n",
+            __FILE__
+        );
+
+        return 0;
+    }
+    else if (!gateway->stats.compressed_bytes){
+        return 0;
+    }
+
+    return (double)gateway->stats.inflated_bytes / gateway->stats.compressed_bytes;
+}
+
 void gateway_free(discord_gateway *gateway){
     if (!gateway){
         log_write(
@@ -1480,14 +2370,18 @@ void gateway_free(discord_gateway *gateway){
         return;
     }
 
+    if (gateway->owns_loop){
+        gateway_loop_free(gateway->loop);
+    }
+
     if (gateway->buffer){
         free(gateway->buffer->data);
         free(gateway->buffer);
     }
 
-    list_free(gateway->queue);
+    free_gateway_inflater(gateway->inflater);
 
-    lws_context_destroy(gateway->context);
+    list_free(gateway->queue);
 
     free(gateway->endpoint);
     free(gateway);
@@ -5,7 +5,12 @@
 
 #include <libwebsockets.h>
 
+#include <stdatomic.h>
+
 typedef struct gateway_receive_buffer gateway_receive_buffer;
+typedef struct gateway_inflater gateway_inflater;
+typedef struct discord_shard_manager discord_shard_manager;
+typedef struct discord_gateway_loop discord_gateway_loop;
 
 typedef enum discord_gateway_opcodes {
     GATEWAY_OP_DISPATCH = 0,
@@ -22,6 +27,93 @@ typedef enum discord_gateway_opcodes {
     GATEWAY_OP_GUILD_SYNC = 12
 } discord_gateway_opcodes;
 
+/* ETF payloads are decoded into the same json objects the json encoding yields */
+typedef enum discord_gateway_encoding {
+    GATEWAY_ENCODING_JSON,
+    GATEWAY_ENCODING_ETF
+} discord_gateway_encoding;
+
+/* dispatch event names, resolved once per payload and used to index callbacks */
+typedef enum discord_gateway_event_type {
+    GATEWAY_EVENT_UNKNOWN,
+    GATEWAY_EVENT_READY,
+    GATEWAY_EVENT_RESUMED,
+    GATEWAY_EVENT_APPLICATION_COMMAND_PERMISSIONS_UPDATE,
+    GATEWAY_EVENT_AUTO_MODERATION_RULE_CREATE,
+    GATEWAY_EVENT_AUTO_MODERATION_RULE_UPDATE,
+    GATEWAY_EVENT_AUTO_MODERATION_RULE_DELETE,
+    GATEWAY_EVENT_AUTO_MODERATION_ACTION_EXECUTION,
+    GATEWAY_EVENT_CHANNEL_CREATE,
+    GATEWAY_EVENT_CHANNEL_UPDATE,
+    GATEWAY_EVENT_CHANNEL_DELETE,
+    GATEWAY_EVENT_CHANNEL_PINS_UPDATE,
+    GATEWAY_EVENT_THREAD_CREATE,
+    GATEWAY_EVENT_THREAD_UPDATE,
+    GATEWAY_EVENT_THREAD_DELETE,
+    GATEWAY_EVENT_THREAD_LIST_SYNC,
+    GATEWAY_EVENT_THREAD_MEMBER_UPDATE,
+    GATEWAY_EVENT_THREAD_MEMBERS_UPDATE,
+    GATEWAY_EVENT_ENTITLEMENT_CREATE,
+    GATEWAY_EVENT_ENTITLEMENT_UPDATE,
+    GATEWAY_EVENT_ENTITLEMENT_DELETE,
+    GATEWAY_EVENT_GUILD_CREATE,
+    GATEWAY_EVENT_GUILD_UPDATE,
+    GATEWAY_EVENT_GUILD_DELETE,
+    GATEWAY_EVENT_GUILD_AUDIT_LOG_ENTRY_CREATE,
+    GATEWAY_EVENT_GUILD_BAN_ADD,
+    GATEWAY_EVENT_GUILD_BAN_REMOVE,
+    GATEWAY_EVENT_GUILD_EMOJIS_UPDATE,
+    GATEWAY_EVENT_GUILD_STICKERS_UPDATE,
+    GATEWAY_EVENT_GUILD_INTEGRATIONS_UPDATE,
+    GATEWAY_EVENT_GUILD_MEMBER_ADD,
+    GATEWAY_EVENT_GUILD_MEMBER_REMOVE,
+    GATEWAY_EVENT_GUILD_MEMBER_UPDATE,
+    GATEWAY_EVENT_GUILD_MEMBERS_CHUNK,
+    GATEWAY_EVENT_GUILD_ROLE_CREATE,
+    GATEWAY_EVENT_GUILD_ROLE_UPDATE,
+    GATEWAY_EVENT_GUILD_ROLE_DELETE,
+    GATEWAY_EVENT_GUILD_SCHEDULED_EVENT_CREATE,
+    GATEWAY_EVENT_GUILD_SCHEDULED_EVENT_UPDATE,
+    GATEWAY_EVENT_GUILD_SCHEDULED_EVENT_DELETE,
+    GATEWAY_EVENT_GUILD_SCHEDULED_EVENT_USER_ADD,
+    GATEWAY_EVENT_GUILD_SCHEDULED_EVENT_USER_REMOVE,
+    GATEWAY_EVENT_GUILD_SOUNDBOARD_SOUND_CREATE,
+    GATEWAY_EVENT_GUILD_SOUNDBOARD_SOUND_UPDATE,
+    GATEWAY_EVENT_GUILD_SOUNDBOARD_SOUND_DELETE,
+    GATEWAY_EVENT_GUILD_SOUNDBOARD_SOUNDS_UPDATE,
+    GATEWAY_EVENT_SOUNDBOARD_SOUNDS,
+    GATEWAY_EVENT_INTEGRATION_CREATE,
+    GATEWAY_EVENT_INTEGRATION_UPDATE,
+    GATEWAY_EVENT_INTEGRATION_DELETE,
+    GATEWAY_EVENT_INTERACTION_CREATE,
+    GATEWAY_EVENT_INVITE_CREATE,
+    GATEWAY_EVENT_INVITE_DELETE,
+    GATEWAY_EVENT_MESSAGE_CREATE,
+    GATEWAY_EVENT_MESSAGE_UPDATE,
+    GATEWAY_EVENT_MESSAGE_DELETE,
+    GATEWAY_EVENT_MESSAGE_DELETE_BULK,
+    GATEWAY_EVENT_MESSAGE_REACTION_ADD,
+    GATEWAY_EVENT_MESSAGE_REACTION_REMOVE,
+    GATEWAY_EVENT_MESSAGE_REACTION_REMOVE_ALL,
+    GATEWAY_EVENT_MESSAGE_REACTION_REMOVE_EMOJI,
+    GATEWAY_EVENT_MESSAGE_POLL_VOTE_ADD,
+    GATEWAY_EVENT_MESSAGE_POLL_VOTE_REMOVE,
+    GATEWAY_EVENT_PRESENCE_UPDATE,
+    GATEWAY_EVENT_STAGE_INSTANCE_CREATE,
+    GATEWAY_EVENT_STAGE_INSTANCE_UPDATE,
+    GATEWAY_EVENT_STAGE_INSTANCE_DELETE,
+    GATEWAY_EVENT_SUBSCRIPTION_CREATE,
+    GATEWAY_EVENT_SUBSCRIPTION_UPDATE,
+    GATEWAY_EVENT_SUBSCRIPTION_DELETE,
+    GATEWAY_EVENT_TYPING_START,
+    GATEWAY_EVENT_USER_UPDATE,
+    GATEWAY_EVENT_VOICE_CHANNEL_EFFECT_SEND,
+    GATEWAY_EVENT_VOICE_STATE_UPDATE,
+    GATEWAY_EVENT_VOICE_SERVER_UPDATE,
+    GATEWAY_EVENT_WEBHOOKS_UPDATE,
+    GATEWAY_EVENT_COUNT
+} discord_gateway_event_type;
+
 typedef bool (*discord_gateway_event)(void *, const void *);
 
 typedef struct discord_gateway_events {
@@ -29,19 +121,54 @@ typedef struct discord_gateway_events {
     discord_gateway_event event;
 } discord_gateway_events;
 
+/* compress requests zlib-stream transport compression for the connection */
 typedef struct discord_gateway_options {
     bool compress;
+    discord_gateway_encoding encoding;
     int large_threshold;
 
     const discord_gateway_events *events;
+
+    /* set by the shard manager, shard_count 0 leaves identify unsharded */
+    int shard_id;
+    int shard_count;
+    discord_shard_manager *manager;
+
+    /* shared with other gateways serviced by the same thread, NULL for a private one */
+    discord_gateway_loop *loop;
 } discord_gateway_options;
 
+/*
+ * an lws context, with drives_http the http client's sockets and timer are
+ * attached to it (only one loop can drive the http client)
+ */
+typedef struct discord_gateway_loop {
+    discord_state *state;
+    struct lws_context *context;
+    bool drives_http;
+
+    /* asynchronous http requests driven by the same event loop */
+    lws_sorted_usec_list_t http_timer;
+} discord_gateway_loop;
+
+/*
+ * compressed_bytes is what arrived on the wire and inflated_bytes the json it
+ * inflated to, both stay 0 without compress
+ */
+typedef struct discord_gateway_stats {
+    size_t messages;
+    uint64_t compressed_bytes;
+    uint64_t inflated_bytes;
+    uint64_t inflate_time_us;
+} discord_gateway_stats;
+
 typedef struct discord_gateway {
     discord_state *state;
 
     /* gateway connection */
     int version;
     bool compress;
+    discord_gateway_encoding encoding;
     char *endpoint;
 
     int shards;
@@ -53,7 +180,24 @@ typedef struct discord_gateway {
     int large_threshold;
     const discord_gateway_events *events;
 
-    bool running;
+    /*
+     * open addressing table of event names hashed with FNV-1a, filled at init,
+     * and the user's callbacks indexed by event type
+     */
+    uint8_t event_slots[DISCORD_GATEWAY_EVENT_SLOTS];
+    discord_gateway_event callbacks[GATEWAY_EVENT_COUNT];
+
+    /* sharding */
+    int shard_id;
+    int shard_count;
+    discord_shard_manager *manager;
+    lws_sorted_usec_list_t identify_timer;
+
+    /* pending while reconnect is set and the connection is closed */
+    lws_sorted_usec_list_t reconnect_timer;
+
+    /* read by the shard manager's thread when shards run on worker threads */
+    atomic_bool running;
 
     bool connected;
     bool reconnect;
@@ -62,19 +206,29 @@ typedef struct discord_gateway {
     char session_id[33];
     int last_sequence;
 
+    /* the MESSAGE_DELETE callback's data */
+    snowflake deleted_message_id;
+
     unsigned long last_sent;
     int sent_count;
 
     int heartbeat_interval_us;
     bool awaiting_heartbeat_ack;
 
-    /* websocket */
-    struct lws_context *context;
+    /* websocket, the loop is shared when the gateway is a managed shard */
+    discord_gateway_loop *loop;
+    bool owns_loop;
     struct lws *wsi;
     list *queue;
     gateway_receive_buffer *buffer;
+    gateway_inflater *inflater;
+
+    discord_gateway_stats stats;
 } discord_gateway;
 
+discord_gateway_loop *gateway_loop_init(discord_state *, bool);
+void gateway_loop_free(discord_gateway_loop *);
+
 discord_gateway *gateway_init(discord_state *, const discord_gateway_options *);
 
 bool gateway_connect(discord_gateway *);
@@ -83,6 +237,9 @@ bool gateway_run_loop(discord_gateway *);
 
 bool gateway_send(discord_gateway *, discord_gateway_opcodes, json_object *);
 
+const discord_gateway_stats *gateway_get_stats(const discord_gateway *);
+double gateway_get_compression_ratio(const discord_gateway *);
+
 void gateway_free(discord_gateway *);
 
 #endif
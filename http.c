@@ -1,545 +1,840 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "http.h"
 
 #include "c-utils/log.h"
 #include "c-utils/str.h"
 
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
 #include <stdlib.h>
+#include <strings.h>
 #include <time.h>
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <curl/curl.h>
 
 static const logctx *logger = NULL;
 
+static const char *methods[] = {
+    [DISCORD_HTTP_GET] = "GET",
+    [DISCORD_HTTP_DELETE] = "DELETE",
+    [DISCORD_HTTP_PATCH] = "PATCH",
+    [DISCORD_HTTP_POST] = "POST",
+    [DISCORD_HTTP_PUT] = "PUT"
+};
+
 struct responsestr {
     char *data;
     size_t length;
+    size_t capacity;
 };
 
-static bool is_rate_limited(discord_http *http, const char *bucket){
-    if (!http){
-        log_write(
-            logger,
-            LOG_ERROR,
-            "[%s] get_rate_limit() - http is NULL\n",
-            __FILE__
-        );
+struct http_bucket {
+    http_bucket *prev;
+    http_bucket *next;
 
-        return true;
-    }
-    else if (!bucket){
-        log_write(
-            logger,
-            LOG_ERROR,
-            "[%s] is_rate_limited() - bucket is NULL\n",
-            __FILE__
-        );
+    char key[DISCORD_HTTP_BUCKET_KEY_LENGTH];
+    char hash[DISCORD_HTTP_BUCKET_HASH_LENGTH + 1];
 
-        return true;
-    }
+    /* index into bucket_locks, which guards remaining, reset and inflight */
+    size_t stripe;
 
-    if (http->globalratelimit){
-        bucket = "global";
-    }
+    int remaining;
+    uint64_t reset;
+    size_t inflight;
 
-    size_t bucketlen = strlen(bucket);
-    double retryafter = map_get_double(http->buckets, bucketlen, bucket);
+    /* the route answered without rate limit headers, so there are none to learn first */
+    bool unlimited;
 
-    if (retryafter > 0){
-        time_t curr = time(NULL);
-        time_t diff = retryafter - curr;
+    /* transfers holding the bucket, it is never evicted while in use */
+    size_t references;
+};
 
-        if (retryafter >= curr){
-            log_write(
-                logger,
-                LOG_WARNING,
-                "[%s] is_rate_limited() - rate limit expires in %lu seconds (bucket: %s)\n",
-                __FILE__,
-                diff,
-                bucket
-            );
+/* an identical GET that attached itself to a transfer already pending */
+typedef struct http_waiter {
+    struct http_waiter *next;
+
+    discord_http_callback callback;
+    void *userdata;
+} http_waiter;
+
+/* the userdata of a discord_http_request call waiting on a pending GET */
+typedef struct http_blocking_waiter {
+    discord_http_response *response;
+    bool done;
+} http_blocking_waiter;
+
+struct http_transfer {
+    http_transfer *prev;
+    http_transfer *next;
+    http_transfer_queue *queue;
+
+    discord_http *http;
+    CURL *handle;
+    http_bucket *bucket;
+    json_object *data;
+    curl_mime *mime;
+    /* per-request headers only, the shared ones belong to discord_http */
+    struct curl_slist *requestheaders;
+    struct responsestr responseheaders;
+    discord_http_ratelimit ratelimit;
+
+    /* the body is parsed while it arrives */
+    json_tokener *tokener;
+    json_object *responsedata;
+    bool parsefailed;
+    discord_http_method method;
+    discord_http_priority priority;
+
+    /* retries so far and when the next attempt may start */
+    size_t ratelimited;
+    size_t failures;
+    uint64_t created;
+    uint64_t retry_at;
+
+    /* a discord_http_request call waiting in a lane, it performs the request once dispatched */
+    bool blocking;
+    bool dispatched;
+
+    /* telemetry, ready_since is when the transfer last could have been sent */
+    discord_http_route_stats *routestats;
+    uint64_t ready_since;
+    uint64_t waited;
+
+    discord_http_callback callback;
+    void *userdata;
+
+    /* only set for GET requests, which may be coalesced and cached */
+    char *path;
+    char *etag;
+    /* the key in discord_http.pending while other GETs can attach to it */
+    char *pendingkey;
+    /* the cached body revalidated with If-None-Match, pinned for a 304 */
+    json_object *revalidated;
+    http_waiter *waiters;
+    size_t waiters_length;
+};
 
-            return true;
-        }
+/* read position of a file part, curl pulls the bytes straight from it */
+typedef struct http_upload {
+    int fd;
+    const char *data;
+    size_t size;
+    size_t offset;
+    bool mapped;
+} http_upload;
+
+typedef struct http_socket {
+    int fd;
+    int events;
+    void *loopdata;
+} http_socket;
+
+struct http_cache_entry {
+    http_cache_entry *prev;
+    http_cache_entry *next;
+
+    char *path;
+    char *etag;
+    json_object *data;
+    uint64_t expires;
+
+    /* route template with the major parameter, writes to it invalidate the entry */
+    char route[DISCORD_HTTP_BUCKET_KEY_LENGTH];
+};
 
-        map_remove(http->buckets, bucketlen, bucket);
-    }
+static uint64_t get_time_ms(void){
+    struct timespec ts = {0};
 
-    http->ratelimited = false;
-    http->globalratelimit = false;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 
-    return false;
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
 }
 
-static bool set_rate_limited(discord_http *http, const char *bucket, double retryafter){
-    if (!http){
-        log_write(
-            logger,
-            LOG_ERROR,
-            "[%s] set_rate_limited() - http is NULL\n",
-            __FILE__
-        );
+static void sleep_ms(uint64_t ms){
+    struct timespec ts = {0};
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000;
 
-        return false;
+    while (nanosleep(&ts, &ts) && errno == EINTR);
+}
+
+/* lock_http calls made by the current thread, set while callbacks run */
+static _Thread_local unsigned int held_locks = 0;
+
+static void lock_http(discord_http *http){
+    if (http->thread_safe){
+        pthread_mutex_lock(&http->lock);
+
+        held_locks += 1;
     }
+}
 
-    if (http->globalratelimit){
-        bucket = "global";
+static void unlock_http(discord_http *http){
+    if (http->thread_safe){
+        held_locks -= 1;
+
+        pthread_mutex_unlock(&http->lock);
     }
+}
 
-    map_item k = {0};
-    k.type = M_TYPE_STRING;
-    k.size = strlen(bucket);
-    k.data_copy = bucket;
+static void lock_bucket(discord_http *http, const http_bucket *bucket){
+    if (http->thread_safe){
+        pthread_mutex_lock(&http->bucket_locks[bucket->stripe]);
+    }
+}
 
-    map_item v = {0};
-    v.type = M_TYPE_DOUBLE;
-    v.size = sizeof(retryafter);
-    v.data_copy = &retryafter;
+static void unlock_bucket(discord_http *http, const http_bucket *bucket){
+    if (http->thread_safe){
+        pthread_mutex_unlock(&http->bucket_locks[bucket->stripe]);
+    }
+}
 
-    bool success = map_set(http->buckets, &k, &v);
+static void lock_global(discord_http *http){
+    if (http->thread_safe){
+        pthread_mutex_lock(&http->global_lock);
+    }
+}
 
-    if (!success){
-        log_write(
-            logger,
-            LOG_ERROR,
-            "[%s] set_rate_limited() - failed to store bucket rate limit\n",
-            __FILE__
-        );
+static void unlock_global(discord_http *http){
+    if (http->thread_safe){
+        pthread_mutex_unlock(&http->global_lock);
     }
+}
 
-    http->ratelimited = true;
+static void lock_share(CURL *handle, curl_lock_data data, curl_lock_access access, void *httpptr){
+    (void)handle;
+    (void)access;
 
-    return success;
+    discord_http *http = httpptr;
+
+    pthread_mutex_lock(&http->share_locks[data]);
 }
 
-static size_t write_response_headers(char *data, size_t size, size_t nitems, void *out){
-    size *= nitems;
-    map *m = out;
+static void unlock_share(CURL *handle, curl_lock_data data, void *httpptr){
+    (void)handle;
 
-    list *parts = string_split_len(data, size, ": ", 1);
+    discord_http *http = httpptr;
 
-    if (!parts){
-        log_write(
-            logger,
-            LOG_ERROR,
-            "[%s] write_response_headers() - string_split_len call failed\n",
-            __FILE__
-        );
+    pthread_mutex_unlock(&http->share_locks[data]);
+}
 
-        return 0;
+static void unlink_bucket(discord_http *http, http_bucket *bucket){
+    if (bucket->prev){
+        bucket->prev->next = bucket->next;
+    }
+    else {
+        http->bucket_list = bucket->next;
     }
-    else if (list_get_length(parts) != 2){
-        list_free(parts);
 
-        return size;
+    if (bucket->next){
+        bucket->next->prev = bucket->prev;
     }
 
-    const char *key = list_get_string(parts, 0);
-    const char *value = list_get_string(parts, 1);
+    bucket->prev = NULL;
+    bucket->next = NULL;
+}
 
-    map_item k = {0};
-    k.type = M_TYPE_STRING;
-    k.size = strlen(key);
-    k.data_copy = key;
+/* drops buckets whose window is over, they hold nothing a new bucket would not */
+static void evict_expired_buckets(discord_http *http, uint64_t now){
+    if (now < http->bucket_sweep){
+        return;
+    }
 
-    map_item v = {0};
-    v.type = M_TYPE_STRING;
-    v.size = strlen(value) - 2;
-    v.data_copy = value;
+    http->bucket_sweep = now + DISCORD_HTTP_BUCKET_SWEEP_INTERVAL;
 
-    bool success = map_set(m, &k, &v);
+    http_bucket *bucket = http->bucket_list;
 
-    list_free(parts);
+    while (bucket){
+        http_bucket *next = bucket->next;
 
-    if (!success){
-        log_write(
-            logger,
-            LOG_ERROR,
-            "[%s] write_response_headers() - map_set call failed\n",
-            __FILE__
-        );
+        lock_bucket(http, bucket);
 
-        return 0;
-    }
+        bool expired = bucket->reset <= now;
 
-    return size;
-}
+        unlock_bucket(http, bucket);
 
-static size_t write_response_data(char *data, size_t length, size_t nmemb, void *out){
-    length *= nmemb;
-    struct responsestr *res = out;
+        if (!bucket->references && expired){
+            char key[DISCORD_HTTP_BUCKET_KEY_LENGTH];
+            size_t keylen = strlen(bucket->key);
 
-    char *tmp = realloc(res->data, res->length + length + 1);
+            /* the map frees the bucket along with its key */
+            memcpy(key, bucket->key, keylen + 1);
 
-    if (!tmp){
-        log_write(
-            logger,
-            LOG_ERROR,
-            "[%s] write_response_data() - buffer data realloc failed\n",
-            __FILE__
-        );
+            unlink_bucket(http, bucket);
+            map_remove(http->buckets, keylen, key);
+        }
 
-        return 0;
+        bucket = next;
     }
-
-    memcpy(tmp + res->length, data, length);
-
-    res->data = tmp;
-    res->length += length;
-    res->data[res->length] = '\0';
-
-    return length;
 }
 
-static char *create_request_bucket(const char *path){
-    if (!path){
-        log_write(
-            logger,
-            LOG_ERROR,
-            "[%s] create_request_bucket() - path is NULL\n",
-            __FILE__
-        );
+static http_bucket *get_bucket(discord_http *http, const char *key){
+    size_t keylen = strlen(key);
 
-        return NULL;
+    evict_expired_buckets(http, get_time_ms());
+
+    if (map_contains(http->buckets, keylen, key)){
+        return map_get_generic(http->buckets, keylen, key);
     }
 
-    list *parts = string_split(path, "/", -1);
+    http_bucket *bucket = calloc(1, sizeof(*bucket));
 
-    if (!parts){
+    if (!bucket){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] create_request_bucket() - failed to split path string\n",
+            "[%s] get_bucket() - calloc for bucket failed\n",
             __FILE__
         );
 
         return NULL;
     }
 
-    const char *channelid = "NULL";
-    const char *guildid = "NULL";
+    memcpy(bucket->key, key, keylen + 1);
+    bucket->remaining = -1;
 
-    if (!strcmp(list_get_string(parts, 1), "channels")){
-        channelid = list_get_string(parts, 2);
-    }
-    else if (!strcmp(list_get_string(parts, 1), "guilds")){
-        guildid = list_get_string(parts, 2);
+    /* FNV-1a, spreads routes over the stripes */
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (size_t index = 0; index < keylen; ++index){
+        hash ^= (unsigned char)key[index];
+        hash *= 1099511628211ULL;
     }
 
-    char *bucket = string_create("%s:%s:%s", channelid, guildid, path);
+    bucket->stripe = hash % DISCORD_HTTP_LOCK_STRIPES;
 
-    list_free(parts);
+    map_item k = {0};
+    k.type = M_TYPE_STRING;
+    k.size = keylen;
+    k.data_copy = key;
 
-    if (!bucket){
+    map_item v = {0};
+    v.type = M_TYPE_GENERIC;
+    v.size = sizeof(bucket);
+    v.data = bucket;
+    v.generic_free = free;
+
+    if (!map_set(http->buckets, &k, &v)){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] create_request_bucket() - failed to create bucket string\n",
+            "[%s] get_bucket() - map_set call failed\n",
             __FILE__
         );
 
+        free(bucket);
+
         return NULL;
     }
 
+    bucket->next = http->bucket_list;
+
+    if (http->bucket_list){
+        http->bucket_list->prev = bucket;
+    }
+
+    http->bucket_list = bucket;
+
     return bucket;
 }
 
-static struct curl_slist *create_request_header_list(const discord_http *http, const discord_http_request_options *opts){
-    if (!http){
-        log_write(
-            logger,
-            LOG_ERROR,
-            "[%s] create_request_header_list() - http is NULL\n",
-            __FILE__
-        );
+static void refill_global_tokens(discord_http *http, uint64_t now){
+    if (now <= http->global_refill){
+        return;
+    }
 
-        return NULL;
+    http->global_tokens += (now - http->global_refill) * http->global_rate / 1000;
+    http->global_refill = now;
+
+    /* an idle client may burst up to one second worth of requests */
+    if (http->global_tokens > http->global_rate){
+        http->global_tokens = http->global_rate;
     }
+}
 
-    struct curl_slist *headers = NULL;
-    struct curl_slist *tmp = NULL;
+/*
+ * returns false if a request in the bucket would be rate limited right now,
+ * wait is set to the milliseconds left until it may be sent
+ */
+static bool can_send_request(discord_http *http, const http_transfer *transfer, uint64_t now, uint64_t *wait){
+    http_bucket *bucket = transfer->bucket;
+    *wait = 0;
+
+    if (http->global_reset > now){
+        *wait = http->global_reset - now;
+    }
 
-    if (opts){
-        if (opts->data){
-            tmp = curl_slist_append(NULL, "Content-Type: application/json");
-
-            if (!tmp){
-                log_write(
-                    logger,
-                    LOG_ERROR,
-                    "[%s] create_request_header_list() - failed to append content type header\n",
-                    __FILE__
-                );
-
-                return NULL;
+    if (!bucket->remaining){
+        if (bucket->reset > now){
+            if (bucket->reset - now > *wait){
+                *wait = bucket->reset - now;
             }
-
-            headers = tmp;
         }
+        else {
+            /* window is over, limits are learned again from the next response */
+            bucket->remaining = -1;
+        }
+    }
 
-        if (opts->reason){
-            char *reason = string_create("X-Audit-Log-Reason: %s", opts->reason);
+    if (*wait){
+        return false;
+    }
 
-            if (!reason){
-                log_write(
-                    logger,
-                    LOG_ERROR,
-                    "[%s] create_request_header_list() - failed to create reason string\n",
-                    __FILE__
-                );
+    /* the global pace only applies once the route itself has room */
+    refill_global_tokens(http, now);
 
-                curl_slist_free_all(headers);
+    double needed = 1;
 
-                return NULL;
-            }
+    if (transfer->priority == DISCORD_HTTP_PRIORITY_LOW){
+        needed += http->global_rate * DISCORD_HTTP_LOW_PRIORITY_RESERVE;
+    }
 
-            tmp = curl_slist_append(headers, reason);
+    if (http->global_tokens < needed){
+        *wait = (uint64_t)((needed - http->global_tokens) * 1000 / http->global_rate) + 1;
+    }
 
-            free(reason);
+    return !*wait;
+}
 
-            if (!tmp){
-                log_write(
-                    logger,
-                    LOG_ERROR,
-                    "[%s] create_request_header_list() - failed to append reason header\n",
-                    __FILE__
-                );
+static void reserve_bucket(discord_http *http, http_bucket *bucket){
+    if (bucket->remaining > 0){
+        bucket->remaining -= 1;
+    }
 
-                curl_slist_free_all(headers);
+    bucket->inflight += 1;
+    http->global_tokens -= 1;
+}
 
-                return NULL;
-            }
+/*
+ * checks and takes a request from the bucket and the global limit in one
+ * step, so concurrent callers cannot both take the last one
+ *
+ * with probe, only the first request goes out while the bucket's limits are
+ * unknown, the others fail with wait 0 until its response arrives, unless
+ * the route's last response showed it has no limits to learn
+ */
+static bool try_reserve_bucket(discord_http *http, const http_transfer *transfer, bool probe, uint64_t now, uint64_t *wait){
+    http_bucket *bucket = transfer->bucket;
+
+    lock_bucket(http, bucket);
+    lock_global(http);
+
+    bool success = can_send_request(http, transfer, now, wait);
+
+    if (success && probe && bucket->remaining < 0 && bucket->inflight && !bucket->unlimited){
+        success = false;
+    }
 
-            headers = tmp;
-        }
+    if (success){
+        reserve_bucket(http, bucket);
     }
 
-    char *authorization = string_create("Authorization: Bot %s", http->token);
+    unlock_global(http);
+    unlock_bucket(http, bucket);
 
-    if (!authorization){
-        log_write(
-            logger,
-            LOG_ERROR,
-            "[%s] create_request_header_list() - failed to create authorization string\n",
-            __FILE__
-        );
+    return success;
+}
 
-        curl_slist_free_all(headers);
+static void update_bucket(discord_http *http, http_bucket *bucket, const discord_http_response *response){
+    uint64_t now = get_time_ms();
 
-        return NULL;
-    }
+    lock_bucket(http, bucket);
 
-    tmp = curl_slist_append(headers, authorization);
+    if (bucket->inflight){
+        bucket->inflight -= 1;
+    }
 
-    free(authorization);
+    if (!response){
+        unlock_bucket(http, bucket);
 
-    if (!tmp){
-        log_write(
-            logger,
-            LOG_ERROR,
-            "[%s] create_request_header_list() - failed to append authorization header\n",
-            __FILE__
-        );
+        return;
+    }
 
-        curl_slist_free_all(headers);
+    const discord_http_ratelimit *ratelimit = &response->ratelimit;
 
-        return NULL;
+    if (ratelimit->bucket[0]){
+        string_copy(ratelimit->bucket, bucket->hash, sizeof(bucket->hash));
     }
 
-    headers = tmp;
+    if (response->status != 429){
+        bucket->unlimited = ratelimit->remaining < 0;
+    }
 
-    char *useragent = string_create("User-Agent: %s", DISCORD_USER_AGENT);
+    if (ratelimit->remaining >= 0){
+        /* requests still in flight were sent after this one was counted */
+        int remaining = ratelimit->remaining - (int)bucket->inflight;
 
-    if (!useragent){
-        log_write(
-            logger,
-            LOG_ERROR,
-            "[%s] create_request_header_list() - failed to create user agent string\n",
-            __FILE__
-        );
+        bucket->remaining = remaining > 0 ? remaining : 0;
+        bucket->reset = now + (uint64_t)(ratelimit->reset_after * 1000);
+    }
 
-        curl_slist_free_all(headers);
+    if (response->status != 429){
+        unlock_bucket(http, bucket);
 
-        return NULL;
+        return;
     }
 
-    tmp = curl_slist_append(headers, useragent);
+    double retryafter = ratelimit->retry_after;
 
-    free(useragent);
+    if (retryafter <= 0){
+        retryafter = ratelimit->reset_after;
+    }
 
-    if (!tmp){
-        log_write(
-            logger,
-            LOG_ERROR,
-            "[%s] create_request_header_list() - failed to append user agent header\n",
-            __FILE__
-        );
+    uint64_t reset = now + (uint64_t)(retryafter * 1000);
 
-        curl_slist_free_all(headers);
+    if (ratelimit->global){
+        lock_global(http);
 
-        return NULL;
+        http->global_reset = reset;
+
+        unlock_global(http);
+    }
+    else {
+        bucket->remaining = 0;
+        bucket->reset = reset;
     }
 
-    headers = tmp;
+    unlock_bucket(http, bucket);
 
-    tmp = curl_slist_append(headers, "Accept: application/json");
+    log_write(
+        logger,
+        LOG_WARNING,
+        "[%s] update_bucket() - rate limit exceeded, retrying in %.3f seconds (bucket: %s)\n",
+        __FILE__,
+        retryafter,
+        ratelimit->global ? "global" : bucket->key
+    );
+}
 
-    if (!tmp){
-        log_write(
-            logger,
-            LOG_ERROR,
-            "[%s] create_request_header_list() - failed to append accept header\n",
-            __FILE__
-        );
+static bool is_header(const char *name, size_t length, const char *expected){
+    return length == strlen(expected) && !strncasecmp(name, expected, length);
+}
 
-        curl_slist_free_all(headers);
+/* splits a raw "Name: value\r\n" line, the value is trimmed */
+static bool split_header_line(const char *line, size_t length, size_t *namelength, const char **value, size_t *valuelength){
+    const char *colon = memchr(line, ':', length);
 
-        return NULL;
+    if (!colon){
+        return false;
     }
 
-    headers = tmp;
+    const char *start = colon + 1;
+    const char *end = line + length;
 
-    return headers;
+    while (start < end && (*start == ' ' || *start == '\t')){
+        ++start;
+    }
+
+    while (end > start && isspace((unsigned char)end[-1])){
+        --end;
+    }
+
+    *namelength = colon - line;
+    *value = start;
+    *valuelength = end - start;
+
+    return true;
 }
 
-static bool set_request_method(CURL *handle, discord_http_method method, const discord_http_request_options *opts){
-    if (!handle){
-        log_write(
-            logger,
-            LOG_ERROR,
-            "[%s] set_request_method() - handle is NULL\n",
-            __FILE__
-        );
+static void parse_rate_limit_header(discord_http_ratelimit *ratelimit, const char *line, size_t length){
+    size_t namelength = 0;
+    const char *value = NULL;
+    size_t valuelength = 0;
 
-        return false;
+    /* everything of interest is either x-ratelimit-* or retry-after */
+    if (!length || (tolower((unsigned char)*line) != 'x' && tolower((unsigned char)*line) != 'r')){
+        return;
+    }
+    else if (!split_header_line(line, length, &namelength, &value, &valuelength)){
+        return;
     }
 
-    CURLcode err = CURLE_FAILED_INIT;
+    /* curl does not terminate header lines */
+    char buffer[DISCORD_HTTP_BUCKET_HASH_LENGTH + 1];
 
-    if (!opts || !opts->data){
-        err = curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE, 0);
+    if (valuelength >= sizeof(buffer)){
+        valuelength = sizeof(buffer) - 1;
+    }
 
-        if (err != CURLE_OK){
-            log_write(
-                logger,
-                LOG_ERROR,
-                "[%s] set_request_method() - set CURLOPT_POSTFIELDSIZE failed\n",
-                __FILE__
-            );
+    memcpy(buffer, value, valuelength);
+    buffer[valuelength] = '\0';
 
-            return false;
-        }
+    if (is_header(line, namelength, "X-RateLimit-Limit")){
+        ratelimit->limit = strtol(buffer, NULL, 10);
     }
-    else if (opts->data){
-        const char *jsonstr = json_object_to_json_string(opts->data);
+    else if (is_header(line, namelength, "X-RateLimit-Remaining")){
+        ratelimit->remaining = strtol(buffer, NULL, 10);
+    }
+    else if (is_header(line, namelength, "X-RateLimit-Reset-After")){
+        ratelimit->reset_after = strtod(buffer, NULL);
+    }
+    else if (is_header(line, namelength, "X-RateLimit-Bucket")){
+        memcpy(ratelimit->bucket, buffer, valuelength + 1);
+    }
+    else if (is_header(line, namelength, "X-RateLimit-Global")){
+        ratelimit->global = !strcasecmp(buffer, "true");
+    }
+    else if (is_header(line, namelength, "Retry-After")){
+        ratelimit->retry_after = strtod(buffer, NULL);
+    }
+}
 
-        if (!jsonstr){
-            log_write(
-                logger,
-                LOG_ERROR,
-                "[%s] set_request_method() - failed to get json_object string\n",
-                __FILE__
-            );
+static void init_rate_limit(discord_http_ratelimit *ratelimit){
+    discord_http_ratelimit empty = {0};
+
+    *ratelimit = empty;
+    ratelimit->limit = -1;
+    ratelimit->remaining = -1;
+}
+
+static bool append_response_data(struct responsestr *res, const char *data, size_t length){
+    if (res->length + length + 1 > res->capacity){
+        size_t capacity = res->capacity ? res->capacity : 256;
+
+        while (res->length + length + 1 > capacity){
+            capacity *= 2;
+        }
+
+        char *tmp = realloc(res->data, capacity);
 
+        if (!tmp){
             return false;
         }
 
-        err = curl_easy_setopt(handle, CURLOPT_POSTFIELDS, jsonstr);
+        res->data = tmp;
+        res->capacity = capacity;
+    }
 
-        if (err != CURLE_OK){
+    memcpy(res->data + res->length, data, length);
+
+    res->length += length;
+    res->data[res->length] = '\0';
+
+    return true;
+}
+
+static void free_response_data(struct responsestr *res){
+    free(res->data);
+
+    res->data = NULL;
+    res->length = 0;
+    res->capacity = 0;
+}
+
+/*
+ * headers are kept as one raw block for discord_http_response_get_headers,
+ * only the rate limit headers are parsed while they arrive
+ */
+static size_t write_response_headers(char *data, size_t size, size_t nitems, void *out){
+    size *= nitems;
+    http_transfer *transfer = out;
+
+    size_t namelength = 0;
+    const char *value = NULL;
+    size_t valuelength = 0;
+
+    /* a status line starts over, e.g. after a redirect or 100 continue */
+    if (size >= 5 && !strncmp(data, "HTTP/", 5)){
+        transfer->responseheaders.length = 0;
+
+        init_rate_limit(&transfer->ratelimit);
+
+        free(transfer->etag);
+        transfer->etag = NULL;
+    }
+    else if (transfer->path && split_header_line(data, size, &namelength, &value, &valuelength) && is_header(data, namelength, "ETag")){
+        free(transfer->etag);
+        transfer->etag = string_create("%.*s", (int)valuelength, value);
+    }
+    else {
+        parse_rate_limit_header(&transfer->ratelimit, data, size);
+    }
+
+    if (!append_response_data(&transfer->responseheaders, data, size)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] write_response_headers() - buffer data realloc failed\n",
+            __FILE__
+        );
+
+        return 0;
+    }
+
+    return size;
+}
+
+static size_t write_response_data(char *data, size_t length, size_t nmemb, void *out){
+    length *= nmemb;
+    http_transfer *transfer = out;
+
+    /* anything after a complete or broken document is dropped */
+    if (transfer->responsedata || transfer->parsefailed){
+        return length;
+    }
+
+    if (!transfer->tokener){
+        transfer->tokener = json_tokener_new();
+
+        if (!transfer->tokener){
             log_write(
                 logger,
                 LOG_ERROR,
-                "[%s] set_request_method() - failed to set CURLOPT_POSTFIELDS\n",
+                "[%s] write_response_data() - json_tokener_new call failed\n",
                 __FILE__
             );
 
-            return false;
+            return 0;
         }
     }
 
-    switch (method){
-    case DISCORD_HTTP_GET:
-        err = curl_easy_setopt(handle, CURLOPT_HTTPGET, 1);
+    /* json_tokener_parse_ex takes an int length */
+    for (size_t offset = 0; offset < length && !transfer->responsedata;){
+        size_t chunk = length - offset;
 
-        if (err != CURLE_OK){
+        if (chunk > INT_MAX){
+            chunk = INT_MAX;
+        }
+
+        transfer->responsedata = json_tokener_parse_ex(
+            transfer->tokener,
+            data + offset,
+            (int)chunk
+        );
+
+        enum json_tokener_error err = json_tokener_get_error(transfer->tokener);
+
+        if (!transfer->responsedata && err != json_tokener_continue){
             log_write(
                 logger,
                 LOG_ERROR,
-                "[%s] set_request_method() - failed to set CURLOPT_HTTPGET\n",
-                __FILE__
+                "[%s] write_response_data() - json_tokener_parse_ex call failed: %s\n",
+                __FILE__,
+                json_tokener_error_desc(err)
             );
 
-            return false;
+            transfer->parsefailed = true;
+
+            break;
         }
 
-        break;
-    case DISCORD_HTTP_DELETE:
-        err = curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, "DELETE");
+        offset += chunk;
+    }
 
-        if (err != CURLE_OK){
-            log_write(
-                logger,
-                LOG_ERROR,
-                "[%s] set_request_method() - failed to set CURLOPT_CUSTOMREQUEST (DELETE)\n",
-                __FILE__
-            );
+    return length;
+}
+
+static bool is_id_segment(const char *segment, size_t length){
+    if (!length){
+        return false;
+    }
 
+    for (size_t index = 0; index < length; ++index){
+        if (!isdigit((unsigned char)segment[index])){
             return false;
         }
+    }
 
-        break;
-    case DISCORD_HTTP_PATCH:
-        err = curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, "PATCH");
+    return true;
+}
 
-        if (err != CURLE_OK){
-            log_write(
-                logger,
-                LOG_ERROR,
-                "[%s] set_request_method() - failed to set CURLOPT_CUSTOMREQUEST (PATCH)\n",
-                __FILE__
-            );
+static bool is_segment(const char *segment, size_t length, const char *name){
+    return length == strlen(name) && !strncmp(segment, name, length);
+}
 
-            return false;
+/*
+ * writes the route template of path into key, ids are replaced by
+ * placeholders except the major parameter (channel, guild or webhook id)
+ * when keepmajor is set
+ *
+ * e.g. /channels/123/messages/456 -> /channels/123/messages/:id
+ */
+static bool write_route_template(const char *path, bool keepmajor, char *key, size_t size){
+    size_t length = 0;
+
+    const char *previous = "";
+    size_t previouslength = 0;
+    size_t segments = 0;
+    bool webhook = false;
+    bool truncated = false;
+
+    for (const char *cursor = path; *cursor && *cursor != '?';){
+        if (*cursor == '/'){
+            if (length + 1 >= size){
+                truncated = true;
+
+                break;
+            }
+
+            key[length++] = *cursor++;
+
+            continue;
         }
 
-        break;
-    case DISCORD_HTTP_POST:
-        err = curl_easy_setopt(handle, CURLOPT_POST, 1);
+        size_t segmentlength = strcspn(cursor, "/?");
+        const char *part = cursor;
+        size_t partlength = segmentlength;
 
-        if (err != CURLE_OK){
-            log_write(
-                logger,
-                LOG_ERROR,
-                "[%s] set_request_method() - failed to set CURLOPT_POST\n",
-                __FILE__
-            );
+        bool major = keepmajor && segments == 1 && (
+            is_segment(previous, previouslength, "channels")
+            || is_segment(previous, previouslength, "guilds")
+            || is_segment(previous, previouslength, "webhooks")
+        );
 
-            return false;
+        if (major){
+            /* kept as is */
+        }
+        else if (segments == 2 && webhook){
+            part = ":token";
+        }
+        else if (is_segment(previous, previouslength, "reactions")){
+            part = ":emoji";
+        }
+        else if (is_id_segment(cursor, segmentlength)){
+            part = ":id";
         }
 
-        break;
-    case DISCORD_HTTP_PUT:
-        err = curl_easy_setopt(handle, CURLOPT_UPLOAD, 1);
+        if (part != cursor){
+            partlength = strlen(part);
+        }
 
-        if (err != CURLE_OK){
-            log_write(
-                logger,
-                LOG_ERROR,
-                "[%s] set_request_method() - failed to set CURLOPT_UPLOAD\n",
-                __FILE__
-            );
+        if (length + partlength >= size){
+            truncated = true;
 
-            return false;
+            break;
         }
 
-        break;
-    default:
+        memcpy(key + length, part, partlength);
+        length += partlength;
+
+        if (!segments){
+            webhook = is_segment(cursor, segmentlength, "webhooks");
+        }
+
+        previous = cursor;
+        previouslength = segmentlength;
+        segments += 1;
+        cursor += segmentlength;
+    }
+
+    if (size){
+        key[length] = '\0';
+    }
+
+    if (truncated){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] set_request_method() - unimplemented request method\n",
-            __FILE__
+            "[%s] write_route_template() - route does not fit in key (path: %s)\n",
+            __FILE__,
+            path
         );
 
         return false;
@@ -548,496 +843,3727 @@ static bool set_request_method(CURL *handle, discord_http_method method, const d
     return true;
 }
 
-static bool set_request_url(CURL *handle, const char *path){
-    if (!handle){
+/* e.g. DELETE /channels/123/messages/456 -> DELETE /channels/123/messages/:id */
+static bool create_request_bucket(discord_http_method method, const char *path, char *key, size_t size){
+    if (!path){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] set_request_url() - handle is NULL\n",
+            "[%s] create_request_bucket() - path is NULL\n",
             __FILE__
         );
 
         return false;
     }
-    else if (!path){
+    else if ((size_t)method >= sizeof(methods) / sizeof(*methods)){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] set_request_url() - path is NULL\n",
-            __FILE__);
+            "[%s] create_request_bucket() - unimplemented request method\n",
+            __FILE__
+        );
 
         return false;
     }
 
-    char *url = string_create("%s%s", DISCORD_API, path);
-
-    if (!url){
-        log_write(
-            logger,
-            LOG_ERROR,
-            "[%s] set_request_url() - failed to create URL string\n",
-            __FILE__);
+    size_t length = strlen(methods[method]);
 
+    if (length + 1 >= size){
         return false;
     }
 
-    CURLcode err = curl_easy_setopt(handle, CURLOPT_URL, url);
+    memcpy(key, methods[method], length);
+    key[length++] = ' ';
 
-    free(url);
+    return write_route_template(path, true, key + length, size - length);
+}
 
-    if (err != CURLE_OK){
+/* headers every request carries, built once in discord_http_init */
+static bool init_shared_headers(discord_http *http){
+    struct curl_slist *headers = NULL;
+    struct curl_slist *tmp = NULL;
+
+    char *authorization = string_create("Authorization: Bot %s", http->token);
+
+    if (!authorization){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] set_request_url() - failed to set CURLOPT_URL\n",
+            "[%s] init_shared_headers() - failed to create authorization string\n",
             __FILE__
         );
 
         return false;
     }
 
-    return true;
-}
+    tmp = curl_slist_append(headers, authorization);
 
-static bool set_request_headers(CURL *handle, const struct curl_slist *headers){
-    if (!handle){
+    free(authorization);
+
+    if (!tmp){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] set_request_headers() - handle is NULL\n",
+            "[%s] init_shared_headers() - failed to append authorization header\n",
             __FILE__
         );
 
         return false;
     }
 
-    CURLcode err = curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
+    headers = tmp;
 
-    if (err != CURLE_OK){
+    char *useragent = string_create("User-Agent: %s", DISCORD_USER_AGENT);
+
+    if (!useragent){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] set_request_headers() - failed to set CURLOPT_HTTPHEADER\n",
+            "[%s] init_shared_headers() - failed to create user agent string\n",
             __FILE__
         );
 
+        curl_slist_free_all(headers);
+
         return false;
     }
 
-    return true;
-}
+    tmp = curl_slist_append(headers, useragent);
 
-static bool set_response_header_writer(CURL *handle, void *out){
-    if (!handle){
+    free(useragent);
+
+    if (!tmp){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] set_response_header_writer() - handle is NULL\n",
+            "[%s] init_shared_headers() - failed to append user agent header\n",
             __FILE__
         );
 
+        curl_slist_free_all(headers);
+
         return false;
     }
-    else if (!out){
+
+    headers = tmp;
+
+    tmp = curl_slist_append(headers, "Accept: application/json");
+
+    if (!tmp){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] set_response_header_writer() - out is NULL\n",
+            "[%s] init_shared_headers() - failed to append accept header\n",
             __FILE__
         );
 
+        curl_slist_free_all(headers);
+
         return false;
     }
 
-    CURLcode err = curl_easy_setopt(
-        handle,
-        CURLOPT_HEADERFUNCTION,
-        write_response_headers
-    );
+    http->headers = tmp;
 
-    if (err != CURLE_OK){
+    /* requests with a body use the same list behind a content type node */
+    http->json_headers = curl_slist_append(NULL, "Content-Type: application/json");
+
+    if (!http->json_headers){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] set_response_header_writer() - failed to set CURLOPT_HEADERFUNCTION\n",
+            "[%s] init_shared_headers() - failed to append content type header\n",
             __FILE__
         );
 
         return false;
     }
 
-    err = curl_easy_setopt(handle, CURLOPT_HEADERDATA, out);
+    http->json_headers->next = http->headers;
 
-    if (err != CURLE_OK){
-        log_write(
-            logger,
-            LOG_ERROR,
-            "[%s] set_response_header_writer() - failed to set CURLOPT_HEADERDATA\n",
-            __FILE__
-        );
+    return true;
+}
+
+static void free_shared_headers(discord_http *http){
+    if (http->json_headers){
+        http->json_headers->next = NULL;
+    }
 
+    curl_slist_free_all(http->json_headers);
+    curl_slist_free_all(http->headers);
+}
+
+static bool prepend_request_header(struct curl_slist **owned, const char *header){
+    struct curl_slist *node = curl_slist_append(NULL, header);
+
+    if (!node){
         return false;
     }
 
+    node->next = *owned;
+    *owned = node;
+
     return true;
 }
 
-static bool set_response_data_writer(CURL *handle, void *out){
-    if (!handle){
+/*
+ * returns the per-request headers linked on top of the shared list, or the
+ * shared list itself when the request has none of its own
+ */
+static struct curl_slist *create_request_header_list(const discord_http *http, const discord_http_request_options *opts, const char *etag, struct curl_slist **owned){
+    if (!http){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] set_response_data_writer() - handle is NULL\n",
+            "[%s] create_request_header_list() - http is NULL\n",
             __FILE__
         );
 
-        return false;
+        return NULL;
+    }
+
+    struct curl_slist *shared = http->headers;
+    struct curl_slist *headers = NULL;
+
+    *owned = NULL;
+
+    /* curl writes the multipart content type along with its boundary */
+    if (opts && opts->data && !opts->files){
+        shared = http->json_headers;
+    }
+
+    if (opts && opts->reason){
+        char *reason = string_create("X-Audit-Log-Reason: %s", opts->reason);
+
+        if (!reason){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] create_request_header_list() - failed to create reason string\n",
+                __FILE__
+            );
+
+            return NULL;
+        }
+
+        bool success = prepend_request_header(&headers, reason);
+
+        free(reason);
+
+        if (!success){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] create_request_header_list() - failed to append reason header\n",
+                __FILE__
+            );
+
+            curl_slist_free_all(headers);
+
+            return NULL;
+        }
+    }
+
+    if (etag){
+        char *match = string_create("If-None-Match: %s", etag);
+
+        if (!match){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] create_request_header_list() - failed to create if-none-match string\n",
+                __FILE__
+            );
+
+            curl_slist_free_all(headers);
+
+            return NULL;
+        }
+
+        bool success = prepend_request_header(&headers, match);
+
+        free(match);
+
+        if (!success){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] create_request_header_list() - failed to append if-none-match header\n",
+                __FILE__
+            );
+
+            curl_slist_free_all(headers);
+
+            return NULL;
+        }
+    }
+
+    if (!headers){
+        return shared;
+    }
+
+    struct curl_slist *tail = headers;
+
+    while (tail->next){
+        tail = tail->next;
+    }
+
+    tail->next = shared;
+    *owned = headers;
+
+    return headers;
+}
+
+/* unlinks the shared list before freeing the nodes owned by the request */
+static void free_request_header_list(const discord_http *http, struct curl_slist *owned){
+    if (!owned){
+        return;
+    }
+
+    struct curl_slist *tail = owned;
+
+    while (tail->next && tail->next != http->headers && tail->next != http->json_headers){
+        tail = tail->next;
+    }
+
+    tail->next = NULL;
+
+    curl_slist_free_all(owned);
+}
+
+static void free_cache_entry(void *entryptr){
+    http_cache_entry *entry = entryptr;
+
+    if (!entry){
+        return;
+    }
+
+    json_object_put(entry->data);
+
+    free(entry->etag);
+    free(entry->path);
+    free(entry);
+}
+
+static void unlink_cache_entry(discord_http *http, http_cache_entry *entry){
+    if (entry->prev){
+        entry->prev->next = entry->next;
+    }
+    else {
+        http->cache_head = entry->next;
+    }
+
+    if (entry->next){
+        entry->next->prev = entry->prev;
+    }
+    else {
+        http->cache_tail = entry->prev;
+    }
+
+    entry->prev = NULL;
+    entry->next = NULL;
+
+    http->cache_length -= 1;
+}
+
+static void link_cache_entry(discord_http *http, http_cache_entry *entry){
+    entry->prev = NULL;
+    entry->next = http->cache_head;
+
+    if (http->cache_head){
+        http->cache_head->prev = entry;
+    }
+    else {
+        http->cache_tail = entry;
+    }
+
+    http->cache_head = entry;
+    http->cache_length += 1;
+}
+
+static void remove_cache_entry(discord_http *http, http_cache_entry *entry){
+    /* the map frees the entry, the key it is removed by must outlive it */
+    char *path = entry->path;
+    entry->path = NULL;
+
+    unlink_cache_entry(http, entry);
+    map_remove(http->cache, strlen(path), path);
+
+    free(path);
+}
+
+static http_cache_entry *get_cache_entry(discord_http *http, const char *path){
+    if (!http->cache){
+        return NULL;
+    }
+
+    size_t pathlen = strlen(path);
+
+    if (!map_contains(http->cache, pathlen, path)){
+        return NULL;
+    }
+
+    http_cache_entry *entry = map_get_generic(http->cache, pathlen, path);
+
+    /* most recently used entries are evicted last */
+    unlink_cache_entry(http, entry);
+    link_cache_entry(http, entry);
+
+    return entry;
+}
+
+/*
+ * the route template that decides which cached GETs a write invalidates,
+ * @me stands for an id, as the current user's id is not known here
+ *
+ * e.g. /users/@me/guilds -> /users/:id/guilds
+ */
+static bool write_cache_route(const char *path, char *route, size_t size){
+    if (!write_route_template(path, true, route, size)){
+        return false;
+    }
+
+    char *cursor = route;
+
+    while ((cursor = strstr(cursor, "/@me"))){
+        if (cursor[4] && cursor[4] != '/'){
+            cursor += 4;
+
+            continue;
+        }
+
+        /* ":id" is as long as "@me" */
+        memcpy(cursor + 1, ":id", 3);
+
+        cursor += 4;
+    }
+
+    return true;
+}
+
+/* true if route is prefix itself or one of the routes below it */
+static bool is_route_prefix(const char *prefix, const char *route){
+    size_t length = strlen(prefix);
+
+    return !strncmp(prefix, route, length) && (!route[length] || route[length] == '/');
+}
+
+/*
+ * drops every cached GET a write to path may have changed, the route itself
+ * along with the ones above and below it under the same major parameter
+ *
+ * e.g. PATCH /channels/123 drops /channels/123 and /channels/123/messages
+ */
+static void invalidate_cache_entries(discord_http *http, const char *path){
+    if (!http->cache_head){
+        return;
+    }
+
+    char route[DISCORD_HTTP_BUCKET_KEY_LENGTH];
+
+    if (!write_cache_route(path, route, sizeof(route))){
+        return;
+    }
+
+    http_cache_entry *entry = http->cache_head;
+
+    while (entry){
+        http_cache_entry *next = entry->next;
+
+        if (is_route_prefix(entry->route, route) || is_route_prefix(route, entry->route)){
+            remove_cache_entry(http, entry);
+        }
+
+        entry = next;
+    }
+}
+
+/* milliseconds a response for path stays fresh, 0 if it is not cached */
+static uint64_t get_cache_ttl(const discord_http *http, const char *path){
+    if (!http->cache){
+        return 0;
+    }
+
+    char route[DISCORD_HTTP_BUCKET_KEY_LENGTH];
+
+    if (!write_route_template(path, false, route, sizeof(route))){
+        return 0;
+    }
+
+    size_t routelen = strlen(route);
+
+    if (http->cache_ttls && map_contains(http->cache_ttls, routelen, route)){
+        return (uint64_t)map_get_double(http->cache_ttls, routelen, route);
+    }
+
+    return http->cache_ttl;
+}
+
+static void store_cache_entry(discord_http *http, const char *path, const char *etag, json_object *data){
+    uint64_t ttl = get_cache_ttl(http, path);
+
+    if (!ttl || !data){
+        return;
+    }
+
+    http_cache_entry *entry = get_cache_entry(http, path);
+
+    if (!entry){
+        entry = calloc(1, sizeof(*entry));
+
+        if (!entry){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] store_cache_entry() - calloc for entry failed\n",
+                __FILE__
+            );
+
+            return;
+        }
+
+        entry->path = string_duplicate(path);
+
+        if (!entry->path){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] store_cache_entry() - string_duplicate call failed for path\n",
+                __FILE__
+            );
+
+            free(entry);
+
+            return;
+        }
+
+        if (!write_cache_route(path, entry->route, sizeof(entry->route))){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] store_cache_entry() - write_cache_route call failed\n",
+                __FILE__
+            );
+
+            free_cache_entry(entry);
+
+            return;
+        }
+
+        map_item k = {0};
+        k.type = M_TYPE_STRING;
+        k.size = strlen(path);
+        k.data_copy = path;
+
+        map_item v = {0};
+        v.type = M_TYPE_GENERIC;
+        v.size = sizeof(entry);
+        v.data = entry;
+        v.generic_free = free_cache_entry;
+
+        if (!map_set(http->cache, &k, &v)){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] store_cache_entry() - map_set call failed\n",
+                __FILE__
+            );
+
+            free_cache_entry(entry);
+
+            return;
+        }
+
+        link_cache_entry(http, entry);
+
+        while (http->cache_length > DISCORD_HTTP_CACHE_SIZE){
+            remove_cache_entry(http, http->cache_tail);
+        }
+    }
+
+    json_object_put(entry->data);
+    entry->data = json_object_get(data);
+
+    free(entry->etag);
+    entry->etag = etag ? string_duplicate(etag) : NULL;
+
+    entry->expires = get_time_ms() + ttl;
+}
+
+/* a fresh entry answers a GET without touching the network */
+static discord_http_response *create_cached_response(const http_cache_entry *entry){
+    discord_http_response *response = calloc(1, sizeof(*response));
+
+    if (!response){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] create_cached_response() - calloc for response failed\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    response->status = 200;
+    response->data = json_object_get(entry->data);
+    response->references = 1;
+
+    init_rate_limit(&response->ratelimit);
+
+    return response;
+}
+
+static discord_http_response *get_cached_response(discord_http *http, discord_http_method method, const char *path, const discord_http_request_options *opts){
+    if (method != DISCORD_HTTP_GET || (opts && opts->data)){
+        return NULL;
+    }
+
+    http_cache_entry *entry = get_cache_entry(http, path);
+
+    if (!entry || entry->expires <= get_time_ms()){
+        return NULL;
+    }
+
+    http->stats.cache_hits += 1;
+
+    return create_cached_response(entry);
+}
+
+/* the discord_http_options connection tuning, reapplied after every reset */
+static void set_handle_tuning(const discord_http *http, CURL *handle){
+    CURLcode err = CURLE_OK;
+
+    if (http->proxy){
+        err = curl_easy_setopt(handle, CURLOPT_PROXY, http->proxy);
+    }
+
+    if (err == CURLE_OK && http->ca_file){
+        err = curl_easy_setopt(handle, CURLOPT_CAINFO, http->ca_file);
+    }
+
+    if (err == CURLE_OK && http->keepalive > 0){
+        err = curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+
+        if (err == CURLE_OK){
+            err = curl_easy_setopt(handle, CURLOPT_TCP_KEEPIDLE, http->keepalive);
+        }
+
+        if (err == CURLE_OK){
+            err = curl_easy_setopt(handle, CURLOPT_TCP_KEEPINTVL, http->keepalive);
+        }
+    }
+
+    if (err == CURLE_OK && http->disable_nodelay){
+        err = curl_easy_setopt(handle, CURLOPT_TCP_NODELAY, 0L);
+    }
+
+    if (err == CURLE_OK && http->connect_timeout > 0){
+        err = curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT_MS, http->connect_timeout);
+    }
+
+    if (err == CURLE_OK && http->timeout > 0){
+        err = curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, http->timeout);
+    }
+
+    if (err == CURLE_OK && http->dns_cache_ttl){
+        err = curl_easy_setopt(handle, CURLOPT_DNS_CACHE_TIMEOUT, http->dns_cache_ttl);
+    }
+
+    if (err != CURLE_OK){
+        log_write(
+            logger,
+            LOG_WARNING,
+            "[%s] set_handle_tuning() - curl_easy_setopt call failed: %s\n",
+            __FILE__,
+            curl_easy_strerror(err)
+        );
+    }
+}
+
+/* options every request uses, curl_easy_reset drops them along with the rest */
+static void set_handle_defaults(const discord_http *http, CURL *handle){
+    set_handle_tuning(http, handle);
+
+    CURLcode err = curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+
+    if (err != CURLE_OK){
+        log_write(
+            logger,
+            LOG_DEBUG,
+            "[%s] set_handle_defaults() - HTTP/2 unavailable, using HTTP/1.1\n",
+            __FILE__
+        );
+
+        return;
+    }
+
+    /* wait for a multiplexed stream instead of opening another connection */
+    err = curl_easy_setopt(handle, CURLOPT_PIPEWAIT, 1L);
+
+    if (err != CURLE_OK){
+        log_write(
+            logger,
+            LOG_WARNING,
+            "[%s] set_handle_defaults() - failed to set CURLOPT_PIPEWAIT\n",
+            __FILE__
+        );
+    }
+}
+
+static CURL *acquire_request_handle(discord_http *http){
+    if (http->handles_length){
+        CURL *handle = http->handles[--http->handles_length];
+
+        /* keeps live connections and the share, drops per-request options */
+        curl_easy_reset(handle);
+        set_handle_defaults(http, handle);
+
+        return handle;
+    }
+
+    CURL *handle = curl_easy_init();
+
+    if (!handle){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] acquire_request_handle() - curl_easy_init call failed\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    CURLcode err = curl_easy_setopt(handle, CURLOPT_SHARE, http->share);
+
+    if (err != CURLE_OK){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] acquire_request_handle() - failed to set CURLOPT_SHARE\n",
+            __FILE__
+        );
+
+        curl_easy_cleanup(handle);
+
+        return NULL;
+    }
+
+    set_handle_defaults(http, handle);
+
+    return handle;
+}
+
+static void release_request_handle(discord_http *http, CURL *handle){
+    if (!handle){
+        return;
+    }
+
+    if (http->handles_length < DISCORD_HTTP_HANDLE_POOL_SIZE){
+        http->handles[http->handles_length++] = handle;
+
+        return;
+    }
+
+    curl_easy_cleanup(handle);
+}
+
+static size_t get_histogram_index(uint64_t value){
+    if (value < DISCORD_HTTP_HISTOGRAM_LINEAR){
+        return value;
+    }
+
+    size_t msb = 63;
+
+    while (!(value >> msb)){
+        --msb;
+    }
+
+    /* each power of two is split into DISCORD_HTTP_HISTOGRAM_SUBBUCKETS */
+    size_t index = DISCORD_HTTP_HISTOGRAM_LINEAR
+        + (msb - DISCORD_HTTP_HISTOGRAM_SUBBUCKET_BITS - 1) * DISCORD_HTTP_HISTOGRAM_SUBBUCKETS
+        + ((value >> (msb - DISCORD_HTTP_HISTOGRAM_SUBBUCKET_BITS)) & (DISCORD_HTTP_HISTOGRAM_SUBBUCKETS - 1));
+
+    if (index >= DISCORD_HTTP_HISTOGRAM_BUCKETS){
+        index = DISCORD_HTTP_HISTOGRAM_BUCKETS - 1;
+    }
+
+    return index;
+}
+
+/* the largest value that falls into a bucket */
+static uint64_t get_histogram_value(size_t index){
+    if (index < DISCORD_HTTP_HISTOGRAM_LINEAR){
+        return index;
+    }
+
+    index -= DISCORD_HTTP_HISTOGRAM_LINEAR;
+
+    size_t msb = index / DISCORD_HTTP_HISTOGRAM_SUBBUCKETS + DISCORD_HTTP_HISTOGRAM_SUBBUCKET_BITS + 1;
+    uint64_t sub = index % DISCORD_HTTP_HISTOGRAM_SUBBUCKETS;
+    size_t shift = msb - DISCORD_HTTP_HISTOGRAM_SUBBUCKET_BITS;
+
+    return ((DISCORD_HTTP_HISTOGRAM_SUBBUCKETS + sub + 1) << shift) - 1;
+}
+
+static void record_histogram(discord_http_histogram *histogram, uint64_t value){
+    if (!histogram->count || value < histogram->min){
+        histogram->min = value;
+    }
+
+    if (value > histogram->max){
+        histogram->max = value;
+    }
+
+    histogram->counts[get_histogram_index(value)] += 1;
+    histogram->count += 1;
+    histogram->sum += value;
+}
+
+static discord_http_route_stats *get_route_stats(discord_http *http, const char *route){
+    size_t routelen = strlen(route);
+
+    if (map_contains(http->route_stats, routelen, route)){
+        return map_get_generic(http->route_stats, routelen, route);
+    }
+
+    discord_http_route_stats *stats = calloc(1, sizeof(*stats));
+
+    if (!stats){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] get_route_stats() - calloc for route stats failed\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    memcpy(stats->route, route, routelen + 1);
+
+    map_item k = {0};
+    k.type = M_TYPE_STRING;
+    k.size = routelen;
+    k.data_copy = route;
+
+    map_item v = {0};
+    v.type = M_TYPE_GENERIC;
+    v.size = sizeof(stats);
+    v.data = stats;
+    v.generic_free = free;
+
+    if (!map_set(http->route_stats, &k, &v)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] get_route_stats() - map_set call failed\n",
+            __FILE__
+        );
+
+        free(stats);
+
+        return NULL;
+    }
+
+    stats->next = http->stats.routes;
+    http->stats.routes = stats;
+
+    return stats;
+}
+
+static uint64_t get_timing(CURL *handle, CURLINFO info){
+    curl_off_t value = 0;
+
+    if (curl_easy_getinfo(handle, info, &value) != CURLE_OK || value < 0){
+        return 0;
+    }
+
+    return (uint64_t)value;
+}
+
+static void record_transfer_timings(discord_http *http, const http_transfer *transfer, CURLcode result, discord_http_response *response){
+    discord_http_timings timings = {0};
+
+    timings.namelookup = get_timing(transfer->handle, CURLINFO_NAMELOOKUP_TIME_T);
+    timings.connect = get_timing(transfer->handle, CURLINFO_CONNECT_TIME_T);
+    timings.appconnect = get_timing(transfer->handle, CURLINFO_APPCONNECT_TIME_T);
+    timings.starttransfer = get_timing(transfer->handle, CURLINFO_STARTTRANSFER_TIME_T);
+    timings.total = get_timing(transfer->handle, CURLINFO_TOTAL_TIME_T);
+    timings.waited = transfer->waited * 1000;
+
+    discord_http_stats *stats = &http->stats;
+
+    /* a reused connection reports 0 for the phases it skipped */
+    if (timings.namelookup){
+        record_histogram(&stats->namelookup, timings.namelookup);
+    }
+
+    if (timings.connect){
+        record_histogram(&stats->connect, timings.connect);
+    }
+
+    if (timings.appconnect){
+        record_histogram(&stats->appconnect, timings.appconnect);
+    }
+
+    record_histogram(&stats->starttransfer, timings.starttransfer);
+    record_histogram(&stats->total, timings.total);
+
+    discord_http_route_stats *routestats = transfer->routestats;
+
+    if (routestats){
+        routestats->requests += 1;
+
+        if (result != CURLE_OK || !response || response->status >= 400){
+            routestats->errors += 1;
+        }
+
+        record_histogram(&routestats->latency, timings.total);
+    }
+
+    if (!response){
+        log_write(
+            logger,
+            LOG_DEBUG,
+            "[%s] record_transfer_timings() - %s failed after %" PRIu64 " us\n",
+            __FILE__,
+            routestats ? routestats->route : transfer->bucket->key,
+            timings.total
+        );
+
+        return;
+    }
+
+    response->timings = timings;
+    memcpy(response->route, transfer->bucket->key, sizeof(response->route));
+
+    log_write(
+        logger,
+        LOG_DEBUG,
+        "[%s] record_transfer_timings() - (%ld) %s: dns %" PRIu64 " us, connect %" PRIu64 " us, tls %" PRIu64 " us, first byte %" PRIu64 " us, total %" PRIu64 " us, rate limited %" PRIu64 " us\n",
+        __FILE__,
+        response->status,
+        response->route,
+        timings.namelookup,
+        timings.connect,
+        timings.appconnect,
+        timings.starttransfer,
+        timings.total,
+        timings.waited
+    );
+}
+
+/* marks the start of an attempt, the time since ready_since was spent rate limited */
+static void begin_attempt(discord_http *http, http_transfer *transfer){
+    uint64_t now = get_time_ms();
+    uint64_t waited = now > transfer->ready_since ? now - transfer->ready_since : 0;
+
+    transfer->waited += waited;
+
+    record_histogram(&http->stats.waited, waited * 1000);
+
+    if (transfer->routestats){
+        record_histogram(&transfer->routestats->waited, waited * 1000);
+    }
+}
+
+static void update_connection_stats(discord_http *http, CURL *handle){
+    long connects = 0;
+    CURLcode err = curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &connects);
+
+    if (err != CURLE_OK){
+        log_write(
+            logger,
+            LOG_WARNING,
+            "[%s] update_connection_stats() - failed to get CURLINFO_NUM_CONNECTS\n",
+            __FILE__
+        );
+
+        return;
+    }
+
+    http->stats.requests += 1;
+
+    if (connects > 0){
+        http->stats.connections_created += connects;
+    }
+    else {
+        http->stats.connections_reused += 1;
+    }
+
+    long version = CURL_HTTP_VERSION_NONE;
+    err = curl_easy_getinfo(handle, CURLINFO_HTTP_VERSION, &version);
+
+    if (err != CURLE_OK || version != CURL_HTTP_VERSION_2_0){
+        return;
+    }
+
+    http->stats.http2_requests += 1;
+
+    if (connects > 0){
+        http->stats.http2_connections += connects;
+    }
+
+    if (http->stats.http2_connections){
+        http->stats.streams_per_connection = (double)http->stats.http2_requests / http->stats.http2_connections;
+    }
+}
+
+static bool set_request_method(CURL *handle, discord_http_method method, const discord_http_request_options *opts){
+    if (!handle){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] set_request_method() - handle is NULL\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    CURLcode err = CURLE_FAILED_INIT;
+
+    /* with files the body is a mime post, set by set_request_mime */
+    if (!opts || !opts->data || opts->files){
+        err = curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE, 0);
+
+        if (err != CURLE_OK){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] set_request_method() - set CURLOPT_POSTFIELDSIZE failed\n",
+                __FILE__
+            );
+
+            return false;
+        }
+    }
+    else {
+        const char *jsonstr = json_object_to_json_string(opts->data);
+
+        if (!jsonstr){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] set_request_method() - failed to get json_object string\n",
+                __FILE__
+            );
+
+            return false;
+        }
+
+        err = curl_easy_setopt(handle, CURLOPT_POSTFIELDS, jsonstr);
+
+        if (err != CURLE_OK){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] set_request_method() - failed to set CURLOPT_POSTFIELDS\n",
+                __FILE__
+            );
+
+            return false;
+        }
+    }
+
+    switch (method){
+    case DISCORD_HTTP_GET:
+        err = curl_easy_setopt(handle, CURLOPT_HTTPGET, 1);
+
+        if (err != CURLE_OK){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] set_request_method() - failed to set CURLOPT_HTTPGET\n",
+                __FILE__
+            );
+
+            return false;
+        }
+
+        break;
+    case DISCORD_HTTP_DELETE:
+        err = curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, "DELETE");
+
+        if (err != CURLE_OK){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] set_request_method() - failed to set CURLOPT_CUSTOMREQUEST (DELETE)\n",
+                __FILE__
+            );
+
+            return false;
+        }
+
+        break;
+    case DISCORD_HTTP_PATCH:
+        err = curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, "PATCH");
+
+        if (err != CURLE_OK){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] set_request_method() - failed to set CURLOPT_CUSTOMREQUEST (PATCH)\n",
+                __FILE__
+            );
+
+            return false;
+        }
+
+        break;
+    case DISCORD_HTTP_POST:
+        err = curl_easy_setopt(handle, CURLOPT_POST, 1);
+
+        if (err != CURLE_OK){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] set_request_method() - failed to set CURLOPT_POST\n",
+                __FILE__
+            );
+
+            return false;
+        }
+
+        break;
+    case DISCORD_HTTP_PUT:
+        /* CURLOPT_UPLOAD would read the body from stdin */
+        err = curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, "PUT");
+
+        if (err != CURLE_OK){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] set_request_method() - failed to set CURLOPT_CUSTOMREQUEST (PUT)\n",
+                __FILE__
+            );
+
+            return false;
+        }
+
+        break;
+    default:
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] set_request_method() - unimplemented request method\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    return true;
+}
+
+static size_t read_upload(char *buffer, size_t size, size_t nitems, void *uploadptr){
+    http_upload *upload = uploadptr;
+    size_t length = size * nitems;
+
+    if (length > upload->size - upload->offset){
+        length = upload->size - upload->offset;
+    }
+
+    if (!length){
+        return 0;
+    }
+
+    if (upload->data){
+        memcpy(buffer, upload->data + upload->offset, length);
+    }
+    else {
+        ssize_t bytes = pread(upload->fd, buffer, length, (off_t)upload->offset);
+
+        while (bytes < 0 && errno == EINTR){
+            bytes = pread(upload->fd, buffer, length, (off_t)upload->offset);
+        }
+
+        if (bytes <= 0){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] read_upload() - pread call failed\n",
+                __FILE__
+            );
+
+            return CURL_READFUNC_ABORT;
+        }
+
+        length = bytes;
+    }
+
+    upload->offset += length;
+
+    return length;
+}
+
+/* lets curl rewind a part, e.g. when a request is retried */
+static int seek_upload(void *uploadptr, curl_off_t offset, int origin){
+    http_upload *upload = uploadptr;
+    curl_off_t position = offset;
+
+    if (origin == SEEK_CUR){
+        position += upload->offset;
+    }
+    else if (origin == SEEK_END){
+        position += upload->size;
+    }
+
+    if (position < 0 || (size_t)position > upload->size){
+        return CURL_SEEKFUNC_FAIL;
+    }
+
+    upload->offset = position;
+
+    return CURL_SEEKFUNC_OK;
+}
+
+static void free_upload(void *uploadptr){
+    http_upload *upload = uploadptr;
+
+    if (!upload){
+        return;
+    }
+
+    if (upload->mapped){
+        munmap((void *)upload->data, upload->size);
+    }
+
+    free(upload);
+}
+
+static http_upload *create_upload(const discord_http_file *file){
+    http_upload *upload = calloc(1, sizeof(*upload));
+
+    if (!upload){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] create_upload() - calloc for upload failed\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    upload->fd = file->fd;
+    upload->data = file->data;
+    upload->size = file->size;
+
+    if (upload->data){
+        return upload;
+    }
+
+    struct stat st = {0};
+
+    if (fstat(file->fd, &st)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] create_upload() - fstat call failed (file: %s)\n",
+            __FILE__,
+            file->filename
+        );
+
+        free(upload);
+
+        return NULL;
+    }
+
+    bool regular = S_ISREG(st.st_mode);
+
+    if (!upload->size){
+        upload->size = st.st_size;
+    }
+    /* reading a mapping past the end of the file raises SIGBUS */
+    else if (regular && upload->size > (size_t)st.st_size){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] create_upload() - size %zu is larger than the file (file: %s, size: %jd)\n",
+            __FILE__,
+            upload->size,
+            file->filename,
+            (intmax_t)st.st_size
+        );
+
+        free(upload);
+
+        return NULL;
+    }
+
+    if (file->mmap && regular && upload->size){
+        void *data = mmap(NULL, upload->size, PROT_READ, MAP_PRIVATE, file->fd, 0);
+
+        /* pread still works for anything that cannot be mapped, like pipes */
+        if (data != MAP_FAILED){
+            posix_madvise(data, upload->size, POSIX_MADV_SEQUENTIAL);
+
+            upload->data = data;
+            upload->mapped = true;
+        }
+    }
+
+    return upload;
+}
+
+static bool add_mime_file(curl_mime *mime, size_t index, const discord_http_file *file){
+    curl_mimepart *part = curl_mime_addpart(mime);
+
+    if (!part){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] add_mime_file() - curl_mime_addpart call failed\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "files[%zu]", index);
+
+    http_upload *upload = create_upload(file);
+
+    if (!upload){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] add_mime_file() - create_upload call failed\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    CURLcode err = curl_mime_data_cb(
+        part,
+        (curl_off_t)upload->size,
+        read_upload,
+        seek_upload,
+        free_upload,
+        upload
+    );
+
+    if (err != CURLE_OK){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] add_mime_file() - curl_mime_data_cb call failed\n",
+            __FILE__
+        );
+
+        free_upload(upload);
+
+        return false;
+    }
+
+    err = curl_mime_name(part, name);
+
+    if (err == CURLE_OK){
+        err = curl_mime_filename(part, file->filename);
+    }
+
+    if (err == CURLE_OK && file->content_type){
+        err = curl_mime_type(part, file->content_type);
+    }
+
+    if (err != CURLE_OK){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] add_mime_file() - failed to describe part: %s\n",
+            __FILE__,
+            curl_easy_strerror(err)
+        );
+
+        return false;
+    }
+
+    return true;
+}
+
+/* payload_json carries the message itself, the files follow as files[n] */
+static curl_mime *create_request_mime(CURL *handle, const discord_http_request_options *opts){
+    curl_mime *mime = curl_mime_init(handle);
+
+    if (!mime){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] create_request_mime() - curl_mime_init call failed\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    if (opts->data){
+        const char *jsonstr = json_object_to_json_string(opts->data);
+        curl_mimepart *part = jsonstr ? curl_mime_addpart(mime) : NULL;
+        CURLcode err = part ? curl_mime_name(part, "payload_json") : CURLE_OUT_OF_MEMORY;
+
+        if (err == CURLE_OK){
+            err = curl_mime_data(part, jsonstr, CURL_ZERO_TERMINATED);
+        }
+
+        if (err == CURLE_OK){
+            err = curl_mime_type(part, "application/json");
+        }
+
+        if (err != CURLE_OK){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] create_request_mime() - failed to add payload_json part\n",
+                __FILE__
+            );
+
+            curl_mime_free(mime);
+
+            return NULL;
+        }
+    }
+
+    size_t fileslen = list_get_length(opts->files);
+
+    for (size_t index = 0; index < fileslen; ++index){
+        const discord_http_file *file = list_get_generic(opts->files, index);
+
+        if (!add_mime_file(mime, index, file)){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] create_request_mime() - add_mime_file call failed\n",
+                __FILE__
+            );
+
+            curl_mime_free(mime);
+
+            return NULL;
+        }
+    }
+
+    CURLcode err = curl_easy_setopt(handle, CURLOPT_MIMEPOST, mime);
+
+    if (err != CURLE_OK){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] create_request_mime() - failed to set CURLOPT_MIMEPOST\n",
+            __FILE__
+        );
+
+        curl_mime_free(mime);
+
+        return NULL;
+    }
+
+    return mime;
+}
+
+static bool set_request_url(const discord_http *http, CURL *handle, const char *path){
+    if (!handle){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] set_request_url() - handle is NULL\n",
+            __FILE__
+        );
+
+        return false;
+    }
+    else if (!path){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] set_request_url() - path is NULL\n",
+            __FILE__);
+
+        return false;
+    }
+
+    char *url = string_create("%s%s", http->base_url, path);
+
+    if (!url){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] set_request_url() - failed to create URL string\n",
+            __FILE__);
+
+        return false;
+    }
+
+    CURLcode err = curl_easy_setopt(handle, CURLOPT_URL, url);
+
+    free(url);
+
+    if (err != CURLE_OK){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] set_request_url() - failed to set CURLOPT_URL\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    return true;
+}
+
+static bool set_request_headers(CURL *handle, const struct curl_slist *headers){
+    if (!handle){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] set_request_headers() - handle is NULL\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    CURLcode err = curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
+
+    if (err != CURLE_OK){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] set_request_headers() - failed to set CURLOPT_HTTPHEADER\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    return true;
+}
+
+static bool set_response_header_writer(CURL *handle, void *out){
+    if (!handle){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] set_response_header_writer() - handle is NULL\n",
+            __FILE__
+        );
+
+        return false;
+    }
+    else if (!out){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] set_response_header_writer() - out is NULL\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    CURLcode err = curl_easy_setopt(
+        handle,
+        CURLOPT_HEADERFUNCTION,
+        write_response_headers
+    );
+
+    if (err != CURLE_OK){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] set_response_header_writer() - failed to set CURLOPT_HEADERFUNCTION\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    err = curl_easy_setopt(handle, CURLOPT_HEADERDATA, out);
+
+    if (err != CURLE_OK){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] set_response_header_writer() - failed to set CURLOPT_HEADERDATA\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    return true;
+}
+
+static bool set_response_data_writer(CURL *handle, void *out){
+    if (!handle){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] set_response_data_writer() - handle is NULL\n",
+            __FILE__
+        );
+
+        return false;
     }
     else if (!out){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] set_response_data_writer() - out is NULL\n",
+            "[%s] set_response_data_writer() - out is NULL\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    CURLcode err = curl_easy_setopt(
+        handle,
+        CURLOPT_WRITEFUNCTION,
+        write_response_data
+    );
+
+    if (err != CURLE_OK){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] set_response_data_writer() - failed to set CURLOPT_WRITEFUNCTION\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    err = curl_easy_setopt(handle, CURLOPT_WRITEDATA, out);
+
+    if (err != CURLE_OK){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] set_response_data_writer() - failed to set CURLOPT_WRITEDATA\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    return true;
+}
+
+static discord_http_response *create_response(CURL *handle){
+    if (!handle){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] create_response() - handle is NULL\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    discord_http_response *response = calloc(1, sizeof(*response));
+
+    if (!response){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] create_response() - calloc for response failed\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    CURLcode err = curl_easy_getinfo(
+        handle,
+        CURLINFO_RESPONSE_CODE,
+        &response->status
+    );
+
+    if (err != CURLE_OK){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] create_response() - failed to get CURLINFO_RESPONSE_CODE\n",
+            __FILE__
+        );
+
+        free(response);
+
+        return NULL;
+    }
+
+    response->references = 1;
+
+    return response;
+}
+
+static void handle_response_status(const discord_http_response *response){
+    if (!response){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] handle_response_status() - response is NULL\n",
+            __FILE__
+        );
+
+        return;
+    }
+
+    switch (response->status){
+    case 200:
+        log_write(
+            logger,
+            LOG_DEBUG,
+            "[%s] handle_response_status() - (%d) request completed successfully",
+            __FILE__,
+            response->status
+        );
+
+        break;
+    case 201:
+        log_write(
+            logger,
+            LOG_DEBUG,
+            "[%s] handle_response_status() - (%d) entity created successfully",
+            __FILE__,
+            response->status
+        );
+
+        break;
+    case 204:
+        log_write(
+            logger,
+            LOG_DEBUG,
+            "[%s] handle_response_status() - (%d) request completed successfully but returned no content",
+            __FILE__,
+            response->status
+        );
+
+        break;
+    case 304:
+        log_write(
+            logger,
+            LOG_DEBUG,
+            "[%s] handle_response_status() - (%d) resource was not modified",
+            __FILE__,
+            response->status
+        );
+
+        break;
+    case 400:
+        log_write(
+            logger,
+            LOG_DEBUG,
+            "[%s] handle_response_status() - (%d) sent invalid request",
+            __FILE__,
+            response->status
+        );
+
+        break;
+    case 401:
+        log_write(
+            logger,
+            LOG_DEBUG,
+            "[%s] handle_response_status() - (%d) sent unauthorized request",
+            __FILE__,
+            response->status
+        );
+
+        break;
+    case 403:
+        log_write(
+            logger,
+            LOG_DEBUG,
+            "[%s] handle_response_status() - (%d) requested privileged resource",
+            __FILE__,
+            response->status
+        );
+
+        break;
+    case 404:
+        log_write(
+            logger,
+            LOG_DEBUG,
+            "[%s] handle_response_status() - (%d) requested nonexistent resource",
+            __FILE__,
+            response->status
+        );
+
+        break;
+    case 405:
+        log_write(
+            logger,
+            LOG_DEBUG,
+            "[%s] handle_response_status() - (%d) invalid method for requested resource",
+            __FILE__,
+            response->status
+        );
+
+        break;
+    case 429:
+        log_write(
+            logger,
+            LOG_WARNING,
+            "[%s] handle_response_status() - (%d) rate limit exceeded",
+            __FILE__,
+            response->status
+        );
+
+        break;
+    default:
+        log_write(
+            logger,
+            LOG_DEBUG,
+            "[%s] handle_response_status() - (%d) unexpected status code",
+            __FILE__,
+            response->status
+        );
+    }
+
+    if (response->data){
+        json_object *message = json_object_object_get(
+            response->data,
+            "message"
+        );
+
+        if (message){
+            log_write(
+                logger,
+                LOG_RAW,
+                " -- (Error: %s)",
+                json_object_get_string(message)
+            );
+        }
+    }
+
+    log_write(logger, LOG_RAW, "\n");
+}
+
+/* the map only indexes transfers, their owners free them */
+static void keep_pending_transfer(void *transferptr){
+    (void)transferptr;
+}
+
+static http_transfer *find_pending_request(discord_http *http, discord_http_method method, const char *path){
+    char *key = string_create("%s %s", methods[method], path);
+
+    if (!key){
+        return NULL;
+    }
+
+    http_transfer *transfer = NULL;
+
+    if (map_contains(http->pending, strlen(key), key)){
+        transfer = map_get_generic(http->pending, strlen(key), key);
+    }
+
+    free(key);
+
+    return transfer;
+}
+
+/* lets identical GETs attach themselves until the response is delivered */
+static bool add_pending_request(discord_http *http, http_transfer *transfer){
+    transfer->pendingkey = string_create("%s %s", methods[transfer->method], transfer->path);
+
+    if (!transfer->pendingkey){
+        return false;
+    }
+
+    map_item k = {0};
+    k.type = M_TYPE_STRING;
+    k.size = strlen(transfer->pendingkey);
+    k.data_copy = transfer->pendingkey;
+
+    map_item v = {0};
+    v.type = M_TYPE_GENERIC;
+    v.size = sizeof(transfer);
+    v.data = transfer;
+    v.generic_free = keep_pending_transfer;
+
+    if (!map_set(http->pending, &k, &v)){
+        free(transfer->pendingkey);
+        transfer->pendingkey = NULL;
+
+        return false;
+    }
+
+    return true;
+}
+
+static void remove_pending_request(discord_http *http, http_transfer *transfer){
+    if (!transfer->pendingkey){
+        return;
+    }
+
+    map_remove(http->pending, strlen(transfer->pendingkey), transfer->pendingkey);
+
+    free(transfer->pendingkey);
+    transfer->pendingkey = NULL;
+}
+
+static void free_transfer(http_transfer *transfer){
+    if (!transfer){
+        return;
+    }
+
+    remove_pending_request(transfer->http, transfer);
+
+    /* unbinds itself from the handle before it goes back to the pool */
+    curl_mime_free(transfer->mime);
+    release_request_handle(transfer->http, transfer->handle);
+
+    if (transfer->bucket){
+        transfer->bucket->references -= 1;
+    }
+
+    free_request_header_list(transfer->http, transfer->requestheaders);
+    json_object_put(transfer->data);
+
+    while (transfer->waiters){
+        http_waiter *next = transfer->waiters->next;
+
+        free(transfer->waiters);
+        transfer->waiters = next;
+    }
+
+    free(transfer->path);
+    free(transfer->etag);
+    json_object_put(transfer->revalidated);
+
+    free_response_data(&transfer->responseheaders);
+    json_object_put(transfer->responsedata);
+    json_tokener_free(transfer->tokener);
+    free(transfer);
+}
+
+/* prepares a finished transfer to be sent again */
+static bool reset_transfer(http_transfer *transfer){
+    free_response_data(&transfer->responseheaders);
+    json_object_put(transfer->responsedata);
+
+    transfer->responsedata = NULL;
+    transfer->parsefailed = false;
+
+    if (transfer->tokener){
+        json_tokener_reset(transfer->tokener);
+    }
+
+    init_rate_limit(&transfer->ratelimit);
+
+    return true;
+}
+
+static http_transfer *create_transfer(discord_http *http, discord_http_method method, const char *path, const discord_http_request_options *opts){
+    http_transfer *transfer = calloc(1, sizeof(*transfer));
+
+    if (!transfer){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] create_transfer() - calloc for transfer failed\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    transfer->http = http;
+    transfer->method = method;
+    transfer->created = get_time_ms();
+    init_rate_limit(&transfer->ratelimit);
+
+    char key[DISCORD_HTTP_BUCKET_KEY_LENGTH];
+
+    if (!create_request_bucket(method, path, key, sizeof(key))){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] create_transfer() - create_request_bucket call failed\n",
+            __FILE__
+        );
+
+        free_transfer(transfer);
+
+        return NULL;
+    }
+
+    transfer->bucket = get_bucket(http, key);
+
+    if (!transfer->bucket){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] create_transfer() - get_bucket call failed\n",
+            __FILE__
+        );
+
+        free_transfer(transfer);
+
+        return NULL;
+    }
+
+    transfer->bucket->references += 1;
+
+    /* statistics are kept per endpoint, without the major parameter */
+    char route[DISCORD_HTTP_BUCKET_KEY_LENGTH];
+    size_t methodlength = strcspn(key, " ") + 1;
+
+    memcpy(route, key, methodlength);
+
+    if (write_route_template(path, false, route + methodlength, sizeof(route) - methodlength)){
+        transfer->routestats = get_route_stats(http, route);
+    }
+
+    transfer->ready_since = transfer->created;
+
+    transfer->handle = acquire_request_handle(http);
+
+    if (!transfer->handle){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] create_transfer() - acquire_request_handle call failed\n",
+            __FILE__
+        );
+
+        free_transfer(transfer);
+
+        return NULL;
+    }
+
+    /* the request body is sent straight from the object's string buffer */
+    if (opts){
+        transfer->data = json_object_get(opts->data);
+        transfer->priority = opts->priority;
+    }
+
+    const char *etag = NULL;
+
+    if (method == DISCORD_HTTP_GET && !transfer->data){
+        transfer->path = string_duplicate(path);
+
+        if (!transfer->path){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] create_transfer() - string_duplicate call failed for path\n",
+                __FILE__
+            );
+
+            free_transfer(transfer);
+
+            return NULL;
+        }
+
+        /* a stale entry with an etag is revalidated instead of fetched again */
+        http_cache_entry *entry = get_cache_entry(http, path);
+
+        if (entry && entry->etag){
+            etag = entry->etag;
+            transfer->revalidated = json_object_get(entry->data);
+        }
+    }
+    else {
+        invalidate_cache_entries(http, path);
+    }
+
+    if (!set_request_method(transfer->handle, method, opts)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] create_transfer() - set_request_method call failed\n",
+            __FILE__
+        );
+
+        free_transfer(transfer);
+
+        return NULL;
+    }
+
+    if (opts && opts->files){
+        transfer->mime = create_request_mime(transfer->handle, opts);
+
+        if (!transfer->mime){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] create_transfer() - create_request_mime call failed\n",
+                __FILE__
+            );
+
+            free_transfer(transfer);
+
+            return NULL;
+        }
+    }
+
+    if (!set_request_url(http, transfer->handle, path)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] create_transfer() - set_request_url call failed\n",
+            __FILE__
+        );
+
+        free_transfer(transfer);
+
+        return NULL;
+    }
+
+    struct curl_slist *headers = create_request_header_list(
+        http,
+        opts,
+        etag,
+        &transfer->requestheaders
+    );
+
+    if (!headers){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] create_transfer() - create_request_header_list call failed\n",
+            __FILE__
+        );
+
+        free_transfer(transfer);
+
+        return NULL;
+    }
+
+    if (!set_request_headers(transfer->handle, headers)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] create_transfer() - set_request_headers call failed\n",
+            __FILE__
+        );
+
+        free_transfer(transfer);
+
+        return NULL;
+    }
+
+    if (!set_response_data_writer(transfer->handle, transfer)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] create_transfer() - set_response_data_writer call failed\n",
+            __FILE__
+        );
+
+        free_transfer(transfer);
+
+        return NULL;
+    }
+
+    if (!set_response_header_writer(transfer->handle, transfer)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] create_transfer() - set_response_header_writer call failed\n",
+            __FILE__
+        );
+
+        free_transfer(transfer);
+
+        return NULL;
+    }
+
+    return transfer;
+}
+
+static void update_cache(discord_http *http, const http_transfer *transfer, discord_http_response *response){
+    if (response->status == 200){
+        store_cache_entry(http, transfer->path, transfer->etag, response->data);
+
+        return;
+    }
+    else if (response->status != 304 || !transfer->revalidated){
+        return;
+    }
+
+    /* callers only know 200, the cached body stands in for the empty one */
+    json_object_put(response->data);
+
+    response->status = 200;
+    response->data = json_object_get(transfer->revalidated);
+
+    /* the entry may have been evicted while the request was in flight */
+    http_cache_entry *entry = get_cache_entry(http, transfer->path);
+
+    if (entry){
+        entry->expires = get_time_ms() + get_cache_ttl(http, transfer->path);
+    }
+    else {
+        store_cache_entry(http, transfer->path, transfer->etag, transfer->revalidated);
+    }
+
+    http->stats.cache_revalidations += 1;
+}
+
+/* the transfer stays owned by the caller so it can be retried */
+static discord_http_response *finish_transfer(http_transfer *transfer, CURLcode result){
+    discord_http *http = transfer->http;
+
+    if (result != CURLE_OK){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] finish_transfer() - failed to perform request: %s\n",
+            __FILE__,
+            curl_easy_strerror(result)
+        );
+
+        record_transfer_timings(http, transfer, result, NULL);
+        update_bucket(http, transfer->bucket, NULL);
+
+        return NULL;
+    }
+
+    update_connection_stats(http, transfer->handle);
+
+    discord_http_response *response = create_response(transfer->handle);
+
+    if (!response){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] finish_transfer() - create_response call failed\n",
+            __FILE__
+        );
+
+        update_bucket(http, transfer->bucket, NULL);
+
+        return NULL;
+    }
+
+    /* owned by the response now */
+    response->rawheaders = transfer->responseheaders.data;
+    response->rawheaders_length = transfer->responseheaders.length;
+    transfer->responseheaders.data = NULL;
+    transfer->responseheaders.length = 0;
+    transfer->responseheaders.capacity = 0;
+
+    response->ratelimit = transfer->ratelimit;
+
+    record_transfer_timings(http, transfer, result, response);
+
+    /* a top level scalar is only complete once the tokener sees the end */
+    if (!transfer->responsedata && transfer->tokener && !transfer->parsefailed){
+        transfer->responsedata = json_tokener_parse_ex(transfer->tokener, "", 1);
+
+        if (!transfer->responsedata){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] finish_transfer() - response body ended before the json document\n",
+                __FILE__
+            );
+        }
+    }
+
+    response->data = transfer->responsedata;
+    transfer->responsedata = NULL;
+
+    /* the body of a 429 is more precise than the headers */
+    if (response->status == 429 && response->data){
+        json_object *obj = json_object_object_get(response->data, "retry_after");
+
+        if (obj){
+            response->ratelimit.retry_after = json_object_get_double(obj);
+        }
+
+        obj = json_object_object_get(response->data, "global");
+
+        if (obj){
+            response->ratelimit.global = json_object_get_boolean(obj);
+        }
+    }
+
+    handle_response_status(response);
+    update_bucket(http, transfer->bucket, response);
+
+    if (transfer->path){
+        update_cache(http, transfer, response);
+    }
+
+    return response;
+}
+
+static bool is_transient_error(CURLcode result){
+    switch (result){
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_SSL_CONNECT_ERROR:
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_GOT_NOTHING:
+    case CURLE_PARTIAL_FILE:
+    case CURLE_HTTP2:
+    case CURLE_HTTP2_STREAM:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* failures that happen before the request could have reached discord */
+static bool is_unsent_error(CURLcode result){
+    return result == CURLE_COULDNT_RESOLVE_HOST
+        || result == CURLE_COULDNT_CONNECT
+        || result == CURLE_SSL_CONNECT_ERROR;
+}
+
+static bool is_idempotent(discord_http_method method){
+    return method != DISCORD_HTTP_POST;
+}
+
+static uint64_t get_random(discord_http *http){
+    /* xorshift64, good enough to spread retries apart */
+    uint64_t x = http->retry_seed;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+
+    http->retry_seed = x;
+
+    return x;
+}
+
+/*
+ * decides whether a finished transfer is sent again and how long it waits
+ * first, 429s are always safe to repeat while other failures only are for
+ * idempotent requests or ones that never left
+ */
+static bool should_retry_transfer(discord_http *http, http_transfer *transfer, CURLcode result, const discord_http_response *response, uint64_t *delay){
+    const discord_http_retry_policy *policy = &http->retry;
+    uint64_t now = get_time_ms();
+
+    *delay = 0;
+
+    if (response && response->status == 429){
+        if (transfer->ratelimited >= DISCORD_HTTP_RATE_LIMIT_RETRIES){
+            return false;
+        }
+
+        double retryafter = response->ratelimit.retry_after;
+
+        if (retryafter <= 0){
+            retryafter = response->ratelimit.reset_after;
+        }
+
+        /* the bucket holds the request back, only the deadline is checked */
+        if (policy->deadline && now + (uint64_t)(retryafter * 1000) > transfer->created + policy->deadline){
+            return false;
+        }
+
+        transfer->ratelimited += 1;
+
+        return true;
+    }
+
+    bool transient = false;
+
+    if (!response){
+        transient = is_transient_error(result) && (is_idempotent(transfer->method) || is_unsent_error(result));
+    }
+    else {
+        switch (response->status){
+        case 500:
+        case 502:
+        case 503:
+        case 504:
+            transient = is_idempotent(transfer->method);
+
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (!transient || transfer->failures >= (size_t)policy->max_retries){
+        return false;
+    }
+
+    /* exponential backoff with equal jitter */
+    uint64_t backoff = policy->base_delay;
+
+    for (size_t index = 0; index < transfer->failures && backoff < policy->max_delay; ++index){
+        backoff *= 2;
+    }
+
+    if (backoff > policy->max_delay){
+        backoff = policy->max_delay;
+    }
+
+    *delay = backoff / 2;
+
+    if (backoff / 2){
+        *delay += get_random(http) % (backoff / 2 + 1);
+    }
+
+    if (response && response->ratelimit.retry_after > 0){
+        uint64_t retryafter = (uint64_t)(response->ratelimit.retry_after * 1000);
+
+        if (retryafter > *delay){
+            *delay = retryafter;
+        }
+    }
+
+    if (policy->deadline && now + *delay > transfer->created + policy->deadline){
+        return false;
+    }
+
+    transfer->failures += 1;
+    http->stats.retries += 1;
+
+    log_write(
+        logger,
+        LOG_WARNING,
+        "[%s] should_retry_transfer() - retrying request in %" PRIu64 " ms (attempt %zu of %d)\n",
+        __FILE__,
+        *delay,
+        transfer->failures + 1,
+        policy->max_retries + 1
+    );
+
+    return true;
+}
+
+static void push_transfer(http_transfer_queue *queue, http_transfer *transfer){
+    transfer->prev = queue->tail;
+    transfer->next = NULL;
+    transfer->queue = queue;
+
+    if (queue->tail){
+        queue->tail->next = transfer;
+    }
+    else {
+        queue->head = transfer;
+    }
+
+    queue->tail = transfer;
+    queue->length += 1;
+}
+
+static void push_transfer_front(http_transfer_queue *queue, http_transfer *transfer){
+    transfer->prev = NULL;
+    transfer->next = queue->head;
+    transfer->queue = queue;
+
+    if (queue->head){
+        queue->head->prev = transfer;
+    }
+    else {
+        queue->tail = transfer;
+    }
+
+    queue->head = transfer;
+    queue->length += 1;
+}
+
+static void remove_transfer(http_transfer_queue *queue, http_transfer *transfer){
+    if (transfer->prev){
+        transfer->prev->next = transfer->next;
+    }
+    else {
+        queue->head = transfer->next;
+    }
+
+    if (transfer->next){
+        transfer->next->prev = transfer->prev;
+    }
+    else {
+        queue->tail = transfer->prev;
+    }
+
+    transfer->prev = NULL;
+    transfer->next = NULL;
+    transfer->queue = NULL;
+
+    queue->length -= 1;
+}
+
+/* lanes are walked in order, so the high priority lane comes first */
+static http_transfer_queue *get_queue_lane(discord_http *http, discord_http_priority priority){
+    switch (priority){
+    case DISCORD_HTTP_PRIORITY_HIGH:
+        return &http->queued[0];
+    case DISCORD_HTTP_PRIORITY_LOW:
+        return &http->queued[2];
+    default:
+        return &http->queued[1];
+    }
+}
+
+static size_t get_queued_length(const discord_http *http){
+    size_t length = 0;
+
+    for (size_t lane = 0; lane < DISCORD_HTTP_PRIORITY_LANES; ++lane){
+        length += http->queued[lane].length;
+    }
+
+    return length;
+}
+
+static bool add_transfer_waiter(discord_http *http, http_transfer *transfer, discord_http_priority priority, discord_http_callback callback, void *userdata){
+    http_waiter *waiter = calloc(1, sizeof(*waiter));
+
+    if (!waiter){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] add_transfer_waiter() - calloc for waiter failed\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    waiter->callback = callback;
+    waiter->userdata = userdata;
+    waiter->next = transfer->waiters;
+
+    transfer->waiters = waiter;
+    transfer->waiters_length += 1;
+
+    /* a still queued request moves up to the lane of its most urgent waiter */
+    http_transfer_queue *lane = get_queue_lane(http, priority);
+
+    if (transfer->queue && transfer->queue != &http->inflight && lane < transfer->queue){
+        remove_transfer(transfer->queue, transfer);
+        push_transfer(lane, transfer);
+
+        transfer->priority = priority;
+    }
+
+    http->stats.requests_coalesced += 1;
+
+    return true;
+}
+
+static void deliver_response(discord_http *http, discord_http_callback callback, void *userdata, discord_http_response *response){
+    if (callback){
+        callback(http, response, userdata);
+    }
+    else {
+        discord_http_response_free(response);
+    }
+}
+
+/* waiters were pushed in front, they are answered in the order they were added */
+static void deliver_waiters(discord_http *http, http_waiter *waiters, discord_http_response *response){
+    http_waiter *ordered = NULL;
+
+    while (waiters){
+        http_waiter *next = waiters->next;
+
+        waiters->next = ordered;
+        ordered = waiters;
+        waiters = next;
+    }
+
+    while (ordered){
+        http_waiter *next = ordered->next;
+
+        deliver_response(http, ordered->callback, ordered->userdata, response);
+        free(ordered);
+
+        ordered = next;
+    }
+}
+
+/*
+ * detaches the waiters and gives each its own reference to the response,
+ * the transfer can't be found by new GETs afterwards
+ */
+static http_waiter *take_transfer_waiters(discord_http *http, http_transfer *transfer, discord_http_response *response){
+    remove_pending_request(http, transfer);
+
+    if (response){
+        response->references += transfer->waiters_length;
+    }
+
+    http_waiter *waiters = transfer->waiters;
+
+    transfer->waiters = NULL;
+    transfer->waiters_length = 0;
+
+    return waiters;
+}
+
+static void complete_transfer(discord_http *http, http_transfer *transfer, discord_http_response *response){
+    http_waiter *waiters = take_transfer_waiters(http, transfer, response);
+
+    deliver_response(http, transfer->callback, transfer->userdata, response);
+    deliver_waiters(http, waiters, response);
+
+    free_transfer(transfer);
+}
+
+/* milliseconds until curl or a rate limited request needs attention, -1 for never */
+static long get_next_timeout(const discord_http *http){
+    uint64_t deadline = http->curl_deadline;
+
+    if (http->queue_deadline && (!deadline || http->queue_deadline < deadline)){
+        deadline = http->queue_deadline;
+    }
+
+    if (!deadline){
+        return -1;
+    }
+
+    uint64_t now = get_time_ms();
+
+    return deadline > now ? (long)(deadline - now) : 0;
+}
+
+static void update_timer(discord_http *http){
+    if (http->loop.set_timer){
+        http->loop.set_timer(http->loop.userdata, get_next_timeout(http));
+    }
+}
+
+static bool start_transfer(discord_http *http, http_transfer *transfer){
+    begin_attempt(http, transfer);
+
+    CURLMcode err = curl_multi_add_handle(http->multi, transfer->handle);
+
+    if (err != CURLM_OK){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] start_transfer() - curl_multi_add_handle call failed: %s\n",
+            __FILE__,
+            curl_multi_strerror(err)
+        );
+
+        update_bucket(http, transfer->bucket, NULL);
+
+        return false;
+    }
+
+    push_transfer(&http->inflight, transfer);
+
+    if (http->inflight.length > http->stats.max_inflight){
+        http->stats.max_inflight = http->inflight.length;
+    }
+
+    return true;
+}
+
+/*
+ * starts every queued transfer whose bucket has room, by priority and then
+ * in the order they were queued, and schedules the timer for the earliest
+ * bucket reset
+ */
+static void dispatch_queued_transfers(discord_http *http){
+    http_transfer_queue failed = {0};
+    uint64_t now = get_time_ms();
+    uint64_t deadline = http->queue_deadline;
+
+    http->queue_deadline = 0;
+
+    http_transfer *transfer = NULL;
+
+    for (size_t lane = 0; lane < DISCORD_HTTP_PRIORITY_LANES; ++lane){
+        transfer = http->queued[lane].head;
+
+        while (transfer){
+            http_transfer *next = transfer->next;
+            uint64_t wait = 0;
+
+            if (transfer->retry_at > now){
+                if (!http->queue_deadline || transfer->retry_at < http->queue_deadline){
+                    http->queue_deadline = transfer->retry_at;
+                }
+            }
+            else if (!try_reserve_bucket(http, transfer, true, now, &wait)){
+                /* no wait while the bucket's first response is outstanding */
+                if (wait && (!http->queue_deadline || now + wait < http->queue_deadline)){
+                    http->queue_deadline = now + wait;
+                }
+            }
+            else if (transfer->blocking){
+                remove_transfer(&http->queued[lane], transfer);
+                begin_attempt(http, transfer);
+
+                transfer->dispatched = true;
+
+                pthread_cond_broadcast(&http->signal);
+            }
+            else {
+                remove_transfer(&http->queued[lane], transfer);
+
+                if (!start_transfer(http, transfer)){
+                    push_transfer(&failed, transfer);
+                }
+            }
+
+            transfer = next;
+        }
+    }
+
+    /* blocking requests asleep on a later deadline have to look again, signal only exists with thread_safe */
+    if (http->thread_safe && http->queue_deadline && (!deadline || http->queue_deadline < deadline)){
+        pthread_cond_broadcast(&http->signal);
+    }
+
+    update_timer(http);
+
+    /* callbacks may queue new requests, so they run once the walk is done */
+    while (failed.head){
+        transfer = failed.head;
+
+        remove_transfer(&failed, transfer);
+        complete_transfer(http, transfer, NULL);
+    }
+}
+
+static void process_completed_transfers(discord_http *http){
+    CURLMsg *msg = NULL;
+    int queued = 0;
+
+    while ((msg = curl_multi_info_read(http->multi, &queued))){
+        if (msg->msg != CURLMSG_DONE){
+            continue;
+        }
+
+        CURL *handle = msg->easy_handle;
+        CURLcode result = msg->data.result;
+
+        http_transfer *transfer = NULL;
+        curl_easy_getinfo(handle, CURLINFO_PRIVATE, (char **)&transfer);
+
+        curl_multi_remove_handle(http->multi, handle);
+
+        if (!transfer){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] process_completed_transfers() - finished handle has no transfer\n",
+                __FILE__
+            );
+
+            release_request_handle(http, handle);
+
+            continue;
+        }
+
+        remove_transfer(&http->inflight, transfer);
+
+        discord_http_response *response = finish_transfer(transfer, result);
+        uint64_t delay = 0;
+
+        if (should_retry_transfer(http, transfer, result, response, &delay)){
+            discord_http_response_free(response);
+
+            response = NULL;
+
+            if (reset_transfer(transfer)){
+                transfer->retry_at = delay ? get_time_ms() + delay : 0;
+                transfer->ready_since = transfer->retry_at ? transfer->retry_at : get_time_ms();
+
+                /* keeps its place ahead of requests queued after it */
+                push_transfer_front(get_queue_lane(http, transfer->priority), transfer);
+
+                continue;
+            }
+        }
+
+        complete_transfer(http, transfer, response);
+    }
+
+    dispatch_queued_transfers(http);
+}
+
+static http_socket *add_socket(discord_http *http, int fd){
+    http_socket *sock = calloc(1, sizeof(*sock));
+
+    if (!sock){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] add_socket() - calloc for socket failed\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    sock->fd = fd;
+
+    list_item item = {0};
+    item.type = L_TYPE_GENERIC;
+    item.size = sizeof(*sock);
+    item.data = sock;
+    item.generic_free = free;
+
+    if (!list_append(http->sockets, &item)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] add_socket() - list_append call failed\n",
+            __FILE__
+        );
+
+        free(sock);
+
+        return NULL;
+    }
+
+    return sock;
+}
+
+static void remove_socket(discord_http *http, const http_socket *sock){
+    size_t socketslen = list_get_length(http->sockets);
+
+    for (size_t index = 0; index < socketslen; ++index){
+        if (list_get_generic(http->sockets, index) == sock){
+            list_remove(http->sockets, index);
+
+            break;
+        }
+    }
+}
+
+static int handle_multi_socket(CURL *handle, curl_socket_t fd, int what, void *httpptr, void *socketptr){
+    if (handle){
+        /* unused */
+    }
+
+    discord_http *http = httpptr;
+    http_socket *sock = socketptr;
+
+    if (what == CURL_POLL_REMOVE){
+        if (!sock){
+            return 0;
+        }
+
+        if (http->loop.watch_socket){
+            http->loop.watch_socket(
+                http->loop.userdata,
+                fd,
+                DISCORD_HTTP_POLL_REMOVE,
+                sock->loopdata
+            );
+        }
+
+        curl_multi_assign(http->multi, fd, NULL);
+        remove_socket(http, sock);
+
+        return 0;
+    }
+
+    if (!sock){
+        sock = add_socket(http, fd);
+
+        if (!sock){
+            return -1;
+        }
+
+        curl_multi_assign(http->multi, fd, sock);
+    }
+
+    sock->events = 0;
+
+    if (what & CURL_POLL_IN){
+        sock->events |= DISCORD_HTTP_POLL_IN;
+    }
+
+    if (what & CURL_POLL_OUT){
+        sock->events |= DISCORD_HTTP_POLL_OUT;
+    }
+
+    if (http->loop.watch_socket){
+        sock->loopdata = http->loop.watch_socket(
+            http->loop.userdata,
+            fd,
+            sock->events,
+            sock->loopdata
+        );
+    }
+
+    return 0;
+}
+
+static int handle_multi_timer(CURLM *multi, long timeout_ms, void *httpptr){
+    if (multi){
+        /* unused */
+    }
+
+    discord_http *http = httpptr;
+
+    http->curl_deadline = timeout_ms < 0 ? 0 : get_time_ms() + timeout_ms;
+
+    update_timer(http);
+
+    return 0;
+}
+
+static bool init_multi_handle(discord_http *http){
+    http->sockets = list_init();
+
+    if (!http->sockets){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] init_multi_handle() - sockets list initialization failed\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    http->multi = curl_multi_init();
+
+    if (!http->multi){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] init_multi_handle() - curl_multi_init call failed\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    CURLMcode err = curl_multi_setopt(http->multi, CURLMOPT_SOCKETFUNCTION, handle_multi_socket);
+
+    if (err == CURLM_OK){
+        err = curl_multi_setopt(http->multi, CURLMOPT_SOCKETDATA, http);
+    }
+
+    if (err == CURLM_OK){
+        err = curl_multi_setopt(http->multi, CURLMOPT_TIMERFUNCTION, handle_multi_timer);
+    }
+
+    if (err == CURLM_OK){
+        err = curl_multi_setopt(http->multi, CURLMOPT_TIMERDATA, http);
+    }
+
+    if (err == CURLM_OK){
+        err = curl_multi_setopt(http->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    }
+
+    if (err == CURLM_OK && http->max_host_connections > 0){
+        err = curl_multi_setopt(http->multi, CURLMOPT_MAX_HOST_CONNECTIONS, http->max_host_connections);
+    }
+
+    if (err != CURLM_OK){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] init_multi_handle() - curl_multi_setopt call failed: %s\n",
+            __FILE__,
+            curl_multi_strerror(err)
+        );
+
+        return false;
+    }
+
+    return true;
+}
+
+static bool init_connection_share(discord_http *http){
+    http->share = curl_share_init();
+
+    if (!http->share){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] init_connection_share() - curl_share_init call failed\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    static const curl_lock_data shared[] = {
+        CURL_LOCK_DATA_DNS,
+        CURL_LOCK_DATA_SSL_SESSION,
+        CURL_LOCK_DATA_CONNECT
+    };
+
+    size_t sharedlen = sizeof(shared) / sizeof(*shared);
+
+    /* libcurl does not support a shared connection cache across threads */
+    if (http->thread_safe){
+        sharedlen -= 1;
+
+        CURLSHcode err = curl_share_setopt(http->share, CURLSHOPT_LOCKFUNC, lock_share);
+
+        if (err == CURLSHE_OK){
+            err = curl_share_setopt(http->share, CURLSHOPT_UNLOCKFUNC, unlock_share);
+        }
+
+        if (err == CURLSHE_OK){
+            err = curl_share_setopt(http->share, CURLSHOPT_USERDATA, http);
+        }
+
+        if (err != CURLSHE_OK){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] init_connection_share() - failed to set lock callbacks (%s)\n",
+                __FILE__,
+                curl_share_strerror(err)
+            );
+
+            return false;
+        }
+    }
+
+    for (size_t index = 0; index < sharedlen; ++index){
+        CURLSHcode err = curl_share_setopt(http->share, CURLSHOPT_SHARE, shared[index]);
+
+        if (err != CURLSHE_OK){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] init_connection_share() - failed to set CURLSHOPT_SHARE (%s)\n",
+                __FILE__,
+                curl_share_strerror(err)
+            );
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool init_locks(discord_http *http){
+    pthread_mutexattr_t attr;
+
+    if (pthread_mutexattr_init(&attr)){
+        return false;
+    }
+
+    /* callbacks run under the lock and may issue requests themselves */
+    bool success = !pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE)
+        && !pthread_mutex_init(&http->lock, &attr);
+
+    pthread_mutexattr_destroy(&attr);
+
+    if (!success){
+        return false;
+    }
+
+    pthread_condattr_t condattr;
+
+    if (pthread_condattr_init(&condattr)){
+        pthread_mutex_destroy(&http->lock);
+
+        return false;
+    }
+
+    /* deadlines come from get_time_ms */
+    success = !pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC)
+        && !pthread_cond_init(&http->signal, &condattr);
+
+    pthread_condattr_destroy(&condattr);
+
+    if (!success){
+        pthread_mutex_destroy(&http->lock);
+
+        return false;
+    }
+
+    pthread_mutex_t *locks[1 + DISCORD_HTTP_LOCK_STRIPES + CURL_LOCK_DATA_LAST];
+    size_t lockslen = 0;
+
+    locks[lockslen++] = &http->global_lock;
+
+    for (size_t index = 0; index < DISCORD_HTTP_LOCK_STRIPES; ++index){
+        locks[lockslen++] = &http->bucket_locks[index];
+    }
+
+    for (size_t index = 0; index < CURL_LOCK_DATA_LAST; ++index){
+        locks[lockslen++] = &http->share_locks[index];
+    }
+
+    size_t initialized = 0;
+
+    while (initialized < lockslen && !pthread_mutex_init(locks[initialized], NULL)){
+        initialized += 1;
+    }
+
+    if (initialized < lockslen){
+        while (initialized--){
+            pthread_mutex_destroy(locks[initialized]);
+        }
+
+        pthread_cond_destroy(&http->signal);
+        pthread_mutex_destroy(&http->lock);
+
+        return false;
+    }
+
+    http->thread_safe = true;
+
+    return true;
+}
+
+static void free_locks(discord_http *http){
+    if (!http->thread_safe){
+        return;
+    }
+
+    pthread_cond_destroy(&http->signal);
+    pthread_mutex_destroy(&http->lock);
+    pthread_mutex_destroy(&http->global_lock);
+
+    for (size_t index = 0; index < DISCORD_HTTP_LOCK_STRIPES; ++index){
+        pthread_mutex_destroy(&http->bucket_locks[index]);
+    }
+
+    for (size_t index = 0; index < CURL_LOCK_DATA_LAST; ++index){
+        pthread_mutex_destroy(&http->share_locks[index]);
+    }
+}
+
+discord_http *discord_http_init(const char *token, const discord_http_options *opts){
+    if (opts){
+        logger = opts->log;
+    }
+
+    if (!token){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] http_init() - token is NULL, refusing to initialize\n",
             __FILE__
         );
 
-        return false;
+        return NULL;
     }
 
-    CURLcode err = curl_easy_setopt(
-        handle,
-        CURLOPT_WRITEFUNCTION,
-        write_response_data
-    );
-
-    if (err != CURLE_OK){
+    if (curl_global_init(CURL_GLOBAL_ALL)){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] set_response_data_writer() - failed to set CURLOPT_WRITEFUNCTION\n",
+            "[%s] http_init() - curl_global_init call failed\n",
             __FILE__
         );
 
-        return false;
+        return NULL;
     }
 
-    err = curl_easy_setopt(handle, CURLOPT_WRITEDATA, out);
+    map *buckets = map_init();
 
-    if (err != CURLE_OK){
+    if (!buckets){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] set_response_data_writer() - failed to set CURLOPT_WRITEDATA\n",
+            "[%s] http_init() - failed to initialize rate limit buckets\n",
             __FILE__
         );
 
-        return false;
+        curl_global_cleanup();
+
+        return NULL;
     }
 
-    return true;
-}
+    discord_http *http = calloc(1, sizeof(*http));
 
-static discord_http_response *create_response(CURL *handle, map *headers){
-    if (!handle){
+    if (!http){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] create_response() - handle is NULL\n",
+            "[%s] http_init() - alloc for discord_http failed\n",
             __FILE__
         );
 
+        curl_global_cleanup();
+        map_free(buckets);
+
         return NULL;
     }
 
-    discord_http_response *response = calloc(1, sizeof(*response));
+    http->token = token;
+    http->buckets = buckets;
 
-    if (!response){
+    if (opts && opts->thread_safe && !init_locks(http)){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] create_response() - calloc for response failed\n",
+            "[%s] http_init() - init_locks call failed\n",
             __FILE__
         );
 
+        curl_global_cleanup();
+        map_free(buckets);
+        free(http);
+
         return NULL;
     }
 
-    CURLcode err = curl_easy_getinfo(
-        handle,
-        CURLINFO_RESPONSE_CODE,
-        &response->status
-    );
+    http->global_rate = DISCORD_HTTP_GLOBAL_RATE;
 
-    if (err != CURLE_OK){
+    if (opts && opts->global_rate > 0){
+        http->global_rate = opts->global_rate;
+    }
+
+    http->global_tokens = http->global_rate;
+    http->global_refill = get_time_ms();
+
+    http->base_url = DISCORD_API;
+
+    if (opts){
+        http->cache_ttl = opts->cache_ttl;
+
+        if (opts->base_url){
+            http->base_url = opts->base_url;
+        }
+
+        http->proxy = opts->proxy;
+        http->ca_file = opts->ca_file;
+        http->keepalive = opts->keepalive;
+        http->disable_nodelay = opts->disable_nodelay;
+        http->connect_timeout = opts->connect_timeout;
+        http->timeout = opts->timeout;
+        http->max_host_connections = opts->max_host_connections;
+        http->dns_cache_ttl = opts->dns_cache_ttl;
+    }
+
+    http->retry.max_retries = DISCORD_HTTP_RETRY_MAX;
+    http->retry.base_delay = DISCORD_HTTP_RETRY_BASE_DELAY;
+    http->retry.max_delay = DISCORD_HTTP_RETRY_MAX_DELAY;
+    http->retry.deadline = DISCORD_HTTP_RETRY_DEADLINE;
+
+    if (opts && opts->retry){
+        http->retry = *opts->retry;
+    }
+
+    http->retry_seed = (uint64_t)time(NULL) ^ (uintptr_t)http;
+
+    if (!http->retry_seed){
+        http->retry_seed = 1;
+    }
+
+    http->cache = map_init();
+    http->cache_ttls = map_init();
+    http->route_stats = map_init();
+    http->pending = map_init();
+
+    if (!http->cache || !http->cache_ttls || !http->route_stats || !http->pending){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] create_response() - failed to get CURLINFO_RESPONSE_CODE\n",
+            "[%s] http_init() - failed to initialize cache and statistics maps\n",
             __FILE__
         );
 
-        free(response);
+        discord_http_free(http);
 
         return NULL;
     }
 
-    response->headers = headers;
-
-    return response;
-}
-
-static void handle_response_status(discord_http *http, const char *bucket, const discord_http_response *response){
-    if (!http){
+    if (!init_shared_headers(http)){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] handle_response_status() - http is NULL\n",
+            "[%s] http_init() - init_shared_headers call failed\n",
             __FILE__
         );
 
-        return;
+        discord_http_free(http);
+
+        return NULL;
     }
-    else if (!response){
+
+    if (!init_connection_share(http)){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] handle_response_status() - response is NULL\n",
+            "[%s] http_init() - init_connection_share call failed\n",
             __FILE__
         );
 
-        return;
-    }
+        discord_http_free(http);
 
-    bool success = false;
-    double retryafter = 0;
-    json_object *obj = NULL;
+        return NULL;
+    }
 
-    switch (response->status){
-    case 200:
+    if (!init_multi_handle(http)){
         log_write(
             logger,
-            LOG_DEBUG,
-            "[%s] handle_response_status() - (%d) request completed successfully",
-            __FILE__,
-            response->status
+            LOG_ERROR,
+            "[%s] http_init() - init_multi_handle call failed\n",
+            __FILE__
         );
 
-        break;
-    case 201:
-        log_write(
-            logger,
-            LOG_DEBUG,
-            "[%s] handle_response_status() - (%d) entity created successfully",
-            __FILE__,
-            response->status
-        );
+        discord_http_free(http);
 
-        break;
-    case 204:
+        return NULL;
+    }
+
+    return http;
+}
+
+static bool socket_action(discord_http *http, int fd, int events){
+    int mask = 0;
+
+    if (events & DISCORD_HTTP_POLL_IN){
+        mask |= CURL_CSELECT_IN;
+    }
+
+    if (events & DISCORD_HTTP_POLL_OUT){
+        mask |= CURL_CSELECT_OUT;
+    }
+
+    int running = 0;
+    CURLMcode err = curl_multi_socket_action(http->multi, fd, mask, &running);
+
+    if (err != CURLM_OK){
         log_write(
             logger,
-            LOG_DEBUG,
-            "[%s] handle_response_status() - (%d) request completed successfully but returned no content",
+            LOG_ERROR,
+            "[%s] socket_action() - curl_multi_socket_action call failed: %s\n",
             __FILE__,
-            response->status
+            curl_multi_strerror(err)
         );
 
-        break;
-    case 304:
+        return false;
+    }
+
+    process_completed_transfers(http);
+
+    return true;
+}
+
+static bool timer_action(discord_http *http){
+    /* the timer is shared between curl and the rate limit queue */
+    if (!http->curl_deadline || http->curl_deadline > get_time_ms()){
+        dispatch_queued_transfers(http);
+
+        return true;
+    }
+
+    http->curl_deadline = 0;
+
+    int running = 0;
+    CURLMcode err = curl_multi_socket_action(http->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+
+    if (err != CURLM_OK){
         log_write(
             logger,
-            LOG_DEBUG,
-            "[%s] handle_response_status() - (%d) resource was not modified",
+            LOG_ERROR,
+            "[%s] timer_action() - curl_multi_socket_action call failed: %s\n",
             __FILE__,
-            response->status
+            curl_multi_strerror(err)
         );
 
-        break;
-    case 400:
+        return false;
+    }
+
+    process_completed_transfers(http);
+
+    return true;
+}
+
+/*
+ * polls the multi's sockets once, at most until the next timeout, and
+ * services whatever is ready, called and returns with the lock held
+ */
+static bool drive_multi(discord_http *http, int timeout_ms){
+    size_t socketslen = list_get_length(http->sockets);
+    struct pollfd *fds = NULL;
+
+    if (socketslen){
+        fds = calloc(socketslen, sizeof(*fds));
+
+        if (!fds){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] drive_multi() - calloc for pollfd array failed\n",
+                __FILE__
+            );
+
+            return false;
+        }
+    }
+
+    for (size_t index = 0; index < socketslen; ++index){
+        const http_socket *sock = list_get_generic(http->sockets, index);
+
+        fds[index].fd = sock->fd;
+
+        if (sock->events & DISCORD_HTTP_POLL_IN){
+            fds[index].events |= POLLIN;
+        }
+
+        if (sock->events & DISCORD_HTTP_POLL_OUT){
+            fds[index].events |= POLLOUT;
+        }
+    }
+
+    int wait = timeout_ms;
+    long timeout = get_next_timeout(http);
+
+    if (timeout >= 0 && (wait < 0 || timeout < wait)){
+        wait = timeout;
+    }
+
+    /* other threads may start requests meanwhile, their sockets are picked up on the next call */
+    if (http->thread_safe && (wait < 0 || wait > DISCORD_HTTP_THREAD_POLL_WAIT)){
+        wait = DISCORD_HTTP_THREAD_POLL_WAIT;
+    }
+
+    http->drivers += 1;
+
+    unlock_http(http);
+
+    int ready = poll(fds, socketslen, wait);
+
+    lock_http(http);
+
+    http->drivers -= 1;
+
+    if (ready < 0){
+        free(fds);
+
+        /* a signal only cut the wait short */
+        if (errno == EINTR){
+            return true;
+        }
+
         log_write(
             logger,
-            LOG_DEBUG,
-            "[%s] handle_response_status() - (%d) sent invalid request",
-            __FILE__,
-            response->status
+            LOG_ERROR,
+            "[%s] drive_multi() - poll call failed\n",
+            __FILE__
         );
 
-        break;
-    case 401:
+        return false;
+    }
+
+    bool success = true;
+
+    for (size_t index = 0; ready > 0 && index < socketslen; ++index){
+        int events = 0;
+
+        if (fds[index].revents & (POLLIN | POLLERR | POLLHUP)){
+            events |= DISCORD_HTTP_POLL_IN;
+        }
+
+        if (fds[index].revents & POLLOUT){
+            events |= DISCORD_HTTP_POLL_OUT;
+        }
+
+        if (events){
+            success = socket_action(http, fds[index].fd, events) && success;
+        }
+    }
+
+    free(fds);
+
+    if (!ready){
+        success = timer_action(http);
+    }
+
+    return success;
+}
+
+/* sleeps through rate limits on its own, outside the lanes, called without the lock */
+static discord_http_response *perform_transfer(discord_http *http, http_transfer *transfer){
+    discord_http_response *response = NULL;
+
+    transfer->ready_since = get_time_ms();
+
+    for (;;){
+        uint64_t wait = 0;
+
+        /* no probe, the first response may be an async one nobody is driving */
+        while (!try_reserve_bucket(http, transfer, false, get_time_ms(), &wait)){
+            log_write(
+                logger,
+                LOG_DEBUG,
+                "[%s] perform_transfer() - rate limited, waiting %" PRIu64 " ms (bucket: %s)\n",
+                __FILE__,
+                wait,
+                transfer->bucket->key
+            );
+
+            sleep_ms(wait);
+        }
+
+        lock_http(http);
+
+        /* the time slept above counts as waiting on rate limits */
+        begin_attempt(http, transfer);
+
+        unlock_http(http);
+
+        /* the only part that blocks, done without the lock */
+        CURLcode err = curl_easy_perform(transfer->handle);
+
+        lock_http(http);
+
+        response = finish_transfer(transfer, err);
+
+        uint64_t delay = 0;
+        bool retry = should_retry_transfer(http, transfer, err, response, &delay);
+
+        unlock_http(http);
+
+        if (!retry){
+            break;
+        }
+
+        discord_http_response_free(response);
+
+        response = NULL;
+
+        if (!reset_transfer(transfer)){
+            break;
+        }
+
+        sleep_ms(delay);
+
+        transfer->ready_since = get_time_ms();
+    }
+
+    return response;
+}
+
+/*
+ * waits on the signal until done is set, e.g. by dispatch_queued_transfers
+ * handing a transfer its turn, and dispatches again itself at the queue's
+ * next deadline, so a blocking request needs no event loop to get through
+ * a rate limit
+ *
+ * asynchronous requests ahead of it or one it coalesced onto only finish
+ * while someone services the multi, without an event loop and with nobody
+ * in discord_http_perform the waiting thread does it, otherwise it wakes up
+ * every DISCORD_HTTP_THREAD_POLL_WAIT ms to check again
+ */
+static void wait_for_signal(discord_http *http, const bool *done){
+    dispatch_queued_transfers(http);
+
+    while (!*done){
+        if (!http->loop.watch_socket && !http->drivers && http->inflight.length){
+            drive_multi(http, DISCORD_HTTP_THREAD_POLL_WAIT);
+        }
+        else {
+            uint64_t deadline = get_time_ms() + DISCORD_HTTP_THREAD_POLL_WAIT;
+
+            if (http->queue_deadline && http->queue_deadline < deadline){
+                deadline = http->queue_deadline;
+            }
+
+            struct timespec ts = {0};
+            ts.tv_sec = deadline / 1000;
+            ts.tv_nsec = (deadline % 1000) * 1000000;
+
+            pthread_cond_timedwait(&http->signal, &http->lock, &ts);
+        }
+
+        if (!*done){
+            dispatch_queued_transfers(http);
+        }
+    }
+}
+
+static void deliver_blocking_response(discord_http *http, discord_http_response *response, void *waiterptr){
+    http_blocking_waiter *waiter = waiterptr;
+
+    waiter->response = response;
+    waiter->done = true;
+
+    if (http->thread_safe){
+        pthread_cond_broadcast(&http->signal);
+    }
+}
+
+/* attaches a blocking GET to an identical pending one, called and returns with the lock held */
+static discord_http_response *wait_for_pending_request(discord_http *http, http_transfer *pending, discord_http_priority priority){
+    http_blocking_waiter waiter = {0};
+
+    if (!add_transfer_waiter(http, pending, priority, deliver_blocking_response, &waiter)){
         log_write(
             logger,
-            LOG_DEBUG,
-            "[%s] handle_response_status() - (%d) sent unauthorized request",
-            __FILE__,
-            response->status
+            LOG_ERROR,
+            "[%s] wait_for_pending_request() - add_transfer_waiter call failed\n",
+            __FILE__
         );
 
-        break;
-    case 403:
-        log_write(
-            logger,
-            LOG_DEBUG,
-            "[%s] handle_response_status() - (%d) requested privileged resource",
-            __FILE__,
-            response->status
-        );
+        return NULL;
+    }
 
-        break;
-    case 404:
-        log_write(
-            logger,
-            LOG_DEBUG,
-            "[%s] handle_response_status() - (%d) requested nonexistent resource",
-            __FILE__,
-            response->status
-        );
+    wait_for_signal(http, &waiter.done);
 
-        break;
-    case 405:
+    return waiter.response;
+}
+
+/* queues a blocking request in its priority lane, called and returns with the lock held */
+static discord_http_response *perform_queued_transfer(discord_http *http, http_transfer *transfer){
+    discord_http_response *response = NULL;
+
+    transfer->blocking = true;
+    transfer->ready_since = get_time_ms();
+
+    if (transfer->path && !add_pending_request(http, transfer)){
         log_write(
             logger,
-            LOG_DEBUG,
-            "[%s] handle_response_status() - (%d) invalid method for requested resource",
+            LOG_WARNING,
+            "[%s] perform_queued_transfer() - add_pending_request call failed, not coalescing %s\n",
             __FILE__,
-            response->status
+            transfer->path
         );
+    }
 
-        break;
-    case 429:
-        obj = json_object_object_get(response->data, "retry_after");
+    push_transfer(get_queue_lane(http, transfer->priority), transfer);
 
-        if (!obj){
-            log_write(
-                logger,
-                LOG_ERROR,
-                "[%s] handle_response_status() - failed to get retry_after json object",
-                __FILE__
-            );
+    for (;;){
+        wait_for_signal(http, &transfer->dispatched);
 
-            break;
-        }
+        /* the only part that blocks, done without the lock */
+        unlock_http(http);
 
-        retryafter = json_object_get_double(obj);
-        obj = json_object_object_get(response->data, "global");
+        CURLcode err = curl_easy_perform(transfer->handle);
+
+        lock_http(http);
+
+        response = finish_transfer(transfer, err);
+
+        uint64_t delay = 0;
 
-        if (obj && json_object_get_boolean(obj)){
-            http->globalratelimit = true;
+        if (!should_retry_transfer(http, transfer, err, response, &delay)){
+            break;
         }
 
-        success = set_rate_limited(http, bucket, time(NULL) + retryafter);
+        discord_http_response_free(response);
 
-        if (!success){
-            log_write(
-                logger,
-                LOG_ERROR,
-                "[%s] handle_response_status() - failed to set rate limit (bucket: %s)",
-                __FILE__,
-                bucket
-            );
+        response = NULL;
 
+        if (!reset_transfer(transfer)){
             break;
         }
 
-        log_write(
-            logger,
-            LOG_WARNING,
-            "[%s] handle_response_status() - rate limit exceeded (bucket: %s)",
-            __FILE__,
-            bucket
-        );
+        transfer->dispatched = false;
+        transfer->retry_at = delay ? get_time_ms() + delay : 0;
+        transfer->ready_since = transfer->retry_at ? transfer->retry_at : get_time_ms();
 
-        break;
-    default:
-        log_write(
-            logger,
-            LOG_DEBUG,
-            "[%s] handle_response_status() - (%d) unexpected status code",
-            __FILE__,
-            response->status
-        );
+        /* keeps its place ahead of requests queued after it */
+        push_transfer_front(get_queue_lane(http, transfer->priority), transfer);
     }
 
-    if (response->data){
-        json_object *message = json_object_object_get(
-            response->data,
-            "message"
-        );
+    /* the caller keeps its own reference */
+    http_waiter *waiters = take_transfer_waiters(http, transfer, response);
 
-        if (message){
-            log_write(
-                logger,
-                LOG_RAW,
-                " -- (Error: %s)",
-                json_object_get_string(message)
-            );
-        }
-    }
+    deliver_waiters(http, waiters, response);
 
-    log_write(logger, LOG_RAW, "\n");
+    /* the response may have opened the bucket for queued requests */
+    dispatch_queued_transfers(http);
+
+    return response;
 }
 
-discord_http *discord_http_init(const char *token, const discord_http_options *opts){
-    if (!opts){
-        /* unused for now */
+static bool queue_request(discord_http *http, discord_http_method method, const char *path, const discord_http_request_options *opts, discord_http_callback callback, void *userdata){
+    discord_http_priority priority = opts ? opts->priority : DISCORD_HTTP_PRIORITY_NORMAL;
+    discord_http_response *cached = get_cached_response(http, method, path, opts);
+
+    /* answered right away, before discord_http_request_async returns */
+    if (cached){
+        deliver_response(http, callback, userdata, cached);
+
+        return true;
     }
 
-    if (!token){
+    /* an identical GET already pending answers this one as well */
+    if (method == DISCORD_HTTP_GET && (!opts || !opts->data)){
+        http_transfer *pending = find_pending_request(http, method, path);
+
+        if (pending){
+            return add_transfer_waiter(http, pending, priority, callback, userdata);
+        }
+    }
+
+    http_transfer *transfer = create_transfer(http, method, path, opts);
+
+    if (!transfer){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] http_init() - token is NULL, refusing to initialize\n",
+            "[%s] queue_request() - create_transfer call failed\n",
             __FILE__
         );
 
-        return NULL;
+        return false;
     }
 
-    if (curl_global_init(CURL_GLOBAL_ALL)){
+    if (transfer->path && !add_pending_request(http, transfer)){
         log_write(
             logger,
-            LOG_ERROR,
-            "[%s] http_init() - curl_global_init call failed\n",
-            __FILE__
+            LOG_WARNING,
+            "[%s] queue_request() - add_pending_request call failed, not coalescing %s\n",
+            __FILE__,
+            path
         );
-
-        return NULL;
     }
 
-    map *buckets = map_init();
+    transfer->callback = callback;
+    transfer->userdata = userdata;
 
-    if (!buckets){
+    CURLcode err = curl_easy_setopt(transfer->handle, CURLOPT_PRIVATE, transfer);
+
+    if (err != CURLE_OK){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] http_init() - failed to initialize rate limit buckets\n",
+            "[%s] queue_request() - failed to set CURLOPT_PRIVATE\n",
             __FILE__
         );
 
-        curl_global_cleanup();
+        free_transfer(transfer);
 
-        return NULL;
+        return false;
     }
 
-    discord_http *http = calloc(1, sizeof(*http));
+    push_transfer(get_queue_lane(http, transfer->priority), transfer);
+    dispatch_queued_transfers(http);
 
-    if (!http){
+    return true;
+}
+
+/*
+ * queues a blocking request in its lane like an asynchronous one and services
+ * the multi until it is answered, called and returns with the lock held
+ */
+static discord_http_response *perform_driven_request(discord_http *http, discord_http_method method, const char *path, const discord_http_request_options *opts){
+    http_blocking_waiter waiter = {0};
+
+    if (!queue_request(http, method, path, opts, deliver_blocking_response, &waiter)){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] http_init() - alloc for discord_http failed\n",
+            "[%s] perform_driven_request() - queue_request call failed\n",
             __FILE__
         );
 
-        curl_global_cleanup();
-        map_free(buckets);
-
         return NULL;
     }
 
-    http->token = token;
-    http->buckets = buckets;
+    while (!waiter.done){
+        /* the waiter stays attached to the request, so it can't be given up on */
+        if (!drive_multi(http, -1)){
+            sleep_ms(DISCORD_HTTP_THREAD_POLL_WAIT);
+        }
+    }
 
-    return http;
+    return waiter.response;
 }
 
 discord_http_response *discord_http_request(discord_http *http, discord_http_method method, const char *path, const discord_http_request_options *opts){
@@ -1062,213 +4588,302 @@ discord_http_response *discord_http_request(discord_http *http, discord_http_met
         return NULL;
     }
 
-    char *bucket = create_request_bucket(path);
+    lock_http(http);
 
-    if (!bucket){
-        log_write(
-            logger,
-            LOG_ERROR,
-            "[%s] discord_http_request() - create_request_bucket call failed\n",
-            __FILE__
-        );
+    /* nested in a callback the lock can't be given up to wait on the lanes */
+    bool queued = http->thread_safe && held_locks == 1;
 
-        return NULL;
+    /*
+     * a single threaded caller drives the multi itself while it waits, so do
+     * callbacks unless the multi's sockets belong to an event loop's thread
+     */
+    if (!http->thread_safe || (!queued && !http->loop.watch_socket)){
+        discord_http_response *response = perform_driven_request(http, method, path, opts);
+
+        unlock_http(http);
+
+        return response;
     }
 
-    if (is_rate_limited(http, bucket)){
-        log_write(
-            logger,
-            LOG_WARNING,
-            "[%s] discord_http_request() - refusing request, rate limited (bucket: %s)\n",
-            __FILE__,
-            (http->globalratelimit ? "global" : bucket)
-        );
+    discord_http_response *cached = get_cached_response(http, method, path, opts);
 
-        free(bucket);
+    if (cached){
+        unlock_http(http);
 
-        return NULL;
+        return cached;
     }
 
-    CURL *handle = curl_easy_init();
+    /* an identical GET already pending answers this one as well */
+    if (queued && method == DISCORD_HTTP_GET && (!opts || !opts->data)){
+        http_transfer *pending = find_pending_request(http, method, path);
+
+        if (pending){
+            discord_http_response *response = wait_for_pending_request(
+                http,
+                pending,
+                opts ? opts->priority : DISCORD_HTTP_PRIORITY_NORMAL
+            );
+
+            unlock_http(http);
+
+            return response;
+        }
+    }
+
+    http_transfer *transfer = create_transfer(http, method, path, opts);
+
+    if (!transfer){
+        unlock_http(http);
 
-    if (!handle){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] discord_http_request() - curl_easy_init call failed\n"
+            "[%s] discord_http_request() - create_transfer call failed\n",
             __FILE__
         );
 
-        free(bucket);
-
         return NULL;
     }
 
-    if (!set_request_method(handle, method, opts)){
+    discord_http_response *response = NULL;
+
+    if (queued){
+        response = perform_queued_transfer(http, transfer);
+
+        free_transfer(transfer);
+
+        unlock_http(http);
+
+        return response;
+    }
+
+    unlock_http(http);
+
+    response = perform_transfer(http, transfer);
+
+    lock_http(http);
+
+    free_transfer(transfer);
+
+    unlock_http(http);
+
+    return response;
+}
+
+bool discord_http_request_async(discord_http *http, discord_http_method method, const char *path, const discord_http_request_options *opts, discord_http_callback callback, void *userdata){
+    if (!http){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] discord_http_request() - set_request_method call failed\n",
+            "[%s] discord_http_request_async() - http is NULL\n",
             __FILE__
         );
 
-        curl_easy_cleanup(handle);
-        free(bucket);
-
-        return NULL;
+        return false;
     }
-
-    if (!set_request_url(handle, path)){
+    else if (!path){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] discord_http_request() - set_request_url call failed\n",
+            "[%s] discord_http_request_async() - path is NULL\n",
             __FILE__
         );
 
-        curl_easy_cleanup(handle);
-        free(bucket);
-
-        return NULL;
+        return false;
     }
 
-    struct curl_slist *requestheaders = create_request_header_list(http, opts);
+    lock_http(http);
+
+    bool success = queue_request(http, method, path, opts, callback, userdata);
+
+    unlock_http(http);
 
-    if (!requestheaders){
+    return success;
+}
+
+bool discord_http_set_cache_ttl(discord_http *http, const char *route, uint64_t ttl){
+    if (!http){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] discord_http_request() - create_request_header_list call failed\n",
+            "[%s] discord_http_set_cache_ttl() - http is NULL\n",
             __FILE__
         );
 
-        curl_easy_cleanup(handle);
-        free(bucket);
-
-        return NULL;
+        return false;
     }
-
-    if (!set_request_headers(handle, requestheaders)){
+    else if (!route){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] discord_http_request() - set_request_headers call failed\n",
+            "[%s] discord_http_set_cache_ttl() - route is NULL\n",
             __FILE__
         );
 
-        curl_slist_free_all(requestheaders);
-        curl_easy_cleanup(handle);
-        free(bucket);
-
-        return NULL;
+        return false;
     }
 
-    struct responsestr out = {0};
+    double value = ttl;
+
+    map_item k = {0};
+    k.type = M_TYPE_STRING;
+    k.size = strlen(route);
+    k.data_copy = route;
+
+    map_item v = {0};
+    v.type = M_TYPE_DOUBLE;
+    v.size = sizeof(value);
+    v.data_copy = &value;
+
+    lock_http(http);
+
+    bool success = map_set(http->cache_ttls, &k, &v);
+
+    unlock_http(http);
 
-    if (!set_response_data_writer(handle, &out)){
+    if (!success){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] discord_http_request() - set_response_data_writer call failed\n",
+            "[%s] discord_http_set_cache_ttl() - map_set call failed\n",
             __FILE__
         );
-
-        curl_slist_free_all(requestheaders);
-        curl_easy_cleanup(handle);
-        free(bucket);
-
-        return NULL;
     }
 
-    map *responseheaders = map_init();
+    return success;
+}
 
-    if (!responseheaders){
+bool discord_http_set_event_loop(discord_http *http, const discord_http_event_loop *loop){
+    if (!http){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] discord_http_request() - map_init call failed\n",
+            "[%s] discord_http_set_event_loop() - http is NULL\n",
             __FILE__
         );
 
-        curl_slist_free_all(requestheaders);
-        curl_easy_cleanup(handle);
-        free(bucket);
+        return false;
+    }
 
-        return NULL;
+    lock_http(http);
+
+    size_t socketslen = list_get_length(http->sockets);
+
+    for (size_t index = 0; index < socketslen; ++index){
+        http_socket *sock = list_get_generic(http->sockets, index);
+
+        sock->loopdata = NULL;
+    }
+
+    if (!loop){
+        discord_http_event_loop empty = {0};
+
+        http->loop = empty;
+
+        unlock_http(http);
+
+        return true;
+    }
+
+    http->loop = *loop;
+
+    /* hand over sockets and the timer of requests already in flight */
+    for (size_t index = 0; index < socketslen; ++index){
+        http_socket *sock = list_get_generic(http->sockets, index);
+
+        if (http->loop.watch_socket){
+            sock->loopdata = http->loop.watch_socket(
+                http->loop.userdata,
+                sock->fd,
+                sock->events,
+                NULL
+            );
+        }
+    }
+
+    long timeout = get_next_timeout(http);
+
+    if (http->loop.set_timer && timeout >= 0){
+        http->loop.set_timer(http->loop.userdata, timeout);
     }
 
-    if (!set_response_header_writer(handle, responseheaders)){
+    unlock_http(http);
+
+    return true;
+}
+
+bool discord_http_socket_action(discord_http *http, int fd, int events){
+    if (!http){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] discord_http_request() - set_response_header_writer call failed\n",
+            "[%s] discord_http_socket_action() - http is NULL\n",
             __FILE__
         );
 
-        map_free(responseheaders);
-        curl_slist_free_all(requestheaders);
-        curl_easy_cleanup(handle);
-        free(bucket);
-
-        return NULL;
+        return false;
     }
 
-    CURLcode err = curl_easy_perform(handle);
+    lock_http(http);
 
-    curl_slist_free_all(requestheaders);
+    bool success = socket_action(http, fd, events);
 
-    if (err != CURLE_OK){
+    unlock_http(http);
+
+    return success;
+}
+
+bool discord_http_timer_action(discord_http *http){
+    if (!http){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] discord_http_request() - failed to perform request: %s\n",
-            __FILE__,
-            curl_easy_strerror(err)
+            "[%s] discord_http_timer_action() - http is NULL\n",
+            __FILE__
         );
 
-        map_free(responseheaders);
-        curl_easy_cleanup(handle);
-        free(bucket);
-
-        return NULL;
+        return false;
     }
 
-    discord_http_response *response = create_response(handle, responseheaders);
+    lock_http(http);
 
-    curl_easy_cleanup(handle);
+    bool success = timer_action(http);
 
-    if (!response){
+    unlock_http(http);
+
+    return success;
+}
+
+bool discord_http_perform(discord_http *http, int timeout_ms){
+    if (!http){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] discord_http_request() - create_response call failed\n",
+            "[%s] discord_http_perform() - http is NULL\n",
             __FILE__
         );
 
-        map_free(responseheaders);
-        free(bucket);
+        return false;
     }
 
-    if (out.length > 0){
-        response->data = json_tokener_parse(out.data);
+    lock_http(http);
 
-        free(out.data);
+    if (!http->inflight.length && !get_queued_length(http)){
+        unlock_http(http);
 
-        if (!response->data){
-            log_write(
-                logger,
-                LOG_ERROR,
-                "[%s] discord_http_request() - json_tokener_parse call failed\n",
-                __FILE__
-            );
+        /* nothing to poll yet, but another thread may start a request, so idle instead of spinning */
+        if (http->thread_safe && timeout_ms){
+            poll(NULL, 0, timeout_ms < 0 || timeout_ms > DISCORD_HTTP_THREAD_POLL_WAIT ? DISCORD_HTTP_THREAD_POLL_WAIT : timeout_ms);
         }
+
+        return true;
     }
 
-    handle_response_status(http, bucket, response);
+    bool success = drive_multi(http, timeout_ms);
 
-    free(bucket);
+    unlock_http(http);
 
-    return response;
+    return success;
 }
 
 discord_http_response *discord_http_get_gateway(discord_http *http){
@@ -1648,7 +5263,231 @@ discord_http_response *discord_http_edit_channel(discord_http *http, snowflake c
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] http_edit_channel() - string_create call failed\n",
+            "[%s] http_edit_channel() - string_create call failed\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    discord_http_request_options opts = {0};
+    opts.data = data;
+    opts.reason = reason;
+
+    discord_http_response *response = discord_http_request(
+        http,
+        DISCORD_HTTP_PATCH,
+        path,
+        &opts
+    );
+
+    free(path);
+
+    return response;
+}
+
+discord_http_response *discord_http_delete_channel(discord_http *http, snowflake channelid, const char *reason){
+    char *path = string_create(
+        "/channels/%" PRIu64,
+        channelid
+    );
+
+    if (!path){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] http_delete_channel() - string_create call failed\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    discord_http_request_options opts = {0};
+    opts.reason = reason;
+
+    discord_http_response *response = discord_http_request(
+        http,
+        DISCORD_HTTP_DELETE,
+        path,
+        &opts
+    );
+
+    free(path);
+
+    return response;
+}
+
+discord_http_response *discord_http_edit_channel_permissions(discord_http *http, snowflake channelid, snowflake overwriteid, json_object *data, const char *reason){
+    char *path = string_create(
+        "/channels/%" PRIu64 "/permissions/%" PRIu64,
+        channelid,
+        overwriteid
+    );
+
+    if (!path){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] http_edit_channel_permissions() - string_create call failed\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    discord_http_request_options opts = {0};
+    opts.data = data;
+    opts.reason = reason;
+
+    discord_http_response *response = discord_http_request(
+        http,
+        DISCORD_HTTP_PUT,
+        path,
+        &opts
+    );
+
+    free(path);
+
+    return response;
+}
+
+discord_http_response *discord_http_delete_channel_permission(discord_http *http, snowflake channelid, snowflake overwriteid, const char *reason){
+    char *path = string_create(
+        "/channels/%" PRIu64 "/permissions/%" PRIu64,
+        channelid,
+        overwriteid
+    );
+
+    if (!path){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] http_delete_channel_permission() - string_create call failed\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    discord_http_request_options opts = {0};
+    opts.reason = reason;
+
+    discord_http_response *response = discord_http_request(
+        http,
+        DISCORD_HTTP_DELETE,
+        path,
+        &opts
+    );
+
+    free(path);
+
+    return response;
+}
+
+discord_http_response *discord_http_get_channel_invites(discord_http *http, snowflake channelid){
+    char *path = string_create(
+        "/channels/%" PRIu64 "/invites",
+        channelid
+    );
+
+    if (!path){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] http_get_channel_invites() - string_create call failed\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    discord_http_response *response = discord_http_request(
+        http,
+        DISCORD_HTTP_GET,
+        path,
+        NULL
+    );
+
+    free(path);
+
+    return response;
+}
+
+discord_http_response *discord_http_create_channel_invite(discord_http *http, snowflake channelid, json_object *data, const char *reason){
+    char *path = string_create(
+        "/channels/%" PRIu64 "/invites",
+        channelid
+    );
+
+    if (!path){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] http_create_channel_invite() - string_create call failed\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    discord_http_request_options opts = {0};
+    opts.data = data;
+    opts.reason = reason;
+
+    discord_http_response *response = discord_http_request(
+        http,
+        DISCORD_HTTP_POST,
+        path,
+        &opts
+    );
+
+    free(path);
+
+    return response;
+}
+
+discord_http_response *discord_http_get_pinned_messages(discord_http *http, snowflake channelid){
+    char *path = string_create(
+        "/channels/%" PRIu64 "/pins",
+        channelid
+    );
+
+    if (!path){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] http_get_pinned_messages() - string_create call failed\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    discord_http_response *response = discord_http_request(
+        http,
+        DISCORD_HTTP_GET,
+        path,
+        NULL
+    );
+
+    free(path);
+
+    return response;
+}
+
+discord_http_response *discord_http_pin_message(discord_http *http, snowflake channelid, snowflake messageid, const char *reason){
+    char *path = string_create(
+        "/channels/%" PRIu64 "/pins/%" PRIu64,
+        channelid,
+        messageid
+    );
+
+    if (!path){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] http_pin_message() - string_create call failed\n",
             __FILE__
         );
 
@@ -1656,12 +5495,11 @@ discord_http_response *discord_http_edit_channel(discord_http *http, snowflake c
     }
 
     discord_http_request_options opts = {0};
-    opts.data = data;
     opts.reason = reason;
 
     discord_http_response *response = discord_http_request(
         http,
-        DISCORD_HTTP_PATCH,
+        DISCORD_HTTP_PUT,
         path,
         &opts
     );
@@ -1671,17 +5509,18 @@ discord_http_response *discord_http_edit_channel(discord_http *http, snowflake c
     return response;
 }
 
-discord_http_response *discord_http_delete_channel(discord_http *http, snowflake channelid, const char *reason){
+discord_http_response *discord_http_unpin_message(discord_http *http, snowflake channelid, snowflake messageid, const char *reason){
     char *path = string_create(
-        "/channels/%" PRIu64,
-        channelid
+        "/channels/%" PRIu64 "/pins/%" PRIu64,
+        channelid,
+        messageid
     );
 
     if (!path){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] http_delete_channel() - string_create call failed\n",
+            "[%s] http_unpin_message() - string_create call failed\n",
             __FILE__
         );
 
@@ -1703,33 +5542,118 @@ discord_http_response *discord_http_delete_channel(discord_http *http, snowflake
     return response;
 }
 
-discord_http_response *discord_http_edit_channel_permissions(discord_http *http, snowflake channelid, snowflake overwriteid, json_object *data, const char *reason){
+/* Message */
+/* GET has no body, the query object goes into the path as key=value pairs */
+static char *create_query_path(const char *path, json_object *query){
+    char *querypath = string_create("%s", path);
+
+    if (!querypath){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] create_query_path() - string_create call failed\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    if (!query){
+        return querypath;
+    }
+
+    char separator = '?';
+
+    struct json_object_iterator curr = json_object_iter_begin(query);
+    struct json_object_iterator end = json_object_iter_end(query);
+
+    while (!json_object_iter_equal(&curr, &end)){
+        const char *key = json_object_iter_peek_name(&curr);
+        const char *value = json_object_get_string(json_object_iter_peek_value(&curr));
+        char *escaped = curl_easy_escape(NULL, value ? value : "", 0);
+
+        if (!escaped){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] create_query_path() - curl_easy_escape call failed for %s\n",
+                __FILE__,
+                key
+            );
+
+            free(querypath);
+
+            return NULL;
+        }
+
+        char *tmp = string_create("%s%c%s=%s", querypath, separator, key, escaped);
+
+        curl_free(escaped);
+        free(querypath);
+
+        if (!tmp){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] create_query_path() - string_create call failed\n",
+                __FILE__
+            );
+
+            return NULL;
+        }
+
+        querypath = tmp;
+        separator = '&';
+
+        json_object_iter_next(&curr);
+    }
+
+    return querypath;
+}
+
+static char *create_channel_messages_path(snowflake channelid, json_object *query){
     char *path = string_create(
-        "/channels/%" PRIu64 "/permissions/%" PRIu64,
-        channelid,
-        overwriteid
+        "/channels/%" PRIu64 "/messages",
+        channelid
     );
 
     if (!path){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] http_edit_channel_permissions() - string_create call failed\n",
+            "[%s] create_channel_messages_path() - string_create call failed\n",
             __FILE__
         );
 
         return NULL;
     }
 
-    discord_http_request_options opts = {0};
-    opts.data = data;
-    opts.reason = reason;
+    char *querypath = create_query_path(path, query);
+
+    free(path);
+
+    return querypath;
+}
+
+discord_http_response *discord_http_get_channel_messages(discord_http *http, snowflake channelid, json_object *query){
+    char *path = create_channel_messages_path(channelid, query);
+
+    if (!path){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] http_get_channel_messages() - create_channel_messages_path call failed\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
 
     discord_http_response *response = discord_http_request(
         http,
-        DISCORD_HTTP_PUT,
+        DISCORD_HTTP_GET,
         path,
-        &opts
+        NULL
     );
 
     free(path);
@@ -1737,50 +5661,46 @@ discord_http_response *discord_http_edit_channel_permissions(discord_http *http,
     return response;
 }
 
-discord_http_response *discord_http_delete_channel_permission(discord_http *http, snowflake channelid, snowflake overwriteid, const char *reason){
-    char *path = string_create(
-        "/channels/%" PRIu64 "/permissions/%" PRIu64,
-        channelid,
-        overwriteid
-    );
+bool discord_http_get_channel_messages_async(discord_http *http, snowflake channelid, json_object *query, discord_http_callback callback, void *userdata){
+    char *path = create_channel_messages_path(channelid, query);
 
     if (!path){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] http_delete_channel_permission() - string_create call failed\n",
+            "[%s] http_get_channel_messages_async() - create_channel_messages_path call failed\n",
             __FILE__
         );
 
-        return NULL;
+        return false;
     }
 
-    discord_http_request_options opts = {0};
-    opts.reason = reason;
-
-    discord_http_response *response = discord_http_request(
+    bool success = discord_http_request_async(
         http,
-        DISCORD_HTTP_DELETE,
+        DISCORD_HTTP_GET,
         path,
-        &opts
+        NULL,
+        callback,
+        userdata
     );
 
     free(path);
 
-    return response;
+    return success;
 }
 
-discord_http_response *discord_http_get_channel_invites(discord_http *http, snowflake channelid){
+discord_http_response *discord_http_get_channel_message(discord_http *http, snowflake channelid, snowflake messageid){
     char *path = string_create(
-        "/channels/%" PRIu64 "/invites",
-        channelid
+        "/channels/%" PRIu64 "/messages/%" PRIu64,
+        channelid,
+        messageid
     );
 
     if (!path){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] http_get_channel_invites() - string_create call failed\n",
+            "[%s] http_get_channel_message() - string_create call failed\n",
             __FILE__
         );
 
@@ -1799,32 +5719,29 @@ discord_http_response *discord_http_get_channel_invites(discord_http *http, snow
     return response;
 }
 
-discord_http_response *discord_http_create_channel_invite(discord_http *http, snowflake channelid, json_object *data, const char *reason){
+discord_http_response *discord_http_crosspost_message(discord_http *http, snowflake channelid, snowflake messageid){
     char *path = string_create(
-        "/channels/%" PRIu64 "/invites",
-        channelid
+        "/channels/%" PRIu64 "/messages/%" PRIu64 "/crosspost",
+        channelid,
+        messageid
     );
 
     if (!path){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] http_create_channel_invite() - string_create call failed\n",
+            "[%s] http_crosspost_message() - string_create call failed\n",
             __FILE__
         );
 
         return NULL;
     }
 
-    discord_http_request_options opts = {0};
-    opts.data = data;
-    opts.reason = reason;
-
     discord_http_response *response = discord_http_request(
         http,
         DISCORD_HTTP_POST,
         path,
-        &opts
+        NULL
     );
 
     free(path);
@@ -1832,9 +5749,9 @@ discord_http_response *discord_http_create_channel_invite(discord_http *http, sn
     return response;
 }
 
-discord_http_response *discord_http_get_pinned_messages(discord_http *http, snowflake channelid){
+discord_http_response *discord_http_create_message(discord_http *http, snowflake channelid, json_object *data, const list *files){
     char *path = string_create(
-        "/channels/%" PRIu64 "/pins",
+        "/channels/%" PRIu64 "/messages",
         channelid
     );
 
@@ -1842,18 +5759,25 @@ discord_http_response *discord_http_get_pinned_messages(discord_http *http, snow
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] http_get_pinned_messages() - string_create call failed\n",
+            "[%s] http_create_message() - string_create call failed\n",
             __FILE__
         );
 
         return NULL;
     }
 
+    discord_http_request_options opts = {0};
+    opts.data = data;
+
+    if (files && list_get_length(files)){
+        opts.files = files;
+    }
+
     discord_http_response *response = discord_http_request(
         http,
-        DISCORD_HTTP_GET,
+        DISCORD_HTTP_POST,
         path,
-        NULL
+        &opts
     );
 
     free(path);
@@ -1861,9 +5785,9 @@ discord_http_response *discord_http_get_pinned_messages(discord_http *http, snow
     return response;
 }
 
-discord_http_response *discord_http_pin_message(discord_http *http, snowflake channelid, snowflake messageid, const char *reason){
+discord_http_response *discord_http_edit_message(discord_http *http, snowflake channelid, snowflake messageid, json_object *data){
     char *path = string_create(
-        "/channels/%" PRIu64 "/pins/%" PRIu64,
+        "/channels/%" PRIu64 "/messages/%" PRIu64,
         channelid,
         messageid
     );
@@ -1872,7 +5796,7 @@ discord_http_response *discord_http_pin_message(discord_http *http, snowflake ch
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] http_pin_message() - string_create call failed\n",
+            "[%s] http_edit_message() - string_create call failed\n",
             __FILE__
         );
 
@@ -1880,11 +5804,11 @@ discord_http_response *discord_http_pin_message(discord_http *http, snowflake ch
     }
 
     discord_http_request_options opts = {0};
-    opts.reason = reason;
+    opts.data = data;
 
     discord_http_response *response = discord_http_request(
         http,
-        DISCORD_HTTP_PUT,
+        DISCORD_HTTP_PATCH,
         path,
         &opts
     );
@@ -1894,9 +5818,9 @@ discord_http_response *discord_http_pin_message(discord_http *http, snowflake ch
     return response;
 }
 
-discord_http_response *discord_http_unpin_message(discord_http *http, snowflake channelid, snowflake messageid, const char *reason){
+discord_http_response *discord_http_delete_message(discord_http *http, snowflake channelid, snowflake messageid, const char *reason){
     char *path = string_create(
-        "/channels/%" PRIu64 "/pins/%" PRIu64,
+        "/channels/%" PRIu64 "/messages/%" PRIu64,
         channelid,
         messageid
     );
@@ -1905,7 +5829,7 @@ discord_http_response *discord_http_unpin_message(discord_http *http, snowflake
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] http_unpin_message() - string_create call failed\n",
+            "[%s] http_delete_message() - string_create call failed\n",
             __FILE__
         );
 
@@ -1927,10 +5851,9 @@ discord_http_response *discord_http_unpin_message(discord_http *http, snowflake
     return response;
 }
 
-/* Message */
-discord_http_response *discord_http_get_channel_messages(discord_http *http, snowflake channelid, json_object *data){
+discord_http_response *discord_http_bulk_delete_messages(discord_http *http, snowflake channelid, json_object *data, const char *reason){
     char *path = string_create(
-        "/channels/%" PRIu64 "/messages",
+        "/channels/%" PRIu64 "/messages/bulk-delete",
         channelid
     );
 
@@ -1938,7 +5861,7 @@ discord_http_response *discord_http_get_channel_messages(discord_http *http, sno
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] http_get_channel_messages() - string_create call failed\n",
+            "[%s] http_bulk_delete_messages() - string_create call failed\n",
             __FILE__
         );
 
@@ -1947,10 +5870,11 @@ discord_http_response *discord_http_get_channel_messages(discord_http *http, sno
 
     discord_http_request_options opts = {0};
     opts.data = data;
+    opts.reason = reason;
 
     discord_http_response *response = discord_http_request(
         http,
-        DISCORD_HTTP_GET,
+        DISCORD_HTTP_POST,
         path,
         &opts
     );
@@ -1960,7 +5884,92 @@ discord_http_response *discord_http_get_channel_messages(discord_http *http, sno
     return response;
 }
 
-discord_http_response *discord_http_get_channel_message(discord_http *http, snowflake channelid, snowflake messageid){
+typedef struct http_delete_batch {
+    size_t pending;
+    bool success;
+    bool abandoned;
+} http_delete_batch;
+
+static int compare_snowflakes(const void *a, const void *b){
+    snowflake x = *(const snowflake *)a;
+    snowflake y = *(const snowflake *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * sorts and dedups ids in place, returning how many are left, the first
+ * *old of those are deleted one by one (a single recent id included)
+ */
+static size_t plan_message_deletes(snowflake *ids, size_t length, time_t cutoff, size_t *old){
+    qsort(ids, length, sizeof(*ids), compare_snowflakes);
+
+    size_t unique = 0;
+
+    for (size_t index = 0; index < length; ++index){
+        if (!unique || ids[index] != ids[unique - 1]){
+            ids[unique++] = ids[index];
+        }
+    }
+
+    size_t single = 0;
+
+    while (single < unique && snowflake_get_creation_time(ids[single]) <= cutoff){
+        single += 1;
+    }
+
+    /* a single recent id cannot be bulk deleted either */
+    if (unique - single < DISCORD_HTTP_BULK_DELETE_MIN){
+        single = unique;
+    }
+
+    *old = single;
+
+    return unique;
+}
+
+/* evenly sized chunks, so none ends up with a single id, 0 past the last */
+static size_t get_delete_chunk_length(size_t recent, size_t chunk){
+    size_t chunks = (recent + DISCORD_HTTP_BULK_DELETE_MAX - 1) / DISCORD_HTTP_BULK_DELETE_MAX;
+
+    if (chunk >= chunks){
+        return 0;
+    }
+
+    return recent / chunks + (chunk < recent % chunks);
+}
+
+static void receive_delete_response(discord_http *http, discord_http_response *response, void *batchptr){
+    (void)http;
+
+    http_delete_batch *batch = batchptr;
+
+    if (!response){
+        batch->success = false;
+    }
+    else {
+        if (response->status != 204){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] receive_delete_response() - API request failed: %s\n",
+                __FILE__,
+                json_object_to_json_string(response->data)
+            );
+
+            batch->success = false;
+        }
+
+        discord_http_response_free(response);
+    }
+
+    /* the caller gave up waiting, the last response frees the batch */
+    if (!--batch->pending && batch->abandoned){
+        free(batch);
+    }
+}
+
+static bool queue_single_delete(discord_http *http, snowflake channelid, snowflake messageid, const discord_http_request_options *opts, http_delete_batch *batch){
     char *path = string_create(
         "/channels/%" PRIu64 "/messages/%" PRIu64,
         channelid,
@@ -1971,184 +5980,228 @@ discord_http_response *discord_http_get_channel_message(discord_http *http, snow
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] http_get_channel_message() - string_create call failed\n",
+            "[%s] queue_single_delete() - string_create call failed\n",
             __FILE__
         );
 
-        return NULL;
+        return false;
     }
 
-    discord_http_response *response = discord_http_request(
+    batch->pending += 1;
+
+    bool success = discord_http_request_async(
         http,
-        DISCORD_HTTP_GET,
+        DISCORD_HTTP_DELETE,
         path,
-        NULL
+        opts,
+        receive_delete_response,
+        batch
     );
 
+    if (!success){
+        batch->pending -= 1;
+    }
+
     free(path);
 
-    return response;
+    return success;
 }
 
-discord_http_response *discord_http_crosspost_message(discord_http *http, snowflake channelid, snowflake messageid){
-    char *path = string_create(
-        "/channels/%" PRIu64 "/messages/%" PRIu64 "/crosspost",
-        channelid,
-        messageid
-    );
+static bool queue_bulk_delete(discord_http *http, snowflake channelid, const snowflake *ids, size_t length, const discord_http_request_options *opts, http_delete_batch *batch){
+    json_object *data = json_object_new_object();
+    json_object *messages = json_object_new_array();
 
-    if (!path){
+    if (!data || !messages){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] http_crosspost_message() - string_create call failed\n",
+            "[%s] queue_bulk_delete() - json object initialization failed\n",
             __FILE__
         );
 
-        return NULL;
+        json_object_put(data);
+        json_object_put(messages);
+
+        return false;
     }
 
-    discord_http_response *response = discord_http_request(
-        http,
-        DISCORD_HTTP_POST,
-        path,
-        NULL
-    );
+    bool success = !json_object_object_add(data, "messages", messages);
 
-    free(path);
+    for (size_t index = 0; success && index < length; ++index){
+        char *id = snowflake_to_string(ids[index]);
 
-    return response;
-}
+        success = id && !json_object_array_add(messages, json_object_new_string(id));
 
-discord_http_response *discord_http_create_message(discord_http *http, snowflake channelid, json_object *data){
-    char *path = string_create(
-        "/channels/%" PRIu64 "/messages",
+        free(id);
+    }
+
+    char *path = success ? string_create(
+        "/channels/%" PRIu64 "/messages/bulk-delete",
         channelid
-    );
+    ) : NULL;
 
     if (!path){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] http_create_message() - string_create call failed\n",
+            "[%s] queue_bulk_delete() - failed to build request\n",
             __FILE__
         );
 
-        return NULL;
+        json_object_put(data);
+
+        return false;
     }
 
-    discord_http_request_options opts = {0};
-    opts.data = data;
+    discord_http_request_options bulkopts = *opts;
+    bulkopts.data = data;
+
+    batch->pending += 1;
 
-    discord_http_response *response = discord_http_request(
+    success = discord_http_request_async(
         http,
         DISCORD_HTTP_POST,
         path,
-        &opts
+        &bulkopts,
+        receive_delete_response,
+        batch
     );
 
+    if (!success){
+        batch->pending -= 1;
+    }
+
+    json_object_put(data);
     free(path);
 
-    return response;
+    return success;
 }
 
-discord_http_response *discord_http_edit_message(discord_http *http, snowflake channelid, snowflake messageid, json_object *data){
-    char *path = string_create(
-        "/channels/%" PRIu64 "/messages/%" PRIu64,
-        channelid,
-        messageid
-    );
-
-    if (!path){
+/*
+ * ids from the last two weeks are deleted DISCORD_HTTP_BULK_DELETE_MAX at a
+ * time, older ones (which bulk-delete rejects) one by one, all queued at
+ * once so the scheduler runs both buckets side by side
+ */
+bool discord_http_delete_messages(discord_http *http, snowflake channelid, const snowflake *ids, size_t length, const char *reason){
+    if (!http){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] http_edit_message() - string_create call failed\n",
+            "[%s] discord_http_delete_messages() - http is NULL\n",
             __FILE__
         );
 
-        return NULL;
+        return false;
     }
+    else if (!length){
+        return true;
+    }
+    else if (!ids){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] discord_http_delete_messages() - ids is NULL\n",
+            __FILE__
+        );
 
-    discord_http_request_options opts = {0};
-    opts.data = data;
-
-    discord_http_response *response = discord_http_request(
-        http,
-        DISCORD_HTTP_PATCH,
-        path,
-        &opts
-    );
-
-    free(path);
-
-    return response;
-}
+        return false;
+    }
 
-discord_http_response *discord_http_delete_message(discord_http *http, snowflake channelid, snowflake messageid, const char *reason){
-    char *path = string_create(
-        "/channels/%" PRIu64 "/messages/%" PRIu64,
-        channelid,
-        messageid
-    );
+    /* bulk-delete rejects duplicates, sorting also puts old ids first */
+    snowflake *sorted = malloc(length * sizeof(*sorted));
+    http_delete_batch *batch = calloc(1, sizeof(*batch));
 
-    if (!path){
+    if (!sorted || !batch){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] http_delete_message() - string_create call failed\n",
+            "[%s] discord_http_delete_messages() - alloc failed\n",
             __FILE__
         );
 
-        return NULL;
+        free(sorted);
+        free(batch);
+
+        return false;
     }
 
+    memcpy(sorted, ids, length * sizeof(*sorted));
+
+    size_t old = 0;
+    size_t unique = plan_message_deletes(sorted, length, time(NULL) - DISCORD_HTTP_BULK_DELETE_MAX_AGE, &old);
+
     discord_http_request_options opts = {0};
     opts.reason = reason;
 
-    discord_http_response *response = discord_http_request(
-        http,
-        DISCORD_HTTP_DELETE,
-        path,
-        &opts
-    );
+    batch->success = true;
 
-    free(path);
+    bool queued = true;
 
-    return response;
-}
+    lock_http(http);
 
-discord_http_response *discord_http_bulk_delete_messages(discord_http *http, snowflake channelid, json_object *data, const char *reason){
-    char *path = string_create(
-        "/channels/%" PRIu64 "/messages/bulk-delete",
-        channelid
-    );
+    for (size_t index = 0; queued && index < old; ++index){
+        queued = queue_single_delete(http, channelid, sorted[index], &opts, batch);
+    }
 
-    if (!path){
+    size_t chunklength = 0;
+
+    for (size_t chunk = 0, offset = old; queued && (chunklength = get_delete_chunk_length(unique - old, chunk)); ++chunk){
+        queued = queue_bulk_delete(http, channelid, sorted + offset, chunklength, &opts, batch);
+        offset += chunklength;
+    }
+
+    unlock_http(http);
+
+    free(sorted);
+
+    if (!queued){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] http_bulk_delete_messages() - string_create call failed\n",
+            "[%s] discord_http_delete_messages() - failed to queue request\n",
             __FILE__
         );
-
-        return NULL;
     }
 
-    discord_http_request_options opts = {0};
-    opts.data = data;
-    opts.reason = reason;
+    /* responses may be delivered on any thread that drives the client */
+    for (;;){
+        lock_http(http);
 
-    discord_http_response *response = discord_http_request(
-        http,
-        DISCORD_HTTP_POST,
-        path,
-        &opts
-    );
+        size_t pending = batch->pending;
 
-    free(path);
+        unlock_http(http);
 
-    return response;
+        if (!pending){
+            break;
+        }
+
+        if (!discord_http_perform(http, -1)){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] discord_http_delete_messages() - discord_http_perform call failed\n",
+                __FILE__
+            );
+
+            lock_http(http);
+
+            batch->abandoned = true;
+
+            if (!batch->pending){
+                free(batch);
+            }
+
+            unlock_http(http);
+
+            return false;
+        }
+    }
+
+    bool success = queued && batch->success;
+
+    free(batch);
+
+    return success;
 }
 
 discord_http_response *discord_http_get_reactions(discord_http *http, snowflake channelid, snowflake messageid, const char *emoji){
@@ -2348,12 +6401,217 @@ void discord_http_response_free(discord_http_response *response){
 
         return;
     }
+    else if (--response->references){
+        return;
+    }
 
     json_object_put(response->data);
-    map_free(response->headers);
+    map_free(atomic_load(&response->headers));
+    free(response->rawheaders);
     free(response);
 }
 
+static bool add_response_header(map *headers, const char *line, size_t length){
+    size_t namelength = 0;
+    const char *value = NULL;
+    size_t valuelength = 0;
+
+    if (!split_header_line(line, length, &namelength, &value, &valuelength)){
+        /* status line or the blank line ending the block */
+        return true;
+    }
+
+    char name[DISCORD_HTTP_HEADER_NAME_LENGTH];
+
+    if (namelength >= sizeof(name)){
+        return true;
+    }
+
+    /* HTTP/2 sends lowercase names, HTTP/1.1 ones are folded to match */
+    for (size_t index = 0; index < namelength; ++index){
+        name[index] = tolower((unsigned char)line[index]);
+    }
+
+    name[namelength] = '\0';
+
+    map_item k = {0};
+    k.type = M_TYPE_STRING;
+    k.size = namelength;
+    k.data_copy = name;
+
+    map_item v = {0};
+    v.type = M_TYPE_STRING;
+    v.size = valuelength;
+    v.data_copy = value;
+
+    return map_set(headers, &k, &v);
+}
+
+bool discord_http_get_stats(discord_http *http, discord_http_stats *output){
+    if (!http){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] discord_http_get_stats() - http is NULL\n",
+            __FILE__
+        );
+
+        return false;
+    }
+    else if (!output){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] discord_http_get_stats() - output is NULL\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    lock_http(http);
+
+    *output = http->stats;
+    output->routes = NULL;
+
+    /* other threads keep recording into the live route list */
+    discord_http_route_stats **tail = &output->routes;
+
+    for (const discord_http_route_stats *route = http->stats.routes; route; route = route->next){
+        discord_http_route_stats *copy = malloc(sizeof(*copy));
+
+        if (!copy){
+            unlock_http(http);
+
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] discord_http_get_stats() - alloc for route stats failed\n",
+                __FILE__
+            );
+
+            discord_http_stats_free(output);
+
+            return false;
+        }
+
+        *copy = *route;
+        copy->next = NULL;
+
+        *tail = copy;
+        tail = &copy->next;
+    }
+
+    unlock_http(http);
+
+    return true;
+}
+
+void discord_http_stats_free(discord_http_stats *stats){
+    if (!stats){
+        return;
+    }
+
+    while (stats->routes){
+        discord_http_route_stats *next = stats->routes->next;
+
+        free(stats->routes);
+
+        stats->routes = next;
+    }
+}
+
+uint64_t discord_http_histogram_percentile(const discord_http_histogram *histogram, double percentile){
+    if (!histogram || !histogram->count){
+        return 0;
+    }
+
+    uint64_t target = (uint64_t)(histogram->count * percentile / 100);
+    uint64_t seen = 0;
+
+    if (target >= histogram->count){
+        return histogram->max;
+    }
+
+    for (size_t index = 0; index < DISCORD_HTTP_HISTOGRAM_BUCKETS; ++index){
+        seen += histogram->counts[index];
+
+        if (seen > target){
+            uint64_t value = get_histogram_value(index);
+
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
+
+const map *discord_http_response_get_headers(discord_http_response *response){
+    if (!response){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] discord_http_response_get_headers() - response is NULL\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    map *headers = atomic_load(&response->headers);
+
+    if (headers){
+        return headers;
+    }
+
+    headers = map_init();
+
+    if (!headers){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] discord_http_response_get_headers() - map_init call failed\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    const char *cursor = response->rawheaders;
+    const char *end = cursor + response->rawheaders_length;
+
+    while (cursor && cursor < end){
+        const char *newline = memchr(cursor, '\n', end - cursor);
+        const char *lineend = newline ? newline + 1 : end;
+
+        if (!add_response_header(headers, cursor, lineend - cursor)){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] discord_http_response_get_headers() - map_set call failed\n",
+                __FILE__
+            );
+
+            map_free(headers);
+
+            return NULL;
+        }
+
+        cursor = lineend;
+    }
+
+    map *published = NULL;
+
+    /* holders on other threads may race to parse a shared response, the first map wins */
+    if (!atomic_compare_exchange_strong(&response->headers, &published, headers)){
+        map_free(headers);
+
+        return published;
+    }
+
+    return headers;
+}
+
 void discord_http_free(discord_http *http){
     if (!http){
         log_write(
@@ -2366,7 +6624,42 @@ void discord_http_free(discord_http *http){
         return;
     }
 
+    while (http->inflight.head){
+        http_transfer *transfer = http->inflight.head;
+
+        remove_transfer(&http->inflight, transfer);
+        curl_multi_remove_handle(http->multi, transfer->handle);
+        complete_transfer(http, transfer, NULL);
+    }
+
+    for (size_t lane = 0; lane < DISCORD_HTTP_PRIORITY_LANES; ++lane){
+        while (http->queued[lane].head){
+            http_transfer *transfer = http->queued[lane].head;
+
+            remove_transfer(&http->queued[lane], transfer);
+            complete_transfer(http, transfer, NULL);
+        }
+    }
+
+    for (size_t index = 0; index < http->handles_length; ++index){
+        curl_easy_cleanup(http->handles[index]);
+    }
+
+    curl_multi_cleanup(http->multi);
+    curl_share_cleanup(http->share);
+
+    free_shared_headers(http);
+
+    map_free(http->cache);
+    map_free(http->cache_ttls);
+    map_free(http->route_stats);
+    map_free(http->pending);
+
+    list_free(http->sockets);
+
     map_free(http->buckets);
+
+    free_locks(http);
     free(http);
 
     curl_global_cleanup();
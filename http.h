@@ -1,6 +1,7 @@
 #ifndef DISCORD_HTTP_H
 #define DISCORD_HTTP_H
 
+#include "c-utils/list.h"
 #include "c-utils/map.h"
 
 #include "snowflake.h"
@@ -8,6 +9,42 @@
 
 #include <json-c/json.h>
 
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <curl/curl.h>
+
+#define DISCORD_HTTP_HANDLE_POOL_SIZE 8
+#define DISCORD_HTTP_RATE_LIMIT_RETRIES 5
+#define DISCORD_HTTP_BUCKET_HASH_LENGTH 64
+#define DISCORD_HTTP_BUCKET_KEY_LENGTH 128
+#define DISCORD_HTTP_BUCKET_SWEEP_INTERVAL 60000
+#define DISCORD_HTTP_HEADER_NAME_LENGTH 128
+#define DISCORD_HTTP_GLOBAL_RATE 50
+#define DISCORD_HTTP_PRIORITY_LANES 3
+#define DISCORD_HTTP_LOW_PRIORITY_RESERVE 0.2
+#define DISCORD_HTTP_CACHE_SIZE 1024
+#define DISCORD_HTTP_RETRY_MAX 3
+#define DISCORD_HTTP_RETRY_BASE_DELAY 250
+#define DISCORD_HTTP_RETRY_MAX_DELAY 8000
+#define DISCORD_HTTP_RETRY_DEADLINE 30000
+#define DISCORD_HTTP_LOCK_STRIPES 16
+#define DISCORD_HTTP_THREAD_POLL_WAIT 10
+#define DISCORD_HTTP_BULK_DELETE_MIN 2
+#define DISCORD_HTTP_BULK_DELETE_MAX 100
+/* two weeks, less a minute of clock skew */
+#define DISCORD_HTTP_BULK_DELETE_MAX_AGE (14 * 24 * 60 * 60 - 60)
+
+/* log-linear buckets, values up to 2^35 us (~9.5h) within 1/8 of a power of two */
+#define DISCORD_HTTP_HISTOGRAM_SUBBUCKET_BITS 3
+#define DISCORD_HTTP_HISTOGRAM_SUBBUCKETS (1 << DISCORD_HTTP_HISTOGRAM_SUBBUCKET_BITS)
+#define DISCORD_HTTP_HISTOGRAM_LINEAR (2 * DISCORD_HTTP_HISTOGRAM_SUBBUCKETS)
+#define DISCORD_HTTP_HISTOGRAM_BUCKETS (DISCORD_HTTP_HISTOGRAM_LINEAR + 32 * DISCORD_HTTP_HISTOGRAM_SUBBUCKETS)
+
+typedef struct http_bucket http_bucket;
+typedef struct http_cache_entry http_cache_entry;
+typedef struct http_transfer http_transfer;
+
 typedef enum discord_http_method {
     DISCORD_HTTP_GET,
     DISCORD_HTTP_DELETE,
@@ -16,32 +53,328 @@ typedef enum discord_http_method {
     DISCORD_HTTP_PUT
 } discord_http_method;
 
+/*
+ * higher priority requests are sent first when the global or bucket budget
+ * is tight, low priority ones also leave DISCORD_HTTP_LOW_PRIORITY_RESERVE of
+ * the global rate to the others
+ *
+ * blocking requests wait their turn in the same lanes as asynchronous ones,
+ * except ones a callback makes on a thread_safe client with an event loop
+ * set, which only sleep through their own rate limits
+ */
+typedef enum discord_http_priority {
+    DISCORD_HTTP_PRIORITY_NORMAL,
+    DISCORD_HTTP_PRIORITY_HIGH,
+    DISCORD_HTTP_PRIORITY_LOW
+} discord_http_priority;
+
+/*
+ * a file sent with multipart/form-data, read from data when set and from fd
+ * otherwise (mapped into memory when mmap is set), size 0 sends the whole fd
+ * and a regular file must be at least size bytes long
+ *
+ * fd and data must stay valid until the request completes
+ */
+typedef struct discord_http_file {
+    const char *filename;
+    const char *content_type;
+
+    int fd;
+    const void *data;
+    size_t size;
+    bool mmap;
+} discord_http_file;
+
+/* files is a list of discord_http_file pointers, data then goes in payload_json */
 typedef struct discord_http_request_options {
     json_object *data;
     const char *reason;
+    const list *files;
+
+    discord_http_priority priority;
 } discord_http_request_options;
 
+/* -1 for limit/remaining when the response carried no rate limit headers */
+typedef struct discord_http_ratelimit {
+    int limit;
+    int remaining;
+    double reset_after;
+    double retry_after;
+    bool global;
+    char bucket[DISCORD_HTTP_BUCKET_HASH_LENGTH + 1];
+} discord_http_ratelimit;
+
+/* microseconds, waited is the time the request was held back by rate limits */
+typedef struct discord_http_timings {
+    uint64_t namelookup;
+    uint64_t connect;
+    uint64_t appconnect;
+    uint64_t starttransfer;
+    uint64_t total;
+    uint64_t waited;
+} discord_http_timings;
+
+/*
+ * headers are kept raw and only parsed into a map by
+ * discord_http_response_get_headers, names are lowercase
+ *
+ * coalesced GET requests share one response, every holder frees its own
+ * reference and must not modify it, getting the headers is safe from any of
+ * them
+ */
 typedef struct discord_http_response {
     long status;
-    map *headers;
     json_object *data;
+
+    discord_http_ratelimit ratelimit;
+
+    char *rawheaders;
+    size_t rawheaders_length;
+    _Atomic(map *) headers;
+
+    discord_http_timings timings;
+    char route[DISCORD_HTTP_BUCKET_KEY_LENGTH];
+
+    atomic_size_t references;
 } discord_http_response;
 
+typedef enum discord_http_poll_events {
+    DISCORD_HTTP_POLL_IN = 1,
+    DISCORD_HTTP_POLL_OUT = 2,
+    DISCORD_HTTP_POLL_REMOVE = 4
+} discord_http_poll_events;
+
+/*
+ * lets an external event loop (e.g. the gateway's libwebsockets context)
+ * watch the sockets of asynchronous requests
+ *
+ * watch_socket returns the per-socket pointer handed back on the next call
+ * for the same fd, set_timer receives -1 to cancel the timer
+ */
+typedef struct discord_http_event_loop {
+    void *userdata;
+
+    void *(*watch_socket)(void *, int, int, void *);
+    void (*set_timer)(void *, long);
+} discord_http_event_loop;
+
+/* values are microseconds, see discord_http_histogram_percentile */
+typedef struct discord_http_histogram {
+    uint64_t counts[DISCORD_HTTP_HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+} discord_http_histogram;
+
+/* route is the method and path template, e.g. "GET /channels/:id/messages" */
+typedef struct discord_http_route_stats {
+    struct discord_http_route_stats *next;
+
+    char route[DISCORD_HTTP_BUCKET_KEY_LENGTH];
+    size_t requests;
+    size_t errors;
+
+    discord_http_histogram latency;
+    discord_http_histogram waited;
+} discord_http_route_stats;
+
+/*
+ * streams_per_connection is the mean number of requests an HTTP/2 connection carried
+ *
+ * the histograms cover every attempt, phases a reused connection skipped
+ * are left out of namelookup, connect and appconnect
+ */
+typedef struct discord_http_stats {
+    size_t requests;
+    size_t connections_created;
+    size_t connections_reused;
+
+    size_t http2_requests;
+    size_t http2_connections;
+    double streams_per_connection;
+    size_t max_inflight;
+    size_t requests_coalesced;
+    size_t cache_hits;
+    size_t cache_revalidations;
+    size_t retries;
+
+    discord_http_histogram namelookup;
+    discord_http_histogram connect;
+    discord_http_histogram appconnect;
+    discord_http_histogram starttransfer;
+    discord_http_histogram total;
+    discord_http_histogram waited;
+
+    discord_http_route_stats *routes;
+} discord_http_stats;
+
+/*
+ * retries of connection errors and 5xx responses, times are milliseconds
+ * and deadline counts from when the request was made (0 for none)
+ */
+typedef struct discord_http_retry_policy {
+    int max_retries;
+    uint64_t base_delay;
+    uint64_t max_delay;
+    uint64_t deadline;
+} discord_http_retry_policy;
+
+/*
+ * global_rate is in requests per second, 0 for DISCORD_HTTP_GLOBAL_RATE
+ *
+ * cache_ttl is how many milliseconds GET responses are served from the
+ * cache, 0 leaves the cache off except for routes given a ttl with
+ * discord_http_set_cache_ttl
+ */
 typedef struct discord_http_options {
     const logctx *log;
+
+    double global_rate;
+    uint64_t cache_ttl;
+
+    /* NULL for the DISCORD_HTTP_RETRY_* defaults */
+    const discord_http_retry_policy *retry;
+
+    /* NULL for DISCORD_API, e.g. "http://127.0.0.1:8080/api/v10" */
+    const char *base_url;
+    /* any proxy string libcurl accepts, e.g. "socks5h://127.0.0.1:1080" */
+    const char *proxy;
+    /* CA bundle to verify the API host against instead of the system one */
+    const char *ca_file;
+
+    /* connection tuning, 0 keeps the libcurl default for each */
+    long keepalive;            /* TCP keepalive idle and probe interval, seconds */
+    bool disable_nodelay;      /* libcurl sets TCP_NODELAY unless this is set */
+    long connect_timeout;      /* milliseconds */
+    long timeout;              /* milliseconds per attempt, including the transfer */
+    long max_host_connections; /* concurrent connections to the API host */
+    long dns_cache_ttl;        /* seconds, -1 caches forever */
+
+    /*
+     * lets any number of threads issue requests on the client, see
+     * discord_http for what the locks cover
+     */
+    bool thread_safe;
 } discord_http_options;
 
+typedef struct http_transfer_queue {
+    http_transfer *head;
+    http_transfer *tail;
+    size_t length;
+} http_transfer_queue;
+
+/* the callback owns the response and must free it (NULL on failure) */
+typedef void (*discord_http_callback)(discord_http *, discord_http_response *, void *);
+
 typedef struct discord_http {
     const char *token;
 
-    bool ratelimited;
-    bool globalratelimit;
+    /* see discord_http_options */
+    const char *base_url;
+    const char *proxy;
+    const char *ca_file;
+    long keepalive;
+    bool disable_nodelay;
+    long connect_timeout;
+    long timeout;
+    long max_host_connections;
+    long dns_cache_ttl;
+
+    /*
+     * with thread_safe, lock guards everything below except the bucket rate
+     * state (bucket_locks, striped by bucket key) and the global limit
+     * (global_lock), taken in the order lock, bucket lock, global_lock
+     *
+     * lock is recursive, callbacks run while it is held and may queue
+     * requests; sockets and the timer are only handed to an event loop from
+     * the thread that holds it, so with one set async requests belong on
+     * the loop's thread and workers use discord_http_request
+     */
+    bool thread_safe;
+    pthread_mutex_t lock;
+    pthread_mutex_t global_lock;
+    pthread_mutex_t bucket_locks[DISCORD_HTTP_LOCK_STRIPES];
+    pthread_mutex_t share_locks[CURL_LOCK_DATA_LAST];
+
+    /* broadcast under lock when a blocking request is dispatched, on CLOCK_MONOTONIC */
+    pthread_cond_t signal;
+
+    /* threads polling the multi's sockets right now */
+    size_t drivers;
+
+    /* request headers shared by every request */
+    struct curl_slist *headers;
+    struct curl_slist *json_headers;
+
+    /* rate limits, times are monotonic milliseconds */
     map *buckets;
+    http_bucket *bucket_list;
+    uint64_t bucket_sweep;
+    uint64_t global_reset;
+
+    /* token bucket pacing every request below the per-route buckets */
+    double global_rate;
+    double global_tokens;
+    uint64_t global_refill;
+
+    /* connection reuse */
+    CURLSH *share;
+    CURL *handles[DISCORD_HTTP_HANDLE_POOL_SIZE];
+    size_t handles_length;
+
+    /* asynchronous requests */
+    CURLM *multi;
+    list *sockets;
+    discord_http_event_loop loop;
+    uint64_t curl_deadline;
+    uint64_t queue_deadline;
+    http_transfer_queue queued[DISCORD_HTTP_PRIORITY_LANES];
+    http_transfer_queue inflight;
+
+    /* GETs queued or in flight, by method and path, e.g. "GET /users/@me" */
+    map *pending;
+
+    /* GET responses by path, most recently used first */
+    map *cache;
+    map *cache_ttls;
+    uint64_t cache_ttl;
+    http_cache_entry *cache_head;
+    http_cache_entry *cache_tail;
+    size_t cache_length;
+
+    discord_http_retry_policy retry;
+    uint64_t retry_seed;
+
+    map *route_stats;
+
+    discord_http_stats stats;
 } discord_http;
 
 discord_http *discord_http_init(const char *, const discord_http_options *);
 
+/*
+ * a blocking GET identical to a pending request waits for that request's
+ * response instead of sending its own
+ *
+ * without thread_safe, the call services the client's other requests while
+ * it waits, so their callbacks may run before it returns
+ */
 discord_http_response *discord_http_request(discord_http *, discord_http_method, const char *, const discord_http_request_options *);
+bool discord_http_request_async(discord_http *, discord_http_method, const char *, const discord_http_request_options *, discord_http_callback, void *);
+
+/* route is a template such as "/users/:id" or "/channels/:id", 0 disables caching it */
+bool discord_http_set_cache_ttl(discord_http *, const char *, uint64_t);
+
+bool discord_http_set_event_loop(discord_http *, const discord_http_event_loop *);
+bool discord_http_socket_action(discord_http *, int, int);
+bool discord_http_timer_action(discord_http *);
+bool discord_http_perform(discord_http *, int);
+
+/* copies the stats under the lock, the copy's routes are freed with discord_http_stats_free */
+bool discord_http_get_stats(discord_http *, discord_http_stats *);
+void discord_http_stats_free(discord_http_stats *);
+uint64_t discord_http_histogram_percentile(const discord_http_histogram *, double);
 
 /*
  * API calls by type
@@ -84,14 +417,16 @@ discord_http_response *discord_http_unpin_message(discord_http *, snowflake, sno
 
 /* Message */
 discord_http_response *discord_http_get_channel_messages(discord_http *, snowflake, json_object *);
+bool discord_http_get_channel_messages_async(discord_http *, snowflake, json_object *, discord_http_callback, void *);
 discord_http_response *discord_http_get_channel_message(discord_http *, snowflake, snowflake);
 
 discord_http_response *discord_http_crosspost_message(discord_http *, snowflake, snowflake);
 
-discord_http_response *discord_http_create_message(discord_http *, snowflake, json_object *);
+discord_http_response *discord_http_create_message(discord_http *, snowflake, json_object *, const list *);
 discord_http_response *discord_http_edit_message(discord_http *, snowflake, snowflake, json_object *);
 discord_http_response *discord_http_delete_message(discord_http *, snowflake, snowflake, const char *);
 discord_http_response *discord_http_bulk_delete_messages(discord_http *, snowflake, json_object *, const char *);
+bool discord_http_delete_messages(discord_http *, snowflake, const snowflake *, size_t, const char *);
 
 discord_http_response *discord_http_get_reactions(discord_http *, snowflake, snowflake, const char *);
 discord_http_response *discord_http_create_reaction(discord_http *, snowflake, snowflake, const char *);
@@ -100,6 +435,8 @@ discord_http_response *discord_http_delete_user_reaction(discord_http *, snowfla
 discord_http_response *discord_http_delete_all_reactions(discord_http *, snowflake, snowflake);
 discord_http_response *discord_http_delete_all_reactions_for_emoji(discord_http *, snowflake, snowflake, const char *);
 
+const map *discord_http_response_get_headers(discord_http_response *);
+
 void discord_http_response_free(discord_http_response *);
 void discord_http_free(discord_http *);
 
@@ -812,6 +812,332 @@ void message_free(void *messageptr){
     free(message);
 }
 
+/* message iterator functions */
+
+static void receive_message_page(discord_http *http, discord_http_response *response, void *iteratorptr){
+    (void)http;
+
+    discord_message_iterator *iterator = iteratorptr;
+    iterator->prefetched = response;
+
+    /* freed while the request was in flight */
+    if (atomic_exchange(&iterator->prefetch, MESSAGE_ITERATOR_IDLE) == MESSAGE_ITERATOR_ABANDONED){
+        if (response){
+            discord_http_response_free(response);
+        }
+
+        free(iterator);
+    }
+}
+
+static bool request_message_page(discord_message_iterator *iterator){
+    json_object *query = json_object_new_object();
+
+    if (!query){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] request_message_page() - query object initialization failed\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    bool success = !json_object_object_add(query, "limit", json_object_new_int(iterator->limit));
+
+    if (success && (iterator->cursor || iterator->direction == MESSAGE_ITERATOR_AFTER)){
+        char *cursor = snowflake_to_string(iterator->cursor);
+
+        if (cursor){
+            success = !json_object_object_add(
+                query,
+                iterator->direction == MESSAGE_ITERATOR_AFTER ? "after" : "before",
+                json_object_new_string(cursor)
+            );
+        }
+        else {
+            success = false;
+        }
+
+        free(cursor);
+    }
+
+    if (!success){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] request_message_page() - failed to build query object\n",
+            __FILE__
+        );
+
+        json_object_put(query);
+
+        return false;
+    }
+
+    /* a cached page is delivered before the call returns */
+    atomic_store(&iterator->prefetch, MESSAGE_ITERATOR_PENDING);
+
+    success = discord_http_get_channel_messages_async(
+        iterator->state->http,
+        iterator->channel_id,
+        query,
+        receive_message_page,
+        iterator
+    );
+
+    json_object_put(query);
+
+    if (!success){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] request_message_page() - discord_http_get_channel_messages_async call failed\n",
+            __FILE__
+        );
+
+        atomic_store(&iterator->prefetch, MESSAGE_ITERATOR_IDLE);
+    }
+
+    return success;
+}
+
+/* makes the prefetched page current and requests the one after it */
+static bool advance_message_page(discord_message_iterator *iterator){
+    while (atomic_load(&iterator->prefetch) == MESSAGE_ITERATOR_PENDING){
+        if (!discord_http_perform(iterator->state->http, -1)){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] advance_message_page() - discord_http_perform call failed\n",
+                __FILE__
+            );
+
+            return false;
+        }
+    }
+
+    if (iterator->page){
+        discord_http_response_free(iterator->page);
+    }
+
+    iterator->page = iterator->prefetched;
+    iterator->prefetched = NULL;
+    iterator->index = 0;
+
+    discord_http_response *response = iterator->page;
+
+    if (!response){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] advance_message_page() - page request failed\n",
+            __FILE__
+        );
+
+        return false;
+    }
+    else if (response->status != 200 || !json_object_is_type(response->data, json_type_array)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] advance_message_page() - API request failed: %s\n",
+            __FILE__,
+            json_object_to_json_string(response->data)
+        );
+
+        discord_http_response_free(response);
+
+        iterator->page = NULL;
+
+        return false;
+    }
+
+    size_t length = json_object_array_length(response->data);
+
+    /* a short page is the last one */
+    if (length < (size_t)iterator->limit){
+        iterator->finished = true;
+
+        return true;
+    }
+
+    for (size_t index = 0; index < length; ++index){
+        json_object *obj = json_object_object_get(
+            json_object_array_get_idx(response->data, index),
+            "id"
+        );
+
+        snowflake id = 0;
+
+        if (!snowflake_from_string(json_object_get_string(obj), &id)){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] advance_message_page() - snowflake_from_string call failed for id: %s\n",
+                __FILE__,
+                json_object_get_string(obj)
+            );
+
+            return false;
+        }
+
+        bool further = iterator->direction == MESSAGE_ITERATOR_AFTER ? id > iterator->cursor : id < iterator->cursor;
+
+        if (!index || further){
+            iterator->cursor = id;
+        }
+    }
+
+    /* the current page can still be consumed if this fails */
+    if (!request_message_page(iterator)){
+        iterator->finished = true;
+        iterator->failed = true;
+    }
+
+    return true;
+}
+
+discord_message_iterator *message_iterator_init(discord_state *state, snowflake channelid, discord_message_iterator_direction direction, snowflake start, int limit){
+    if (!state){
+        log_write(
+            logger,
+            LOG_WARNING,
+            "[%s] message_iterator_init() - state is NULL\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    logger = state->log;
+
+    discord_message_iterator *iterator = calloc(1, sizeof(*iterator));
+
+    if (!iterator){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] message_iterator_init() - iterator alloc failed\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    iterator->state = state;
+    iterator->channel_id = channelid;
+    iterator->direction = direction;
+    iterator->cursor = start;
+    iterator->limit = limit > 0 && limit < MESSAGE_ITERATOR_PAGE_SIZE ? limit : MESSAGE_ITERATOR_PAGE_SIZE;
+
+    if (!request_message_page(iterator)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] message_iterator_init() - request_message_page call failed\n",
+            __FILE__
+        );
+
+        free(iterator);
+
+        return NULL;
+    }
+
+    return iterator;
+}
+
+/*
+ * the message is set in the state cache as it is returned, so it stays
+ * valid until the cache evicts it
+ */
+const discord_message *message_iterator_next(discord_message_iterator *iterator){
+    if (!iterator){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] message_iterator_next() - iterator is NULL\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    for (;;){
+        size_t length = iterator->page ? json_object_array_length(iterator->page->data) : 0;
+
+        if (iterator->index < length){
+            size_t index = iterator->index++;
+
+            if (iterator->direction == MESSAGE_ITERATOR_AFTER){
+                index = length - 1 - index;
+            }
+
+            /* keeps the prefetch moving without blocking the caller */
+            if (atomic_load(&iterator->prefetch) == MESSAGE_ITERATOR_PENDING){
+                discord_http_perform(iterator->state->http, 0);
+            }
+
+            json_object *obj = json_object_array_get_idx(iterator->page->data, index);
+            const discord_message *message = state_set_message(iterator->state, obj, true);
+
+            if (!message){
+                log_write(
+                    logger,
+                    LOG_ERROR,
+                    "[%s] message_iterator_next() - state_set_message call failed\n",
+                    __FILE__
+                );
+
+                iterator->failed = true;
+            }
+
+            return message;
+        }
+
+        if (iterator->finished || iterator->failed){
+            return NULL;
+        }
+
+        if (!advance_message_page(iterator)){
+            iterator->failed = true;
+
+            return NULL;
+        }
+    }
+}
+
+void message_iterator_free(discord_message_iterator *iterator){
+    if (!iterator){
+        log_write(
+            logger,
+            LOG_DEBUG,
+            "[%s] message_iterator_free() - iterator is NULL\n",
+            __FILE__
+        );
+
+        return;
+    }
+
+    if (iterator->page){
+        discord_http_response_free(iterator->page);
+    }
+
+    iterator->page = NULL;
+
+    /* the pending request still points at the iterator, its callback frees it */
+    if (atomic_exchange(&iterator->prefetch, MESSAGE_ITERATOR_ABANDONED) == MESSAGE_ITERATOR_PENDING){
+        return;
+    }
+
+    if (iterator->prefetched){
+        discord_http_response_free(iterator->prefetched);
+    }
+
+    free(iterator);
+}
+
 /* message reply functions */
 
 static bool set_reply_json_content(json_object *replyobj, const char *content){
@@ -961,6 +1287,73 @@ static bool set_reply_json_embeds(json_object *replyobj, const discord_embed *em
     return success;
 }
 
+/* the files themselves are sent as multipart parts, matched by id */
+static bool set_reply_json_attachments(json_object *replyobj, const list *attachments){
+    if (!attachments){
+        return true;
+    }
+
+    json_object *attachmentsobj = json_object_new_array();
+
+    if (!attachmentsobj){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] set_reply_json_attachments() - attachments object initialization failed\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    if (json_object_object_add(replyobj, "attachments", attachmentsobj)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] set_reply_json_attachments() - json_object_object_add call failed for attachments\n",
+            __FILE__
+        );
+
+        json_object_put(attachmentsobj);
+
+        return false;
+    }
+
+    for (size_t index = 0; index < list_get_length(attachments); ++index){
+        const discord_http_file *file = list_get_generic(attachments, index);
+        json_object *attachmentobj = json_object_new_object();
+
+        if (!attachmentobj){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] set_reply_json_attachments() - attachment object initialization failed\n",
+                __FILE__
+            );
+
+            return false;
+        }
+
+        if (json_object_array_add(attachmentsobj, attachmentobj)){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] set_reply_json_attachments() - json_object_array_add call failed\n",
+                __FILE__
+            );
+
+            json_object_put(attachmentobj);
+
+            return false;
+        }
+
+        json_object_object_add(attachmentobj, "id", json_object_new_int64((int64_t)index));
+        json_object_object_add(attachmentobj, "filename", json_object_new_string(file->filename));
+    }
+
+    return true;
+}
+
 /* --- BOOKMARK --- convert this to the constructor format */
 json_object *message_reply_to_json(const discord_message_reply *reply){
     if (!reply){
@@ -1005,6 +1398,12 @@ json_object *message_reply_to_json(const discord_message_reply *reply){
         return NULL;
     }
 
+    if (!set_reply_json_attachments(replyobj, reply->attachments)){
+        json_object_put(replyobj);
+
+        return NULL;
+    }
+
     /* support the rest */
 
     return replyobj;
@@ -3,6 +3,8 @@
 
 #include "state.h"
 
+#include <stdatomic.h>
+
 typedef struct discord_message_reference {
     int type;
     snowflake message_id;
@@ -28,6 +30,7 @@ typedef struct discord_message_reply {
     const list *components;
     const list *sticker_ids;
     json_object *payload_json;
+    /* discord_http_file pointers, uploaded as multipart/form-data */
     const list *attachments;
     int flags;
 } discord_message_reply;
@@ -125,6 +128,44 @@ typedef struct discord_message {
     list *sticker_items;
 } discord_message;
 
+#define MESSAGE_ITERATOR_PAGE_SIZE 100
+
+/* the prefetch may complete on any thread driving a thread-safe client */
+typedef enum discord_message_iterator_prefetch {
+    MESSAGE_ITERATOR_IDLE = 0,
+    MESSAGE_ITERATOR_PENDING = 1,
+    MESSAGE_ITERATOR_ABANDONED = 2
+} discord_message_iterator_prefetch;
+
+typedef enum discord_message_iterator_direction {
+    MESSAGE_ITERATOR_BEFORE = 0,
+    MESSAGE_ITERATOR_AFTER = 1
+} discord_message_iterator_direction;
+
+/*
+ * walks a channel's history one page at a time, newest to oldest for
+ * MESSAGE_ITERATOR_BEFORE and oldest to newest for MESSAGE_ITERATOR_AFTER
+ *
+ * the next page is requested as soon as the current one arrives, so it
+ * downloads while the caller works through the current page
+ */
+typedef struct discord_message_iterator {
+    discord_state *state;
+
+    snowflake channel_id;
+    discord_message_iterator_direction direction;
+    snowflake cursor;
+    int limit;
+
+    discord_http_response *page;
+    size_t index;
+
+    discord_http_response *prefetched;
+    atomic_int prefetch;
+    bool finished;
+    bool failed;
+} discord_message_iterator;
+
 discord_message *message_init(discord_state *, json_object *);
 bool message_update(discord_message *, json_object *);
 
@@ -132,6 +173,10 @@ bool message_update(discord_message *, json_object *);
 //bool message_edit(discord_message *, params);
 bool message_delete(const discord_message *, const char *);
 
+discord_message_iterator *message_iterator_init(discord_state *, snowflake, discord_message_iterator_direction, snowflake, int);
+const discord_message *message_iterator_next(discord_message_iterator *);
+void message_iterator_free(discord_message_iterator *);
+
 void message_free(void *);
 
 json_object *message_reply_to_json(const discord_message_reply *);
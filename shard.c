@@ -0,0 +1,858 @@
+#include "shard.h"
+
+static const logctx *logger = NULL;
+
+static bool set_gateway_information(discord_shard_manager *manager){
+    discord_http_response *response = discord_http_get_bot_gateway(manager->state->http);
+
+    if (!response){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] set_gateway_information() - discord_http_get_bot_gateway call failed\n",
+            __FILE__
+        );
+
+        return false;
+    }
+    else if (response->status != 200){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] set_gateway_information() - API request failed: %s\n",
+            __FILE__,
+            json_object_to_json_string(response->data)
+        );
+
+        discord_http_response_free(response);
+
+        return false;
+    }
+
+    json_object *sessiondata = json_object_object_get(
+        response->data,
+        "session_start_limit"
+    );
+
+    manager->recommended_shards = json_object_get_int(
+        json_object_object_get(response->data, "shards")
+    );
+
+    manager->max_concurrency = json_object_get_int(
+        json_object_object_get(sessiondata, "max_concurrency")
+    );
+
+    manager->remaining_session_starts = json_object_get_int(
+        json_object_object_get(sessiondata, "remaining")
+    );
+
+    char *url = string_duplicate(
+        json_object_get_string(json_object_object_get(response->data, "url"))
+    );
+
+    discord_http_response_free(response);
+
+    if (!url){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] set_gateway_information() - url string alloc failed\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    free(manager->url);
+
+    manager->url = url;
+
+    if (manager->max_concurrency < 1){
+        manager->max_concurrency = 1;
+    }
+
+    return true;
+}
+
+
+/* queued by shard_manager_send for a group running on another thread */
+struct discord_shard_command {
+    discord_shard_command *next;
+
+    discord_gateway_opcodes op;
+    json_object *data;
+};
+
+static discord_shard_group *get_shard_group(const discord_shard_manager *manager, int shardid){
+    return &manager->groups[shardid % manager->group_count];
+}
+
+static bool is_group_shard(const discord_shard_group *group, int shardid){
+    return shardid % group->manager->group_count == group->index;
+}
+
+static void free_shards(discord_shard_manager *manager){
+    if (manager->shards){
+        for (int index = 0; index < manager->shard_count; ++index){
+            gateway_free(manager->shards[index]);
+        }
+    }
+
+    free(manager->shards);
+    free(manager->identify_at);
+
+    manager->shards = NULL;
+    manager->identify_at = NULL;
+    manager->shard_count = 0;
+}
+
+static bool init_shards(discord_shard_manager *manager){
+    manager->shards = calloc(manager->shard_count, sizeof(*manager->shards));
+    manager->identify_at = calloc(manager->max_concurrency, sizeof(*manager->identify_at));
+
+    if (!manager->shards || !manager->identify_at){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] init_shards() - alloc for %d shards failed\n",
+            __FILE__,
+            manager->shard_count
+        );
+
+        return false;
+    }
+
+    discord_gateway_options opts = manager->gateway_options;
+    opts.shard_count = manager->shard_count;
+    opts.manager = manager;
+
+    for (int index = 0; index < manager->shard_count; ++index){
+        opts.shard_id = index;
+        opts.loop = get_shard_group(manager, index)->loop;
+
+        manager->shards[index] = gateway_init(manager->state, &opts);
+
+        if (!manager->shards[index]){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] init_shards() - gateway_init call failed for shard %d\n",
+                __FILE__,
+                index
+            );
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool connect_group_wave(discord_shard_group *);
+
+static void handle_connect_timer(lws_sorted_usec_list_t *sul){
+    discord_shard_group *group = lws_container_of(sul, discord_shard_group, connect_timer);
+
+    if (!connect_group_wave(group)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] handle_connect_timer() - connect_group_wave call failed\n",
+            __FILE__
+        );
+    }
+}
+
+/*
+ * a wave covers every rate limit bucket once, so its shards can identify
+ * together, every group connects its own part of each wave
+ */
+static bool connect_group_wave(discord_shard_group *group){
+    discord_shard_manager *manager = group->manager;
+
+    int first = group->wave * manager->max_concurrency;
+    int end = first + manager->max_concurrency;
+
+    if (end > manager->shard_count){
+        end = manager->shard_count;
+    }
+
+    group->wave += 1;
+
+    for (int shardid = first; shardid < end; ++shardid){
+        if (!is_group_shard(group, shardid)){
+            continue;
+        }
+
+        discord_gateway *shard = manager->shards[shardid];
+
+        log_write(
+            logger,
+            LOG_DEBUG,
+            "[%s] connect_group_wave() - connecting shard %d of %d\n",
+            __FILE__,
+            shardid,
+            manager->shard_count
+        );
+
+        if (!gateway_connect(shard)){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] connect_group_wave() - gateway_connect call failed for shard %d\n",
+                __FILE__,
+                shardid
+            );
+
+            /* stops shard_manager_run_loop */
+            shard->running = false;
+
+            return false;
+        }
+    }
+
+    if (end < manager->shard_count){
+        lws_sul_schedule(
+            group->loop->context,
+            0,
+            &group->connect_timer,
+            handle_connect_timer,
+            DISCORD_GATEWAY_IDENTIFY_INTERVAL * LWS_US_PER_SEC
+        );
+    }
+
+    return true;
+}
+
+static void disconnect_group(discord_shard_group *group){
+    discord_shard_manager *manager = group->manager;
+
+    lws_sul_schedule(
+        group->loop->context,
+        0,
+        &group->connect_timer,
+        handle_connect_timer,
+        LWS_SET_TIMER_USEC_CANCEL
+    );
+
+    for (int shardid = group->index; shardid < manager->shard_count; shardid += manager->group_count){
+        discord_gateway *shard = manager->shards[shardid];
+
+        if (shard->connected || shard->reconnect){
+            gateway_disconnect(shard);
+        }
+        else if (shardid >= group->wave * manager->max_concurrency){
+            /* never connected, nothing will close */
+            shard->running = false;
+        }
+    }
+}
+
+static bool send_group(discord_shard_group *group, discord_gateway_opcodes op, json_object *data){
+    discord_shard_manager *manager = group->manager;
+    bool success = true;
+
+    for (int shardid = group->index; shardid < manager->shard_count; shardid += manager->group_count){
+        if (!gateway_send(manager->shards[shardid], op, data)){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] send_group() - gateway_send call failed for shard %d\n",
+                __FILE__,
+                shardid
+            );
+
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+static bool queue_group_command(discord_shard_group *group, discord_gateway_opcodes op, json_object *data){
+    discord_shard_command *command = calloc(1, sizeof(*command));
+
+    if (!command){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] queue_group_command() - alloc for command failed\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    command->op = op;
+
+    /* the worker must not share json objects with the caller's thread */
+    if (data && json_object_deep_copy(data, &command->data, NULL)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] queue_group_command() - json_object_deep_copy call failed\n",
+            __FILE__
+        );
+
+        free(command);
+
+        return false;
+    }
+
+    pthread_mutex_lock(&group->lock);
+
+    discord_shard_command **tail = &group->commands;
+
+    while (*tail){
+        tail = &(*tail)->next;
+    }
+
+    *tail = command;
+
+    pthread_mutex_unlock(&group->lock);
+
+    lws_cancel_service(group->loop->context);
+
+    return true;
+}
+
+static void free_group_commands(discord_shard_command *command){
+    while (command){
+        discord_shard_command *next = command->next;
+
+        json_object_put(command->data);
+        free(command);
+
+        command = next;
+    }
+}
+
+static void run_group_commands(discord_shard_group *group){
+    if (atomic_exchange(&group->disconnect, false)){
+        disconnect_group(group);
+    }
+
+    pthread_mutex_lock(&group->lock);
+
+    discord_shard_command *commands = group->commands;
+    group->commands = NULL;
+
+    pthread_mutex_unlock(&group->lock);
+
+    for (discord_shard_command *command = commands; command; command = command->next){
+        send_group(group, command->op, command->data);
+    }
+
+    free_group_commands(commands);
+}
+
+static bool are_group_shards_running(const discord_shard_group *group){
+    const discord_shard_manager *manager = group->manager;
+
+    for (int shardid = group->index; shardid < manager->shard_count; shardid += manager->group_count){
+        if (!manager->shards[shardid]->running){
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool are_shards_running(const discord_shard_manager *manager){
+    if (!manager->shard_count){
+        return false;
+    }
+
+    for (int index = 0; index < manager->shard_count; ++index){
+        if (!manager->shards[index]->running){
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void *run_shard_group(void *groupptr){
+    discord_shard_group *group = groupptr;
+    discord_shard_manager *manager = group->manager;
+
+    bool success = connect_group_wave(group);
+
+    while (success && !atomic_load(&group->stop) && are_group_shards_running(group)){
+        if (lws_service(group->loop->context, 0)){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] run_shard_group() - lws_service call failed for group %d\n",
+                __FILE__,
+                group->index
+            );
+
+            success = false;
+
+            break;
+        }
+
+        run_group_commands(group);
+    }
+
+    /* lets shard_manager_run_loop see the group is gone */
+    if (!success){
+        for (int shardid = group->index; shardid < manager->shard_count; shardid += manager->group_count){
+            manager->shards[shardid]->running = false;
+        }
+    }
+
+    return NULL;
+}
+
+static bool start_shard_groups(discord_shard_manager *manager){
+    for (int index = 0; index < manager->group_count && index < manager->shard_count; ++index){
+        discord_shard_group *group = &manager->groups[index];
+
+        atomic_store(&group->stop, false);
+
+        if (pthread_create(&group->thread, NULL, run_shard_group, group)){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] start_shard_groups() - pthread_create call failed for group %d\n",
+                __FILE__,
+                index
+            );
+
+            return false;
+        }
+
+        group->started = true;
+    }
+
+    return true;
+}
+
+static void stop_shard_groups(discord_shard_manager *manager){
+    for (int index = 0; index < manager->group_count; ++index){
+        discord_shard_group *group = &manager->groups[index];
+
+        if (!group->started){
+            continue;
+        }
+
+        atomic_store(&group->stop, true);
+
+        lws_cancel_service(group->loop->context);
+
+        pthread_join(group->thread, NULL);
+
+        group->started = false;
+    }
+}
+
+static bool init_shard_groups(discord_shard_manager *manager){
+    manager->group_count = manager->threads > 0 ? manager->threads : 1;
+    manager->groups = calloc(manager->group_count, sizeof(*manager->groups));
+
+    if (!manager->groups){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] init_shard_groups() - alloc for %d groups failed\n",
+            __FILE__,
+            manager->group_count
+        );
+
+        manager->group_count = 0;
+
+        return false;
+    }
+
+    for (int index = 0; index < manager->group_count; ++index){
+        discord_shard_group *group = &manager->groups[index];
+
+        group->manager = manager;
+        group->index = index;
+
+        /* worker loops can't run curl's sockets, lws is not thread-safe */
+        group->loop = gateway_loop_init(manager->state, !manager->threads);
+
+        if (!group->loop || pthread_mutex_init(&group->lock, NULL)){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] init_shard_groups() - initialization failed for group %d\n",
+                __FILE__,
+                index
+            );
+
+            gateway_loop_free(group->loop);
+
+            manager->group_count = index;
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void free_shard_groups(discord_shard_manager *manager){
+    for (int index = 0; index < manager->group_count; ++index){
+        discord_shard_group *group = &manager->groups[index];
+
+        gateway_loop_free(group->loop);
+
+        pthread_mutex_destroy(&group->lock);
+
+        free_group_commands(group->commands);
+    }
+
+    free(manager->groups);
+
+    manager->groups = NULL;
+    manager->group_count = 0;
+}
+
+discord_shard_manager *shard_manager_init(discord_state *state, const discord_shard_manager_options *opts){
+    if (!state){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] shard_manager_init() - state is NULL\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    logger = state->log;
+
+    if (opts && opts->threads > 0 && !state->thread_safe){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] shard_manager_init() - worker threads require a thread_safe state\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    discord_shard_manager *manager = calloc(1, sizeof(*manager));
+
+    if (!manager){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] shard_manager_init() - alloc for shard manager failed\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    if (pthread_mutex_init(&manager->identify_lock, NULL)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] shard_manager_init() - identify lock initialization failed\n",
+            __FILE__
+        );
+
+        free(manager);
+
+        return NULL;
+    }
+
+    manager->state = state;
+
+    if (opts){
+        manager->requested_shards = opts->shards;
+        manager->threads = opts->threads > 0 ? opts->threads : 0;
+
+        if (opts->gateway){
+            manager->gateway_options = *opts->gateway;
+        }
+    }
+
+    if (!init_shard_groups(manager)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] shard_manager_init() - init_shard_groups call failed\n",
+            __FILE__
+        );
+
+        shard_manager_free(manager);
+
+        return NULL;
+    }
+
+    return manager;
+}
+
+bool shard_manager_connect(discord_shard_manager *manager){
+    if (!manager){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] shard_manager_connect() - manager is NULL\n",
+            __FILE__
+        );
+
+        return false;
+    }
+    else if (manager->shards){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] shard_manager_connect() - shards are already connected\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    if (!set_gateway_information(manager)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] shard_manager_connect() - set_gateway_information call failed\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    manager->shard_count = manager->requested_shards > 0 ? manager->requested_shards : manager->recommended_shards;
+
+    if (manager->shard_count < 1){
+        manager->shard_count = 1;
+    }
+
+    if (manager->remaining_session_starts < manager->shard_count){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] shard_manager_connect() - %d session starts left for %d shards\n",
+            __FILE__,
+            manager->remaining_session_starts,
+            manager->shard_count
+        );
+
+        manager->shard_count = 0;
+
+        return false;
+    }
+
+    log_write(
+        logger,
+        LOG_DEBUG,
+        "[%s] shard_manager_connect() - starting %d shards on %d threads (max_concurrency %d)\n",
+        __FILE__,
+        manager->shard_count,
+        manager->threads ? manager->threads : 1,
+        manager->max_concurrency
+    );
+
+    if (!init_shards(manager)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] shard_manager_connect() - init_shards call failed\n",
+            __FILE__
+        );
+
+        free_shards(manager);
+
+        return false;
+    }
+
+    /* workers connect their own shards, lws calls stay on the context's thread */
+    if (manager->threads){
+        return start_shard_groups(manager);
+    }
+
+    return connect_group_wave(&manager->groups[0]);
+}
+
+void shard_manager_disconnect(discord_shard_manager *manager){
+    if (!manager){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] shard_manager_disconnect() - manager is NULL\n",
+            __FILE__
+        );
+
+        return;
+    }
+
+    if (!manager->threads){
+        disconnect_group(&manager->groups[0]);
+
+        return;
+    }
+
+    for (int index = 0; index < manager->group_count; ++index){
+        atomic_store(&manager->groups[index].disconnect, true);
+
+        lws_cancel_service(manager->groups[index].loop->context);
+    }
+}
+
+/*
+ * returns once any shard stops, a failed shard takes the others down with it
+ *
+ * with threads the workers are joined before returning and this thread
+ * services the http client's asynchronous requests meanwhile
+ */
+bool shard_manager_run_loop(discord_shard_manager *manager){
+    if (!manager){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] shard_manager_run_loop() - manager is NULL\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    bool success = true;
+
+    while (success && are_shards_running(manager)){
+        if (manager->threads){
+            success = discord_http_perform(manager->state->http, DISCORD_HTTP_THREAD_POLL_WAIT);
+        }
+        else {
+            success = !lws_service(manager->groups[0].loop->context, 0);
+        }
+
+        if (!success){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] shard_manager_run_loop() - servicing the %s failed\n",
+                __FILE__,
+                manager->threads ? "http client" : "event loop"
+            );
+        }
+    }
+
+    stop_shard_groups(manager);
+
+    return success;
+}
+
+/* for payloads that apply to the whole session, e.g. presence updates */
+bool shard_manager_send(discord_shard_manager *manager, discord_gateway_opcodes op, json_object *data){
+    if (!manager){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] shard_manager_send() - manager is NULL\n",
+            __FILE__
+        );
+
+        return false;
+    }
+
+    if (!manager->threads){
+        return send_group(&manager->groups[0], op, data);
+    }
+
+    bool success = true;
+
+    for (int index = 0; index < manager->group_count && index < manager->shard_count; ++index){
+        if (!queue_group_command(&manager->groups[index], op, data)){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] shard_manager_send() - queue_group_command call failed for group %d\n",
+                __FILE__,
+                index
+            );
+
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+discord_gateway *shard_manager_get_shard(const discord_shard_manager *manager, snowflake guildid){
+    if (!manager){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] shard_manager_get_shard() - manager is NULL\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+    else if (!manager->shard_count){
+        log_write(
+            logger,
+            LOG_WARNING,
+            "[%s] shard_manager_get_shard() - shards are not connected\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    return manager->shards[(guildid >> 22) % manager->shard_count];
+}
+
+/*
+ * claims the next IDENTIFY slot of the shard's bucket (shard_id % max_concurrency)
+ * and returns how many microseconds the shard has to wait for it
+ */
+lws_usec_t shard_manager_reserve_identify(discord_shard_manager *manager, int shardid){
+    if (!manager || !manager->identify_at){
+        return 0;
+    }
+
+    pthread_mutex_lock(&manager->identify_lock);
+
+    lws_usec_t *slot = &manager->identify_at[shardid % manager->max_concurrency];
+    lws_usec_t now = lws_now_usecs();
+    lws_usec_t at = *slot > now ? *slot : now;
+
+    *slot = at + DISCORD_GATEWAY_IDENTIFY_INTERVAL * LWS_US_PER_SEC;
+
+    pthread_mutex_unlock(&manager->identify_lock);
+
+    return at - now;
+}
+
+void shard_manager_free(discord_shard_manager *manager){
+    if (!manager){
+        log_write(
+            logger,
+            LOG_DEBUG,
+            "[%s] shard_manager_free() - manager is NULL\n",
+            __FILE__
+        );
+
+        return;
+    }
+
+    stop_shard_groups(manager);
+
+    for (int index = 0; index < manager->shard_count; ++index){
+        if (manager->shards[index]){
+            manager->shards[index]->reconnect = false;
+        }
+    }
+
+    /* closes the shards' connections while they are still alive */
+    free_shard_groups(manager);
+    free_shards(manager);
+
+    pthread_mutex_destroy(&manager->identify_lock);
+
+    free(manager->url);
+    free(manager);
+}
@@ -0,0 +1,85 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "gateway.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+/*
+ * runs every shard's gateway connection, all of them feeding the same state
+ * and event callbacks
+ *
+ * shards 0 or DISCORD_GATEWAY_RECOMMENDED_SHARDS uses the count /gateway/bot
+ * recommends, the gateway options are applied to every shard
+ *
+ * threads 0 services every shard on one lws context from the thread calling
+ * shard_manager_run_loop, otherwise shard_id % threads picks the group each
+ * shard is pinned to, every group running its own lws context on a worker
+ * thread; the state must then be thread_safe and the calling thread drives
+ * the http client instead
+ */
+typedef struct discord_shard_manager_options {
+    int shards;
+    int threads;
+    const discord_gateway_options *gateway;
+} discord_shard_manager_options;
+
+typedef struct discord_shard_command discord_shard_command;
+
+typedef struct discord_shard_group {
+    discord_shard_manager *manager;
+    int index;
+    discord_gateway_loop *loop;
+
+    /* shards are connected max_concurrency at a time, one wave per identify interval */
+    int wave;
+    lws_sorted_usec_list_t connect_timer;
+
+    /* requests from other threads, run by the worker whenever lws_service returns */
+    pthread_t thread;
+    bool started;
+    atomic_bool stop;
+    atomic_bool disconnect;
+    pthread_mutex_t lock;
+    discord_shard_command *commands;
+} discord_shard_group;
+
+typedef struct discord_shard_manager {
+    discord_state *state;
+    discord_gateway_options gateway_options;
+
+    /* from /gateway/bot */
+    char *url;
+    int recommended_shards;
+    int max_concurrency;
+    int remaining_session_starts;
+
+    int requested_shards;
+    int shard_count;
+    discord_gateway **shards;
+
+    int threads;
+    int group_count;
+    discord_shard_group *groups;
+
+    /* earliest time the next IDENTIFY may be sent, one per rate limit bucket */
+    pthread_mutex_t identify_lock;
+    lws_usec_t *identify_at;
+} discord_shard_manager;
+
+discord_shard_manager *shard_manager_init(discord_state *, const discord_shard_manager_options *);
+
+bool shard_manager_connect(discord_shard_manager *);
+void shard_manager_disconnect(discord_shard_manager *);
+bool shard_manager_run_loop(discord_shard_manager *);
+
+bool shard_manager_send(discord_shard_manager *, discord_gateway_opcodes, json_object *);
+
+/* with threads, only use the shard from its group's thread (e.g. its event callbacks) */
+discord_gateway *shard_manager_get_shard(const discord_shard_manager *, snowflake);
+lws_usec_t shard_manager_reserve_identify(discord_shard_manager *, int);
+
+void shard_manager_free(discord_shard_manager *);
+
+#endif
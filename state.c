@@ -1,3 +1,5 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "state.h"
 
 static const logctx *logger = NULL;
@@ -12,6 +14,46 @@ static const char *statuses[] = {
     NULL
 };
 
+/* state_lock calls made by the current thread, the lock is recursive */
+static _Thread_local unsigned int held_locks = 0;
+
+static void lock_state(discord_state *state){
+    if (state && state->thread_safe){
+        pthread_mutex_lock(&state->lock);
+
+        held_locks += 1;
+    }
+}
+
+static void unlock_state(discord_state *state){
+    if (state && state->thread_safe){
+        held_locks -= 1;
+
+        pthread_mutex_unlock(&state->lock);
+    }
+}
+
+/* cached objects can be freed or updated by other threads unless the lock is held */
+static bool is_state_locked(const discord_state *state){
+    return !state || !state->thread_safe || held_locks;
+}
+
+static bool init_state_lock(discord_state *state){
+    pthread_mutexattr_t attr;
+
+    if (pthread_mutexattr_init(&attr)){
+        return false;
+    }
+
+    /* setters call the public getters, callers may hold the lock around both */
+    bool success = !pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE)
+        && !pthread_mutex_init(&state->lock, &attr);
+
+    pthread_mutexattr_destroy(&attr);
+
+    return success;
+}
+
 discord_state *state_init(const char *token, const discord_state_options *opts){
     if (!token){
         log_write(
@@ -46,6 +88,23 @@ discord_state *state_init(const char *token, const discord_state_options *opts){
         state->max_messages = opts->max_messages;
     }
 
+    if (opts && opts->thread_safe){
+        if (!init_state_lock(state)){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] state_init() - init_state_lock call failed\n",
+                __FILE__
+            );
+
+            free(state);
+
+            return NULL;
+        }
+
+        state->thread_safe = true;
+    }
+
     state->user_pointer = NULL;
 
     state->token = string_duplicate(token);
@@ -78,7 +137,22 @@ discord_state *state_init(const char *token, const discord_state_options *opts){
         return NULL;
     }
 
-    state->http = discord_http_init(state->token, NULL);
+    discord_http_options hopts = {0};
+
+    if (opts && opts->http){
+        hopts = *opts->http;
+    }
+
+    if (!hopts.log){
+        hopts.log = state->log;
+    }
+
+    /* event callbacks on other threads issue requests */
+    if (state->thread_safe){
+        hopts.thread_safe = true;
+    }
+
+    state->http = discord_http_init(state->token, &hopts);
 
     if (!state->http){
         log_write(
@@ -108,6 +182,21 @@ discord_state *state_init(const char *token, const discord_state_options *opts){
         return NULL;
     }
 
+    state->retired = list_init();
+
+    if (!state->retired){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] state_init() - retired list initialization failed\n",
+            __FILE__
+        );
+
+        state_free(state);
+
+        return NULL;
+    }
+
     state->emojis = map_init();
 
     if (!state->emojis){
@@ -142,6 +231,16 @@ discord_state *state_init(const char *token, const discord_state_options *opts){
 }
 
 json_object *state_get_presence(discord_state *state){
+    if (!is_state_locked(state)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] state_get_presence() - state_lock is not held by the calling thread\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
     if (!state){
         log_write(
             logger,
@@ -157,6 +256,16 @@ json_object *state_get_presence(discord_state *state){
 }
 
 const char *state_get_presence_string(discord_state *state){
+    if (!is_state_locked(state)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] state_get_presence_string() - state_lock is not held by the calling thread\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
     if (!state){
         log_write(
             logger,
@@ -171,12 +280,12 @@ const char *state_get_presence_string(discord_state *state){
     return state->presence ? json_object_to_json_string(state->presence) : "null";
 }
 
-bool state_set_presence(discord_state *state, const discord_presence *presence){
+static bool set_state_presence(discord_state *state, const discord_presence *presence){
     if (!state){
         log_write(
             logger,
             LOG_WARNING,
-            "[%s] state_set_presence() - state is NULL\n",
+            "[%s] set_state_presence() - state is NULL\n",
             __FILE__
         );
 
@@ -189,7 +298,7 @@ bool state_set_presence(discord_state *state, const discord_presence *presence){
             log_write(
                 logger,
                 LOG_ERROR,
-                "[%s] state_set_presence() - presence object initialization failed\n",
+                "[%s] set_state_presence() - presence object initialization failed\n",
                 __FILE__
             );
 
@@ -207,7 +316,7 @@ bool state_set_presence(discord_state *state, const discord_presence *presence){
             log_write(
                 logger,
                 LOG_ERROR,
-                "[%s] state_set_presence() - json_merge_objects call failed\n",
+                "[%s] set_state_presence() - json_merge_objects call failed\n",
                 __FILE__
             );
 
@@ -240,12 +349,12 @@ bool state_set_presence(discord_state *state, const discord_presence *presence){
     return success;
 }
 
-bool state_set_presence_since(discord_state *state, time_t since){
+static bool set_state_presence_since(discord_state *state, time_t since){
     if (!state){
         log_write(
             logger,
             LOG_WARNING,
-            "[%s] state_set_presence_since() - state is NULL\n",
+            "[%s] set_state_presence_since() - state is NULL\n",
             __FILE__
         );
 
@@ -258,7 +367,7 @@ bool state_set_presence_since(discord_state *state, time_t since){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] state_set_presence_since() - since object initialization failed\n",
+            "[%s] set_state_presence_since() - since object initialization failed\n",
             __FILE__
         );
 
@@ -269,7 +378,7 @@ bool state_set_presence_since(discord_state *state, time_t since){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] state_set_presence_since() - json_object_object_add call failed for since\n",
+            "[%s] set_state_presence_since() - json_object_object_add call failed for since\n",
             __FILE__
         );
 
@@ -281,12 +390,12 @@ bool state_set_presence_since(discord_state *state, time_t since){
     return true;
 }
 
-bool state_set_presence_activities(discord_state *state, const list *activities){
+static bool set_state_presence_activities(discord_state *state, const list *activities){
     if (!state){
         log_write(
             logger,
             LOG_WARNING,
-            "[%s] state_set_presence_activities() - state is NULL\n",
+            "[%s] set_state_presence_activities() - state is NULL\n",
             __FILE__
         );
 
@@ -300,7 +409,7 @@ bool state_set_presence_activities(discord_state *state, const list *activities)
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] state_set_presence_activities() - activities object initialization failed\n",
+            "[%s] set_state_presence_activities() - activities object initialization failed\n",
             __FILE__
         );
 
@@ -315,7 +424,7 @@ bool state_set_presence_activities(discord_state *state, const list *activities)
             log_write(
                 logger,
                 LOG_ERROR,
-                "[%s] state_set_presence_activities() - json_object_array_add call failed\n",
+                "[%s] set_state_presence_activities() - json_object_array_add call failed\n",
                 __FILE__
             );
 
@@ -330,7 +439,7 @@ bool state_set_presence_activities(discord_state *state, const list *activities)
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] state_set_presence_activities() - json_object_object_add call failed\n",
+            "[%s] set_state_presence_activities() - json_object_object_add call failed\n",
             __FILE__
         );
 
@@ -342,12 +451,12 @@ bool state_set_presence_activities(discord_state *state, const list *activities)
     return true;
 }
 
-bool state_set_presence_status(discord_state *state, const char *status){
+static bool set_state_presence_status(discord_state *state, const char *status){
     if (!state){
         log_write(
             logger,
             LOG_WARNING,
-            "[%s] state_set_presence_status() - state is NULL\n",
+            "[%s] set_state_presence_status() - state is NULL\n",
             __FILE__
         );
 
@@ -371,7 +480,7 @@ bool state_set_presence_status(discord_state *state, const char *status){
             log_write(
                 logger,
                 LOG_WARNING,
-                "[%s] state_set_presence_status() - invalid status %s -- valid statuses are offline, invisible, idle, dnd, online\n",
+                "[%s] set_state_presence_status() - invalid status %s -- valid statuses are offline, invisible, idle, dnd, online\n",
                 __FILE__,
                 status
             );
@@ -385,7 +494,7 @@ bool state_set_presence_status(discord_state *state, const char *status){
             log_write(
                 logger,
                 LOG_ERROR,
-                "[%s] state_set_presence_status() - status object initialization failed\n",
+                "[%s] set_state_presence_status() - status object initialization failed\n",
                 __FILE__
             );
 
@@ -397,7 +506,7 @@ bool state_set_presence_status(discord_state *state, const char *status){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] state_set_presence_status() - json_object_object_add call failed\n",
+            "[%s] set_state_presence_status() - json_object_object_add call failed\n",
             __FILE__
         );
 
@@ -409,12 +518,12 @@ bool state_set_presence_status(discord_state *state, const char *status){
     return true;
 }
 
-bool state_set_presence_afk(discord_state *state, bool afk){
+static bool set_state_presence_afk(discord_state *state, bool afk){
     if (!state){
         log_write(
             logger,
             LOG_WARNING,
-            "[%s] state_set_presence_afk() - state is NULL\n",
+            "[%s] set_state_presence_afk() - state is NULL\n",
             __FILE__
         );
 
@@ -427,7 +536,7 @@ bool state_set_presence_afk(discord_state *state, bool afk){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] state_set_presence_afk() - afk object initialization failed\n",
+            "[%s] set_state_presence_afk() - afk object initialization failed\n",
             __FILE__
         );
 
@@ -438,7 +547,7 @@ bool state_set_presence_afk(discord_state *state, bool afk){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] state_set_presence_afk() - json_object_object_add call failed\n",
+            "[%s] set_state_presence_afk() - json_object_object_add call failed\n",
             __FILE__
         );
 
@@ -448,12 +557,126 @@ bool state_set_presence_afk(discord_state *state, bool afk){
     return true;
 }
 
-const discord_message *state_set_message(discord_state *state, json_object *data, bool update){
+/* removes a cached message, while callbacks hold pinned objects it is only freed once they return */
+static void retire_state_message(discord_state *state, size_t index){
+    if (!state->pins){
+        list_remove(state->messages, index);
+
+        return;
+    }
+
+    list_item item = {0};
+
+    if (!list_pop(state->messages, index, &item)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] retire_state_message() - list_pop call failed\n",
+            __FILE__
+        );
+
+        return;
+    }
+
+    list_item retired = {0};
+    retired.type = L_TYPE_GENERIC;
+    retired.size = sizeof(discord_message);
+    retired.data = item.data;
+    retired.generic_free = message_free;
+
+    /* a pinned message may still be read, leaking it is the safe failure */
+    if (!list_append(state->retired, &retired)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] retire_state_message() - list_append call failed, leaking message\n",
+            __FILE__
+        );
+    }
+}
+
+/* updates a pinned message by caching an updated copy in its place, the original is retired */
+static discord_message *replace_state_message(discord_state *state, discord_message *cached, json_object *data){
+    json_object *raw = NULL;
+
+    if (json_object_deep_copy(cached->raw_object, &raw, NULL)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] replace_state_message() - json_object_deep_copy call failed\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    if (!json_merge_objects(data, raw)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] replace_state_message() - json_merge_objects call failed\n",
+            __FILE__
+        );
+
+        json_object_put(raw);
+
+        return NULL;
+    }
+
+    discord_message *message = message_init(state, raw);
+
+    json_object_put(raw);
+
+    if (!message){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] replace_state_message() - message initialization failed\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
+
+    list_item item = {0};
+    item.type = L_TYPE_GENERIC;
+    item.size = sizeof(*message);
+    item.data = message;
+    item.generic_free = message_free;
+
+    if (!list_append(state->messages, &item)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] replace_state_message() - list_append call failed\n",
+            __FILE__
+        );
+
+        message_free(message);
+
+        return NULL;
+    }
+
+    /* caching a referenced message may have moved or evicted the original */
+    size_t messageslen = list_get_length(state->messages);
+
+    for (size_t index = 0; index < messageslen; ++index){
+        if (list_get_generic(state->messages, index) == cached){
+            retire_state_message(state, index);
+
+            break;
+        }
+    }
+
+    return message;
+}
+
+static const discord_message *set_state_message(discord_state *state, json_object *data, bool update){
     if (!state){
         log_write(
             logger,
             LOG_WARNING,
-            "[%s] state_set_message() - state is NULL\n",
+            "[%s] set_state_message() - state is NULL\n",
             __FILE__
         );
 
@@ -463,7 +686,7 @@ const discord_message *state_set_message(discord_state *state, json_object *data
         log_write(
             logger,
             LOG_WARNING,
-            "[%s] state_set_message() - data is NULL\n",
+            "[%s] set_state_message() - data is NULL\n",
             __FILE__
         );
 
@@ -478,7 +701,7 @@ const discord_message *state_set_message(discord_state *state, json_object *data
         log_write(
             logger,
             LOG_WARNING,
-            "[%s] state_set_message() - failed to get id from data: %s\n",
+            "[%s] set_state_message() - failed to get id from data: %s\n",
             __FILE__,
             json_object_to_json_string(data)
         );
@@ -493,7 +716,7 @@ const discord_message *state_set_message(discord_state *state, json_object *data
         log_write(
             logger,
             LOG_WARNING,
-            "[%s] state_set_message() - snowflake_from_string call failed for id: %s\n",
+            "[%s] set_state_message() - snowflake_from_string call failed for id: %s\n",
             __FILE__,
             idstr
         );
@@ -517,13 +740,27 @@ const discord_message *state_set_message(discord_state *state, json_object *data
 
     discord_message *message = NULL;
 
-    if (cached){
+    if (cached && update && state->pins){
+        message = replace_state_message(state, cached, data);
+
+        if (!message){
+            log_write(
+                logger,
+                LOG_ERROR,
+                "[%s] set_state_message() - replace_state_message call failed\n",
+                __FILE__
+            );
+
+            return NULL;
+        }
+    }
+    else if (cached){
         if (update){
             if (!message_update(cached, data)){
                 log_write(
                     logger,
                     LOG_ERROR,
-                    "[%s] state_set_message() - message_update call failed\n",
+                    "[%s] set_state_message() - message_update call failed\n",
                     __FILE__
                 );
 
@@ -542,7 +779,7 @@ const discord_message *state_set_message(discord_state *state, json_object *data
             log_write(
                 logger,
                 LOG_ERROR,
-                "[%s] state_set_message() - message initialization failed\n",
+                "[%s] set_state_message() - message initialization failed\n",
                 __FILE__
             );
 
@@ -559,7 +796,7 @@ const discord_message *state_set_message(discord_state *state, json_object *data
             log_write(
                 logger,
                 LOG_ERROR,
-                "[%s] state_set_message() - list_append call failed\n",
+                "[%s] set_state_message() - list_append call failed\n",
                 __FILE__
             );
 
@@ -569,7 +806,7 @@ const discord_message *state_set_message(discord_state *state, json_object *data
         }
 
         if (state->max_messages && list_get_length(state->messages) == state->max_messages){
-            list_remove(state->messages, 0);
+            retire_state_message(state, 0);
         }
     }
 
@@ -577,6 +814,16 @@ const discord_message *state_set_message(discord_state *state, json_object *data
 }
 
 const discord_message *state_get_message(discord_state *state, snowflake id){
+    if (!is_state_locked(state)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] state_get_message() - state_lock is not held by the calling thread\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
     if (!state){
         log_write(
             logger,
@@ -615,12 +862,12 @@ const discord_message *state_get_message(discord_state *state, snowflake id){
     return message;
 }
 
-const discord_emoji *state_set_emoji(discord_state *state, json_object *data){
+static const discord_emoji *set_state_emoji(discord_state *state, json_object *data){
     if (!state){
         log_write(
             logger,
             LOG_WARNING,
-            "[%s] state_set_emoji() - state is NULL\n",
+            "[%s] set_state_emoji() - state is NULL\n",
             __FILE__
         );
 
@@ -630,7 +877,7 @@ const discord_emoji *state_set_emoji(discord_state *state, json_object *data){
         log_write(
             logger,
             LOG_WARNING,
-            "[%s] state_set_emoji() - data is NULL\n",
+            "[%s] set_state_emoji() - data is NULL\n",
             __FILE__
         );
 
@@ -645,7 +892,7 @@ const discord_emoji *state_set_emoji(discord_state *state, json_object *data){
         log_write(
             logger,
             LOG_WARNING,
-            "[%s] state_set_emoji() - failed to get id from data: %s\n",
+            "[%s] set_state_emoji() - failed to get id from data: %s\n",
             __FILE__,
             json_object_to_json_string(data)
         );
@@ -660,7 +907,7 @@ const discord_emoji *state_set_emoji(discord_state *state, json_object *data){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] state_set_emoji() - snowflake_from_string call failed for id: %s\n",
+            "[%s] set_state_emoji() - snowflake_from_string call failed for id: %s\n",
             __FILE__,
             idstr
         );
@@ -680,7 +927,7 @@ const discord_emoji *state_set_emoji(discord_state *state, json_object *data){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] state_set_emoji() - emoji initialization failed\n",
+            "[%s] set_state_emoji() - emoji initialization failed\n",
             __FILE__
         );
 
@@ -702,7 +949,7 @@ const discord_emoji *state_set_emoji(discord_state *state, json_object *data){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] state_set_emoji() - map_set call for emojis failed\n",
+            "[%s] set_state_emoji() - map_set call for emojis failed\n",
             __FILE__
         );
 
@@ -715,6 +962,16 @@ const discord_emoji *state_set_emoji(discord_state *state, json_object *data){
 }
 
 const discord_emoji *state_get_emoji(discord_state *state, snowflake id){
+    if (!is_state_locked(state)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] state_get_emoji() - state_lock is not held by the calling thread\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
     if (!state){
         log_write(
             logger,
@@ -743,12 +1000,12 @@ const discord_emoji *state_get_emoji(discord_state *state, snowflake id){
     return map_get_generic(state->emojis, idsize, &id);
 }
 
-const discord_user *state_set_user(discord_state *state, json_object *data){
+static const discord_user *set_state_user(discord_state *state, json_object *data){
     if (!state){
         log_write(
             logger,
             LOG_WARNING,
-            "[%s] state_set_user() - state is NULL\n",
+            "[%s] set_state_user() - state is NULL\n",
             __FILE__
         );
 
@@ -758,7 +1015,7 @@ const discord_user *state_set_user(discord_state *state, json_object *data){
         log_write(
             logger,
             LOG_WARNING,
-            "[%s] state_set_user() - data is NULL\n",
+            "[%s] set_state_user() - data is NULL\n",
             __FILE__
         );
 
@@ -773,7 +1030,7 @@ const discord_user *state_set_user(discord_state *state, json_object *data){
         log_write(
             logger,
             LOG_WARNING,
-            "[%s] state_set_user() - failed to get id from data: %s\n",
+            "[%s] set_state_user() - failed to get id from data: %s\n",
             __FILE__,
             json_object_to_json_string(data)
         );
@@ -788,7 +1045,7 @@ const discord_user *state_set_user(discord_state *state, json_object *data){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] state_set_user() - snowflake_from_string call failed for id: %s\n",
+            "[%s] set_state_user() - snowflake_from_string call failed for id: %s\n",
             __FILE__,
             idstr
         );
@@ -808,7 +1065,7 @@ const discord_user *state_set_user(discord_state *state, json_object *data){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] state_set_user() - user initialization failed\n",
+            "[%s] set_state_user() - user initialization failed\n",
             __FILE__
         );
 
@@ -830,7 +1087,7 @@ const discord_user *state_set_user(discord_state *state, json_object *data){
         log_write(
             logger,
             LOG_ERROR,
-            "[%s] state_set_user() - map_set call for users failed\n",
+            "[%s] set_state_user() - map_set call for users failed\n",
             __FILE__
         );
 
@@ -843,6 +1100,16 @@ const discord_user *state_set_user(discord_state *state, json_object *data){
 }
 
 const discord_user *state_get_user(discord_state *state, snowflake id){
+    if (!is_state_locked(state)){
+        log_write(
+            logger,
+            LOG_ERROR,
+            "[%s] state_get_user() - state_lock is not held by the calling thread\n",
+            __FILE__
+        );
+
+        return NULL;
+    }
     if (!state){
         log_write(
             logger,
@@ -871,6 +1138,118 @@ const discord_user *state_get_user(discord_state *state, snowflake id){
     return map_get_generic(state->users, idsize, &id);
 }
 
+bool state_set_presence(discord_state *state, const discord_presence *presence){
+    lock_state(state);
+
+    bool success = set_state_presence(state, presence);
+
+    unlock_state(state);
+
+    return success;
+}
+
+bool state_set_presence_since(discord_state *state, time_t since){
+    lock_state(state);
+
+    bool success = set_state_presence_since(state, since);
+
+    unlock_state(state);
+
+    return success;
+}
+
+bool state_set_presence_activities(discord_state *state, const list *activities){
+    lock_state(state);
+
+    bool success = set_state_presence_activities(state, activities);
+
+    unlock_state(state);
+
+    return success;
+}
+
+bool state_set_presence_status(discord_state *state, const char *status){
+    lock_state(state);
+
+    bool success = set_state_presence_status(state, status);
+
+    unlock_state(state);
+
+    return success;
+}
+
+bool state_set_presence_afk(discord_state *state, bool afk){
+    lock_state(state);
+
+    bool success = set_state_presence_afk(state, afk);
+
+    unlock_state(state);
+
+    return success;
+}
+
+const discord_message *state_set_message(discord_state *state, json_object *data, bool update){
+    lock_state(state);
+
+    const discord_message *output = set_state_message(state, data, update);
+
+    unlock_state(state);
+
+    return output;
+}
+
+const discord_emoji *state_set_emoji(discord_state *state, json_object *data){
+    lock_state(state);
+
+    const discord_emoji *output = set_state_emoji(state, data);
+
+    unlock_state(state);
+
+    return output;
+}
+
+const discord_user *state_set_user(discord_state *state, json_object *data){
+    lock_state(state);
+
+    const discord_user *output = set_state_user(state, data);
+
+    unlock_state(state);
+
+    return output;
+}
+
+void state_lock(discord_state *state){
+    lock_state(state);
+}
+
+void state_unlock(discord_state *state){
+    unlock_state(state);
+}
+
+void state_pin(discord_state *state){
+    lock_state(state);
+
+    if (state){
+        state->pins += 1;
+    }
+
+    unlock_state(state);
+}
+
+void state_unpin(discord_state *state){
+    lock_state(state);
+
+    if (state && state->pins){
+        state->pins -= 1;
+
+        if (!state->pins){
+            list_empty(state->retired);
+        }
+    }
+
+    unlock_state(state);
+}
+
 void state_free(discord_state *state){
     if (!state){
         log_write(
@@ -888,9 +1267,14 @@ void state_free(discord_state *state){
     json_object_put(state->presence);
 
     list_free(state->messages);
+    list_free(state->retired);
     map_free(state->emojis);
     map_free(state->users);
 
+    if (state->thread_safe){
+        pthread_mutex_destroy(&state->lock);
+    }
+
     free(state->token);
     free(state);
 }
@@ -9,14 +9,19 @@
 
 #include "snowflake.h"
 
+#include <pthread.h>
+
 typedef struct discord_activity discord_activity;
 typedef struct discord_application discord_application;
 typedef struct discord_channel discord_channel;
 typedef struct discord_embed discord_embed;
 typedef struct discord_emoji discord_emoji;
 typedef struct discord_http discord_http;
+typedef struct discord_http_options discord_http_options;
+typedef struct discord_http_response discord_http_response;
 typedef struct discord_member discord_member;
 typedef struct discord_message discord_message;
+typedef struct discord_message_iterator discord_message_iterator;
 typedef struct discord_message_reply discord_message_reply;
 typedef struct discord_state discord_state;
 typedef struct discord_team discord_team;
@@ -40,14 +45,25 @@ typedef struct discord_user discord_user;
 #define DISCORD_LIBRARY_VERSION "0"
 #define DISCORD_LIBRARY_OS "Linux"
 
+/* overridable at build time, e.g. -DDISCORD_API='"http://127.0.0.1:8080/api/v10"' */
+#ifndef DISCORD_API
 #define DISCORD_API "https://discord.com/api/v10"
+#endif
+
 #define DISCORD_CDN "https://cdn.discordapp.com"
 #define DISCORD_USER_AGENT ("DiscordBot (" DISCORD_LIBRARY_URL " " DISCORD_LIBRARY_VERSION ")")
 
 #define DISCORD_GATEWAY_VERSION 9
 #define DISCORD_GATEWAY_PORT 443
-#define DISCORD_GATEWAY_ENCODING "json"
+#define DISCORD_GATEWAY_ENCODING_JSON "json"
+#define DISCORD_GATEWAY_ENCODING_ETF "etf"
+#define DISCORD_GATEWAY_COMPRESSION "zlib-stream"
+#define DISCORD_GATEWAY_INFLATE_CHUNK 16384
 #define DISCORD_GATEWAY_IDENTIFY_LIMIT 1000
+#define DISCORD_GATEWAY_IDENTIFY_INTERVAL 5
+#define DISCORD_GATEWAY_RECONNECT_DELAY 3
+#define DISCORD_GATEWAY_RECOMMENDED_SHARDS -1
+#define DISCORD_GATEWAY_EVENT_SLOTS 256
 #define DISCORD_GATEWAY_HEARTBEAT_JITTER 0.5
 #define DISCORD_GATEWAY_RATE_LIMIT_INTERVAL 60
 #define DISCORD_GATEWAY_RATE_LIMIT_COUNT 110
@@ -89,6 +105,12 @@ typedef struct discord_state_options {
     discord_gateway_intents intent;
 
     size_t max_messages;
+
+    /* NULL for the defaults, log falls back to the state's */
+    const discord_http_options *http;
+
+    /* locks the caches for shards running on worker threads, implies a thread_safe http client */
+    bool thread_safe;
 } discord_state_options;
 
 typedef struct discord_state {
@@ -106,8 +128,16 @@ typedef struct discord_state {
     list *messages;
     size_t max_messages;
 
+    /* event callbacks in progress, messages they may hold are retired instead of freed */
+    unsigned int pins;
+    list *retired;
+
     map *emojis;
     map *users;
+
+    /* recursive, held while gateway events update the caches */
+    bool thread_safe;
+    pthread_mutex_t lock;
 } discord_state;
 
 discord_state *state_init(const char *, const discord_state_options *);
@@ -130,6 +160,22 @@ const discord_emoji *state_get_emoji(discord_state *, snowflake);
 const discord_user *state_set_user(discord_state *, json_object *);
 const discord_user *state_get_user(discord_state *, snowflake);
 
+/*
+ * with thread_safe, other shard threads may update or evict cached objects at
+ * any time, the getters fail unless the calling thread holds the lock and the
+ * objects they (and the setters) return stay valid only until it is released
+ *
+ * event callbacks run without the lock, their event data stays valid until
+ * they return since the state is pinned meanwhile, any other cached object
+ * still needs the lock
+ */
+void state_lock(discord_state *);
+void state_unlock(discord_state *);
+
+/* while pinned, evicted or updated messages are kept alive until the last state_unpin */
+void state_pin(discord_state *);
+void state_unpin(discord_state *);
+
 void state_free(discord_state *);
 
 #endif
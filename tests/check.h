@@ -0,0 +1,20 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* a failed check is reported and the test carries on, main returns CHECK_RESULT */
+static int check_failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)){ \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            check_failures += 1; \
+        } \
+    } while (0)
+
+#define CHECK_RESULT (check_failures ? EXIT_FAILURE : EXIT_SUCCESS)
+
+#endif
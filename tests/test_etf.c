@@ -0,0 +1,368 @@
+#include "check.h"
+
+#include "etf.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <zlib.h>
+
+/*
+ * etf_encode and etf_decode round trips, the encoder's choice of integer
+ * tags and the decoder's handling of truncated or malformed input
+ */
+
+static json_object *round_trip(json_object *obj){
+    size_t length = 0;
+    unsigned char *data = etf_encode(obj, 0, &length);
+
+    if (!data){
+        return NULL;
+    }
+
+    json_object *output = NULL;
+
+    if (!etf_decode(data, length, &output)){
+        output = NULL;
+    }
+
+    free(data);
+
+    return output;
+}
+
+static bool is_round_trip(const char *text){
+    json_object *obj = json_tokener_parse(text);
+
+    if (!obj){
+        return false;
+    }
+
+    json_object *output = round_trip(obj);
+    bool success = output && json_object_equal(obj, output);
+
+    json_object_put(obj);
+    json_object_put(output);
+
+    return success;
+}
+
+static bool is_integer_round_trip(int64_t value){
+    json_object *obj = json_object_new_int64(value);
+    json_object *output = round_trip(obj);
+
+    bool success = json_object_get_type(output) == json_type_int && json_object_get_int64(output) == value;
+
+    json_object_put(obj);
+    json_object_put(output);
+
+    return success;
+}
+
+static bool is_decodable(const unsigned char *data, size_t length){
+    json_object *output = NULL;
+
+    if (!etf_decode(data, length, &output)){
+        return false;
+    }
+
+    json_object_put(output);
+
+    return true;
+}
+
+/* the tag of the term following the version byte */
+static int get_encoded_tag(json_object *obj){
+    size_t length = 0;
+    unsigned char *data = etf_encode(obj, 0, &length);
+    int tag = data && length > 1 ? data[1] : -1;
+
+    free(data);
+    json_object_put(obj);
+
+    return tag;
+}
+
+static void test_round_trips(void){
+    CHECK(is_round_trip("{\"op\":0,\"d\":{\"id\":\"175928847299117063\",\"tts\":false}}"));
+    CHECK(is_round_trip("{\"op\":2,\"d\":{\"token\":\"abc\",\"intents\":513,\"shard\":[0,1]}}"));
+    CHECK(is_round_trip("[1,[2,[3,[]]],\"a\",{}]"));
+    CHECK(is_round_trip("{\"a\":null,\"b\":true,\"c\":false,\"d\":[null]}"));
+    CHECK(is_round_trip("{\"x\":0.5,\"y\":-1e300,\"z\":0.0}"));
+    CHECK(is_round_trip("[\"\",\"\\u00e9t\\u00e9\"]"));
+    CHECK(is_round_trip("[]"));
+    CHECK(is_round_trip("{}"));
+
+    /* nil at the top level decodes to NULL */
+    json_object *previous = json_object_new_object();
+    json_object *output = previous;
+
+    size_t length = 0;
+    unsigned char *data = etf_encode(NULL, 0, &length);
+
+    CHECK(data && etf_decode(data, length, &output) && !output);
+
+    free(data);
+    json_object_put(previous);
+
+    /* binaries keep embedded NULs */
+    json_object *obj = json_object_new_string_len("a\0b", 3);
+
+    output = round_trip(obj);
+
+    CHECK(output && json_object_get_string_len(output) == 3 && !memcmp(json_object_get_string(output), "a\0b", 3));
+
+    json_object_put(obj);
+    json_object_put(output);
+}
+
+static void test_integers(void){
+    const int64_t values[] = {
+        0,
+        1,
+        UINT8_MAX,
+        UINT8_MAX + 1,
+        -1,
+        INT32_MAX,
+        (int64_t)INT32_MAX + 1,
+        INT32_MIN,
+        (int64_t)INT32_MIN - 1,
+        175928847299117063,
+        INT64_MAX,
+        -INT64_MAX,
+        INT64_MIN
+    };
+
+    for (size_t index = 0; index < sizeof(values) / sizeof(*values); ++index){
+        CHECK(is_integer_round_trip(values[index]));
+    }
+
+    CHECK(get_encoded_tag(json_object_new_int64(UINT8_MAX)) == ETF_SMALL_INTEGER);
+    CHECK(get_encoded_tag(json_object_new_int64(UINT8_MAX + 1)) == ETF_INTEGER);
+    CHECK(get_encoded_tag(json_object_new_int64(-1)) == ETF_INTEGER);
+    CHECK(get_encoded_tag(json_object_new_int64(INT32_MIN)) == ETF_INTEGER);
+    CHECK(get_encoded_tag(json_object_new_int64((int64_t)INT32_MAX + 1)) == ETF_SMALL_BIG);
+    CHECK(get_encoded_tag(json_object_new_int64((int64_t)INT32_MIN - 1)) == ETF_SMALL_BIG);
+
+    /* unsigned values past INT64_MAX survive as well */
+    json_object *obj = json_object_new_uint64(UINT64_MAX);
+    json_object *output = round_trip(obj);
+
+    CHECK(output && json_object_get_uint64(output) == UINT64_MAX);
+
+    json_object_put(obj);
+    json_object_put(output);
+}
+
+static void test_bigs(void){
+    /* 9 bytes with a zero top byte still fit */
+    const unsigned char wide[] = {ETF_VERSION, ETF_SMALL_BIG, 9, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0};
+    const unsigned char overflow[] = {ETF_VERSION, ETF_SMALL_BIG, 9, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+    const unsigned char minimum[] = {ETF_VERSION, ETF_SMALL_BIG, 8, 1, 0, 0, 0, 0, 0, 0, 0, 0x80};
+    const unsigned char underflow[] = {ETF_VERSION, ETF_SMALL_BIG, 8, 1, 1, 0, 0, 0, 0, 0, 0, 0x80};
+    const unsigned char large[] = {ETF_VERSION, ETF_LARGE_BIG, 0, 0, 0, 2, 0, 0x34, 0x12};
+
+    json_object *output = NULL;
+
+    CHECK(etf_decode(wide, sizeof(wide), &output) && json_object_get_int64(output) == 1);
+
+    json_object_put(output);
+
+    CHECK(!is_decodable(overflow, sizeof(overflow)));
+
+    output = NULL;
+
+    CHECK(etf_decode(minimum, sizeof(minimum), &output) && json_object_get_int64(output) == INT64_MIN);
+
+    json_object_put(output);
+
+    CHECK(!is_decodable(underflow, sizeof(underflow)));
+
+    output = NULL;
+
+    CHECK(etf_decode(large, sizeof(large), &output) && json_object_get_int64(output) == 0x1234);
+
+    json_object_put(output);
+}
+
+static void test_atoms(void){
+    const unsigned char atomtrue[] = {ETF_VERSION, ETF_SMALL_ATOM_UTF8, 4, 't', 'r', 'u', 'e'};
+    const unsigned char atomnil[] = {ETF_VERSION, ETF_ATOM, 0, 3, 'n', 'i', 'l'};
+    const unsigned char atomother[] = {ETF_VERSION, ETF_SMALL_ATOM, 3, 'f', 'o', 'o'};
+
+    json_object *output = NULL;
+
+    CHECK(etf_decode(atomtrue, sizeof(atomtrue), &output) && json_object_get_type(output) == json_type_boolean && json_object_get_boolean(output));
+
+    json_object_put(output);
+
+    output = json_object_new_object();
+
+    json_object *previous = output;
+
+    CHECK(etf_decode(atomnil, sizeof(atomnil), &output) && !output);
+
+    json_object_put(previous);
+
+    output = NULL;
+
+    CHECK(etf_decode(atomother, sizeof(atomother), &output) && json_object_get_type(output) == json_type_string && !strcmp(json_object_get_string(output), "foo"));
+
+    json_object_put(output);
+}
+
+static void test_malformed(void){
+    const unsigned char version[] = {ETF_VERSION};
+    const unsigned char badversion[] = {ETF_VERSION - 1, ETF_SMALL_INTEGER, 1};
+    const unsigned char trailing[] = {ETF_VERSION, ETF_SMALL_INTEGER, 1, 0};
+    const unsigned char badtag[] = {ETF_VERSION, 0};
+    const unsigned char toolong[] = {ETF_VERSION, ETF_LIST, 0xFF, 0xFF, 0xFF, 0xFF, ETF_NIL};
+    const unsigned char improper[] = {ETF_VERSION, ETF_LIST, 0, 0, 0, 1, ETF_SMALL_INTEGER, 1, ETF_SMALL_INTEGER, 2};
+    const unsigned char binary[] = {ETF_VERSION, ETF_BINARY, 0, 0, 0, 4, 'a', 'b', 'c'};
+
+    json_object *output = NULL;
+
+    CHECK(!etf_decode(NULL, 0, &output));
+    CHECK(!etf_decode(version, 0, &output));
+    CHECK(!is_decodable(version, sizeof(version)));
+    CHECK(!is_decodable(badversion, sizeof(badversion)));
+    CHECK(!is_decodable(trailing, sizeof(trailing)));
+    CHECK(!is_decodable(badtag, sizeof(badtag)));
+    CHECK(!is_decodable(toolong, sizeof(toolong)));
+    CHECK(!is_decodable(improper, sizeof(improper)));
+    CHECK(!is_decodable(binary, sizeof(binary)));
+
+    /* every strict prefix of a valid term is refused */
+    json_object *obj = json_tokener_parse("{\"op\":0,\"s\":42,\"d\":{\"id\":\"1\",\"n\":[1,256,4294967296,0.25,true,null]}}");
+
+    size_t length = 0;
+    unsigned char *data = etf_encode(obj, 0, &length);
+
+    CHECK(data && is_decodable(data, length));
+
+    for (size_t prefix = 0; data && prefix < length; ++prefix){
+        CHECK(!is_decodable(data, prefix));
+    }
+
+    free(data);
+    json_object_put(obj);
+}
+
+/* an integer nested in depth arrays, either as json or as ETF bytes */
+static json_object *create_nested(size_t depth){
+    json_object *obj = json_object_new_int(0);
+
+    for (size_t index = 0; index < depth; ++index){
+        json_object *array = json_object_new_array();
+
+        json_object_array_add(array, obj);
+
+        obj = array;
+    }
+
+    return obj;
+}
+
+static size_t write_nested(unsigned char *data, size_t depth){
+    size_t length = 0;
+
+    data[length++] = ETF_VERSION;
+
+    for (size_t index = 0; index < depth; ++index){
+        const unsigned char list[] = {ETF_LIST, 0, 0, 0, 1};
+
+        memcpy(data + length, list, sizeof(list));
+        length += sizeof(list);
+    }
+
+    data[length++] = ETF_SMALL_INTEGER;
+    data[length++] = 0;
+
+    memset(data + length, ETF_NIL, depth);
+
+    return length + depth;
+}
+
+static void test_depth(void){
+    unsigned char data[(ETF_MAX_DEPTH + 1) * 6 + 3];
+
+    CHECK(is_decodable(data, write_nested(data, ETF_MAX_DEPTH)));
+    CHECK(!is_decodable(data, write_nested(data, ETF_MAX_DEPTH + 1)));
+
+    json_object *obj = create_nested(ETF_MAX_DEPTH);
+    size_t length = 0;
+    unsigned char *encoded = etf_encode(obj, 0, &length);
+
+    CHECK(encoded);
+
+    free(encoded);
+    json_object_put(obj);
+
+    obj = create_nested(ETF_MAX_DEPTH + 1);
+    encoded = etf_encode(obj, 0, &length);
+
+    CHECK(!encoded);
+
+    free(encoded);
+    json_object_put(obj);
+}
+
+static void test_compressed(void){
+    json_object *obj = json_tokener_parse("{\"t\":\"READY\",\"d\":{\"v\":9,\"guilds\":[]}}");
+
+    size_t length = 0;
+    unsigned char *term = etf_encode(obj, 0, &length);
+
+    unsigned char data[512] = {ETF_VERSION, ETF_COMPRESSED};
+    uLongf datalen = sizeof(data) - 6;
+
+    CHECK(term && compress(data + 6, &datalen, term + 1, length - 1) == Z_OK);
+
+    for (size_t index = 0; index < 4; ++index){
+        data[2 + index] = (length - 1) >> (24 - index * 8) & 0xFF;
+    }
+
+    json_object *output = NULL;
+
+    CHECK(etf_decode(data, datalen + 6, &output) && json_object_equal(obj, output));
+
+    json_object_put(output);
+
+    /* the stated length has to match what inflates */
+    data[5] += 1;
+
+    CHECK(!is_decodable(data, datalen + 6));
+
+    free(term);
+    json_object_put(obj);
+}
+
+static void test_offset(void){
+    json_object *obj = json_tokener_parse("{\"op\":1,\"d\":null}");
+
+    size_t length = 0;
+    unsigned char *data = etf_encode(obj, 16, &length);
+
+    json_object *output = NULL;
+
+    CHECK(data && data[16] == ETF_VERSION && etf_decode(data + 16, length, &output) && json_object_equal(obj, output));
+
+    CHECK(!etf_encode(obj, 0, NULL));
+
+    free(data);
+    json_object_put(obj);
+    json_object_put(output);
+}
+
+int main(void){
+    test_round_trips();
+    test_integers();
+    test_bigs();
+    test_atoms();
+    test_malformed();
+    test_depth();
+    test_compressed();
+    test_offset();
+
+    return CHECK_RESULT;
+}
@@ -0,0 +1,237 @@
+/* the helpers under test are static, http.c also sets the feature test macros */
+#include "http.c"
+
+#include "check.h"
+
+/*
+ * rate limit bucket keys and cache routes built from request paths,
+ * the bulk-delete planner behind discord_http_delete_messages and the
+ * histogram bucket math behind discord_http_stats
+ */
+
+#define TEST_DISCORD_EPOCH 1420070400000
+
+static bool is_bucket(discord_http_method method, const char *path, const char *expected){
+    char key[DISCORD_HTTP_BUCKET_KEY_LENGTH];
+
+    return create_request_bucket(method, path, key, sizeof(key)) && !strcmp(key, expected);
+}
+
+static bool is_template(const char *path, bool keepmajor, const char *expected){
+    char key[DISCORD_HTTP_BUCKET_KEY_LENGTH];
+
+    return write_route_template(path, keepmajor, key, sizeof(key)) && !strcmp(key, expected);
+}
+
+static bool is_cache_route(const char *path, const char *expected){
+    char route[DISCORD_HTTP_BUCKET_KEY_LENGTH];
+
+    return write_cache_route(path, route, sizeof(route)) && !strcmp(route, expected);
+}
+
+static void test_buckets(void){
+    CHECK(is_bucket(DISCORD_HTTP_GET, "/channels/123/messages/456", "GET /channels/123/messages/:id"));
+    CHECK(is_bucket(DISCORD_HTTP_DELETE, "/channels/123/messages/456", "DELETE /channels/123/messages/:id"));
+    CHECK(is_bucket(DISCORD_HTTP_POST, "/channels/123/messages/bulk-delete", "POST /channels/123/messages/bulk-delete"));
+    CHECK(is_bucket(DISCORD_HTTP_PATCH, "/guilds/1/members/2", "PATCH /guilds/1/members/:id"));
+    CHECK(is_bucket(DISCORD_HTTP_GET, "/guilds/1/members?limit=5&after=7", "GET /guilds/1/members"));
+    CHECK(is_bucket(DISCORD_HTTP_GET, "/users/@me", "GET /users/@me"));
+    CHECK(is_bucket(DISCORD_HTTP_GET, "/users/80351110224678912", "GET /users/:id"));
+    CHECK(is_bucket(DISCORD_HTTP_GET, "/gateway/bot", "GET /gateway/bot"));
+
+    /* every emoji shares the reaction bucket of its message */
+    CHECK(is_bucket(
+        DISCORD_HTTP_PUT,
+        "/channels/1/messages/2/reactions/%F0%9F%91%8D/@me",
+        "PUT /channels/1/messages/:id/reactions/:emoji/@me"
+    ));
+    CHECK(is_bucket(
+        DISCORD_HTTP_DELETE,
+        "/channels/1/messages/2/reactions/name:3/4",
+        "DELETE /channels/1/messages/:id/reactions/:emoji/:id"
+    ));
+
+    /* the webhook id is the major parameter, its token is not */
+    CHECK(is_bucket(DISCORD_HTTP_POST, "/webhooks/1/abc-DEF_123", "POST /webhooks/1/:token"));
+    CHECK(is_bucket(DISCORD_HTTP_PATCH, "/webhooks/1/abc/messages/2?wait=true", "PATCH /webhooks/1/:token/messages/:id"));
+
+    /* an id that is not the second segment is never major */
+    CHECK(is_template("/channels/123/messages", false, "/channels/:id/messages"));
+    CHECK(is_template("/channels/123/messages", true, "/channels/123/messages"));
+    CHECK(is_template("/applications/1/guilds/2/commands", true, "/applications/:id/guilds/:id/commands"));
+    CHECK(is_template("/channels/12a/messages", false, "/channels/12a/messages"));
+    CHECK(is_template("", true, ""));
+    CHECK(is_template("/", true, "/"));
+
+    char key[DISCORD_HTTP_BUCKET_KEY_LENGTH];
+
+    CHECK(!create_request_bucket(DISCORD_HTTP_GET, NULL, key, sizeof(key)));
+    CHECK(!create_request_bucket((discord_http_method)-1, "/gateway", key, sizeof(key)));
+}
+
+static void test_bucket_truncation(void){
+    char key[16];
+
+    /* "GET /channels/1" plus its NUL just fits */
+    CHECK(create_request_bucket(DISCORD_HTTP_GET, "/channels/1", key, sizeof(key)) && !strcmp(key, "GET /channels/1"));
+    CHECK(!create_request_bucket(DISCORD_HTTP_GET, "/channels/12", key, sizeof(key)));
+    CHECK(strlen(key) < sizeof(key));
+
+    /* placeholders count towards the length, not the ids they replace */
+    CHECK(!create_request_bucket(DISCORD_HTTP_GET, "/users/1/x", key, 8));
+    CHECK(create_request_bucket(DISCORD_HTTP_GET, "/users/1", key, 15) && !strcmp(key, "GET /users/:id"));
+    CHECK(!create_request_bucket(DISCORD_HTTP_GET, "/users/1", key, 14));
+    CHECK(!create_request_bucket(DISCORD_HTTP_DELETE, "/", key, 7));
+
+    char longpath[DISCORD_HTTP_BUCKET_KEY_LENGTH * 2];
+
+    memset(longpath, 'a', sizeof(longpath) - 1);
+    longpath[0] = '/';
+    longpath[sizeof(longpath) - 1] = '\0';
+
+    char longkey[DISCORD_HTTP_BUCKET_KEY_LENGTH];
+
+    CHECK(!create_request_bucket(DISCORD_HTTP_GET, longpath, longkey, sizeof(longkey)));
+    CHECK(strlen(longkey) < sizeof(longkey));
+}
+
+static void test_cache_routes(void){
+    CHECK(is_cache_route("/users/@me/guilds", "/users/:id/guilds"));
+    CHECK(is_cache_route("/users/@me", "/users/:id"));
+    CHECK(is_cache_route("/users/123/guilds", "/users/:id/guilds"));
+    CHECK(is_cache_route("/users/@meow", "/users/@meow"));
+    CHECK(is_cache_route("/channels/1/messages/2?limit=1", "/channels/1/messages/:id"));
+
+    CHECK(is_route_prefix("/channels/1", "/channels/1"));
+    CHECK(is_route_prefix("/channels/1", "/channels/1/messages"));
+    CHECK(is_route_prefix("/channels/1/messages/:id", "/channels/1/messages/:id/reactions/:emoji"));
+    CHECK(!is_route_prefix("/channels/1", "/channels/12"));
+    CHECK(!is_route_prefix("/channels/1/messages", "/channels/1"));
+    CHECK(!is_route_prefix("/channels/2", "/channels/1/messages"));
+}
+
+/* a snowflake created at the given unix time, the low bits tell ids apart */
+static snowflake create_snowflake(time_t created, uint64_t low){
+    return ((uint64_t)created * 1000 - TEST_DISCORD_EPOCH) << 22 | low;
+}
+
+static void test_delete_plan(void){
+    time_t cutoff = 1700000000;
+
+    snowflake old1 = create_snowflake(cutoff - 60, 1);
+    snowflake old2 = create_snowflake(cutoff, 2);
+    snowflake recent1 = create_snowflake(cutoff + 1, 3);
+    snowflake recent2 = create_snowflake(cutoff + 60, 4);
+    snowflake recent3 = create_snowflake(cutoff + 60, 5);
+
+    size_t old = 0;
+
+    /* sorted oldest first, duplicates dropped, the cutoff itself is old */
+    snowflake ids[] = {recent2, old2, recent1, old1, recent2, old2, recent3};
+
+    CHECK(plan_message_deletes(ids, 7, cutoff, &old) == 5);
+    CHECK(old == 2);
+    CHECK(ids[0] == old1 && ids[1] == old2 && ids[2] == recent1 && ids[3] == recent2 && ids[4] == recent3);
+
+    /* a lone recent id is deleted one by one too */
+    snowflake lone[] = {recent1, old1, recent1};
+
+    CHECK(plan_message_deletes(lone, 3, cutoff, &old) == 2);
+    CHECK(old == 2);
+
+    snowflake single[] = {recent1};
+
+    CHECK(plan_message_deletes(single, 1, cutoff, &old) == 1);
+    CHECK(old == 1);
+
+    snowflake pair[] = {recent2, recent1};
+
+    CHECK(plan_message_deletes(pair, 2, cutoff, &old) == 2);
+    CHECK(old == 0);
+    CHECK(pair[0] == recent1);
+
+    snowflake allold[] = {old2, old1};
+
+    CHECK(plan_message_deletes(allold, 2, cutoff, &old) == 2);
+    CHECK(old == 2);
+
+    CHECK(plan_message_deletes(ids, 0, cutoff, &old) == 0);
+    CHECK(old == 0);
+}
+
+static void test_delete_chunks(void){
+    CHECK(get_delete_chunk_length(0, 0) == 0);
+    CHECK(get_delete_chunk_length(2, 0) == 2);
+    CHECK(get_delete_chunk_length(2, 1) == 0);
+    CHECK(get_delete_chunk_length(100, 0) == 100);
+    CHECK(get_delete_chunk_length(100, 1) == 0);
+    CHECK(get_delete_chunk_length(101, 0) == 51);
+    CHECK(get_delete_chunk_length(101, 1) == 50);
+    CHECK(get_delete_chunk_length(200, 0) == 100);
+    CHECK(get_delete_chunk_length(200, 1) == 100);
+    CHECK(get_delete_chunk_length(201, 0) == 67);
+    CHECK(get_delete_chunk_length(201, 2) == 67);
+    CHECK(get_delete_chunk_length(201, 3) == 0);
+
+    /* the chunks cover every id and each one is a valid bulk-delete */
+    for (size_t recent = DISCORD_HTTP_BULK_DELETE_MIN; recent <= 10 * DISCORD_HTTP_BULK_DELETE_MAX; ++recent){
+        size_t total = 0;
+        size_t chunk = 0;
+        size_t chunklength = 0;
+        bool valid = true;
+
+        while ((chunklength = get_delete_chunk_length(recent, chunk++))){
+            valid = valid && chunklength >= DISCORD_HTTP_BULK_DELETE_MIN && chunklength <= DISCORD_HTTP_BULK_DELETE_MAX;
+            total += chunklength;
+        }
+
+        CHECK(valid && total == recent);
+        CHECK(chunk - 1 == (recent + DISCORD_HTTP_BULK_DELETE_MAX - 1) / DISCORD_HTTP_BULK_DELETE_MAX);
+    }
+}
+
+static void test_histogram(void){
+    for (uint64_t value = 0; value < DISCORD_HTTP_HISTOGRAM_LINEAR; ++value){
+        CHECK(get_histogram_index(value) == value && get_histogram_value(value) == value);
+    }
+
+    /* bucket bounds are contiguous up to where the last bucket saturates */
+    uint64_t lower = 0;
+
+    for (size_t index = 1; index < DISCORD_HTTP_HISTOGRAM_BUCKETS; ++index){
+        uint64_t upper = get_histogram_value(index);
+        uint64_t first = get_histogram_value(index - 1) + 1;
+
+        CHECK(upper >= first && upper > lower);
+        CHECK(get_histogram_index(first) == index);
+        CHECK(get_histogram_index(upper) == index);
+
+        lower = upper;
+    }
+
+    CHECK(get_histogram_index(lower + 1) == DISCORD_HTTP_HISTOGRAM_BUCKETS - 1);
+    CHECK(get_histogram_index(UINT64_MAX) == DISCORD_HTTP_HISTOGRAM_BUCKETS - 1);
+
+    discord_http_histogram histogram = {0};
+
+    for (uint64_t value = 1; value <= 1000; ++value){
+        record_histogram(&histogram, value * 1000);
+    }
+
+    uint64_t median = discord_http_histogram_percentile(&histogram, 50);
+
+    CHECK(histogram.count == 1000 && histogram.min == 1000 && histogram.max == 1000000);
+    CHECK(median >= 500000 && median <= 500000 + 500000 / DISCORD_HTTP_HISTOGRAM_SUBBUCKETS);
+    CHECK(discord_http_histogram_percentile(&histogram, 100) == 1000000);
+}
+
+int main(void){
+    test_buckets();
+    test_bucket_truncation();
+    test_cache_routes();
+    test_delete_plan();
+    test_delete_chunks();
+    test_histogram();
+
+    return CHECK_RESULT;
+}